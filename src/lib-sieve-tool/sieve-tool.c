@@ -275,6 +275,7 @@ struct sieve_instance *sieve_tool_init_finish
 	svenv.temp_dir = tool->mail_user_dovecot->set->mail_temp_dir;
 	svenv.location = SIEVE_ENV_LOCATION_MS;
 	svenv.delivery_phase = SIEVE_DELIVERY_PHASE_POST;
+	svenv.flags = SIEVE_FLAG_REGEX_CACHE;
 
 	/* Initialize Sieve Engine */
 	if ( (tool->svinst=sieve_init
@@ -304,6 +305,10 @@ void sieve_tool_deinit(struct sieve_tool **_tool)
 
 	/* Deinitialize Sieve engine */
 	sieve_deinit(&tool->svinst);
+	sieve_regex_cache_deinit();
+	sieve_storage_cache_deinit();
+	sieve_include_validation_cache_deinit();
+	sieve_program_workers_deinit();
 
 	/* Free options */
 
@@ -610,6 +615,11 @@ void sieve_tool_parse_trace_option
         tr_config->flags |= SIEVE_TRFLG_DEBUG;
     } else if ( strcmp(tr_option, "addresses") == 0 ) {
         tr_config->flags |= SIEVE_TRFLG_ADDRESSES;
+    } else if ( strncmp(tr_option, "sample=", 7) == 0 ) {
+        if ( str_to_uint(&tr_option[7], &tr_config->sample_interval) < 0 ) {
+            i_fatal_status(EX_USAGE,
+                "Invalid -Tsample= trace sample interval: %s", &tr_option[7]);
+        }
     } else {
         i_fatal_status(EX_USAGE, "Unknown -t trace option value: %s", tr_option);
     }
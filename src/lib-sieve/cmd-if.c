@@ -1,6 +1,9 @@
 /* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
  */
 
+#include "lib.h"
+#include "array.h"
+
 #include "sieve-common.h"
 #include "sieve-commands.h"
 #include "sieve-validator.h"
@@ -83,6 +86,8 @@ const struct sieve_command_def cmd_else = {
  */
 
 struct cmd_if_context_data {
+	struct sieve_command *cmd;
+
 	struct cmd_if_context_data *previous;
 	struct cmd_if_context_data *next;
 
@@ -90,6 +95,12 @@ struct cmd_if_context_data {
 
 	bool jump_generated;
 	sieve_size_t exit_jump;
+
+	/* Test is part of a dispatch operation (see tst-header.c) */
+	bool dispatched;
+	bool dispatch_last;
+	sieve_size_t dispatch_jump;
+	sieve_size_t dispatch_default_jump;
 };
 
 static void cmd_if_initialize_context_data
@@ -99,6 +110,7 @@ static void cmd_if_initialize_context_data
 
 	/* Assign context */
 	cmd_data = p_new(sieve_command_pool(cmd), struct cmd_if_context_data, 1);
+	cmd_data->cmd = cmd;
 	cmd_data->exit_jump = 0;
 	cmd_data->jump_generated = FALSE;
 
@@ -203,6 +215,65 @@ static void cmd_if_resolve_exit_jumps
 	}
 }
 
+static struct sieve_command *cmd_if_dispatch_test
+(struct cmd_if_context_data *cmd_data)
+{
+	struct sieve_ast_node *test;
+
+	if ( cmd_data->const_condition >= 0 ||
+		sieve_command_is(cmd_data->cmd, cmd_else) )
+		return NULL;
+
+	test = sieve_ast_test_first(cmd_data->cmd->ast_node);
+	if ( test == NULL || sieve_ast_test_next(test) != NULL )
+		return NULL;
+	return test->command;
+}
+
+static bool cmd_if_generate_dispatch
+(const struct sieve_codegen_env *cgenv, struct cmd_if_context_data *cmd_data)
+{
+	ARRAY(struct sieve_command *) tests;
+	struct cmd_if_context_data *if_ctx;
+	struct sieve_command *first, *test;
+	sieve_size_t *branch_jumps, default_jump;
+	unsigned int count, i;
+
+	/* Find the run of subsequent tests that can be dispatched at once */
+	if ( (first=cmd_if_dispatch_test(cmd_data)) == NULL )
+		return TRUE;
+
+	t_array_init(&tests, 8);
+	array_append(&tests, &first, 1);
+	for ( if_ctx = cmd_data->next; if_ctx != NULL; if_ctx = if_ctx->next ) {
+		if ( (test=cmd_if_dispatch_test(if_ctx)) == NULL ||
+			!tst_header_dispatch_compatible(first, test) )
+			break;
+		array_append(&tests, &test, 1);
+	}
+
+	count = array_count(&tests);
+	if ( count < 2 )
+		return TRUE;
+
+	branch_jumps = t_new(sieve_size_t, count);
+	if ( !tst_header_dispatch_generate(cgenv, array_idx(&tests, 0), count,
+		branch_jumps, &default_jump) )
+		return FALSE;
+
+	if_ctx = cmd_data;
+	for ( i = 0; i < count; i++ ) {
+		if_ctx->dispatched = TRUE;
+		if_ctx->dispatch_jump = branch_jumps[i];
+		if ( i == count - 1 ) {
+			if_ctx->dispatch_last = TRUE;
+			if_ctx->dispatch_default_jump = default_jump;
+		}
+		if_ctx = if_ctx->next;
+	}
+	return TRUE;
+}
+
 static bool cmd_if_generate
 (const struct sieve_codegen_env *cgenv, struct sieve_command *cmd)
 {
@@ -212,8 +283,15 @@ static bool cmd_if_generate
 	struct sieve_ast_node *test;
 	struct sieve_jumplist jmplist;
 
+	/* Merge the tests of a run of if/elsif commands if possible */
+	if ( !cmd_data->dispatched && !cmd_if_generate_dispatch(cgenv, cmd_data) )
+		return FALSE;
+
 	/* Generate test condition */
-	if ( cmd_data->const_condition < 0 ) {
+	if ( cmd_data->dispatched ) {
+		/* Dispatch operation jumps here when this test matches */
+		sieve_binary_resolve_offset(sblock, cmd_data->dispatch_jump);
+	} else if ( cmd_data->const_condition < 0 ) {
 		/* Prepare jumplist */
 		sieve_jumplist_init_temp(&jmplist, sblock);
 
@@ -246,7 +324,13 @@ static bool cmd_if_generate
 		}
 	}
 
-	if ( cmd_data->const_condition < 0 ) {
+	if ( cmd_data->dispatched ) {
+		/* Dispatch operation jumps here when none of its tests match */
+		if ( cmd_data->dispatch_last ) {
+			sieve_binary_resolve_offset
+				(sblock, cmd_data->dispatch_default_jump);
+		}
+	} else if ( cmd_data->const_condition < 0 ) {
 		/* Case false ... (subsequent elsif/else commands might generate more) */
 		sieve_jumplist_resolve(&jmplist);
 	}
@@ -3,6 +3,8 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "array.h"
+#include "str.h"
 #include "str-sanitize.h"
 #include "strfuncs.h"
 #include "istream.h"
@@ -85,6 +87,8 @@ static int act_redirect_check_duplicate
 	(const struct sieve_runtime_env *renv,
 		const struct sieve_action *act,
 		const struct sieve_action *act_other);
+static const char *act_redirect_get_duplicate_key
+	(const struct sieve_script_env *senv, const struct sieve_action *action);
 static void act_redirect_print
 	(const struct sieve_action *action, const struct sieve_result_print_env *rpenv,
 		bool *keep);
@@ -97,13 +101,22 @@ const struct sieve_action_def act_redirect = {
 	.flags = SIEVE_ACTFLAG_TRIES_DELIVER,
 	.equals = act_redirect_equals,
 	.check_duplicate = act_redirect_check_duplicate,
+	.get_duplicate_key = act_redirect_get_duplicate_key,
 	.print = act_redirect_print,
 	.commit = act_redirect_commit
 };
 
 struct act_redirect_context {
 	const char *to_address;
+
+	/* Duplicate ID, determined upon commit */
+	const char *dupeid;
+
+	/* Message was sent along with a preceding redirect */
+	int batch_status;
+	bool batched;
 };
+ARRAY_DEFINE_TYPE(act_redirect_context, struct act_redirect_context *);
 
 /*
  * Validation
@@ -292,6 +305,17 @@ static int act_redirect_check_duplicate
 	return ( act_redirect_equals(renv->scriptenv, act, act_other) ? 1 : 0 );
 }
 
+static const char *act_redirect_get_duplicate_key
+(const struct sieve_script_env *senv ATTR_UNUSED,
+	const struct sieve_action *action)
+{
+	struct act_redirect_context *ctx =
+		(struct act_redirect_context *) action->context;
+
+	/* Addresses are compared case-insensitively */
+	return t_str_lcase(ctx->to_address);
+}
+
 static void act_redirect_print
 (const struct sieve_action *action,
 	const struct sieve_result_print_env *rpenv, bool *keep)
@@ -305,10 +329,25 @@ static void act_redirect_print
 	*keep = FALSE;
 }
 
+static const char *act_redirect_get_addresses
+(struct act_redirect_context *const *ctxs, unsigned int count)
+{
+	string_t *addresses = t_str_new(128);
+	unsigned int i;
+
+	for ( i = 0; i < count; i++ ) {
+		if ( i > 0 )
+			str_append(addresses, ", ");
+		str_printfa(addresses, "<%s>",
+			str_sanitize(ctxs[i]->to_address, 128));
+	}
+	return str_c(addresses);
+}
+
 static int act_redirect_send
 (const struct sieve_action_exec_env *aenv, struct mail *mail,
-	struct act_redirect_context *ctx, const char *new_msg_id)
-	ATTR_NULL(4)
+	struct act_redirect_context *const *ctxs, unsigned int count,
+	const char *new_msg_id) ATTR_NULL(5)
 {
 	static const char *hide_headers[] =
 		{ "Return-Path", "X-Sieve", "X-Sieve-Redirected-From" };
@@ -323,6 +362,7 @@ static int act_redirect_send
 	struct ostream *output;
 	const char *error;
 	struct sieve_smtp_context *sctx;
+	unsigned int i;
 	int ret;
 
 	/* Just to be sure */
@@ -369,8 +409,11 @@ static int act_redirect_send
 		}
 	}
 
-	/* Open SMTP transport */
-	sctx = sieve_smtp_start_single(senv, ctx->to_address, sender, &output);
+	/* Open SMTP transport; all recipients share one transaction */
+	sctx = sieve_smtp_start(senv, sender);
+	for ( i = 0; i < count; i++ )
+		sieve_smtp_add_rcpt(sctx, ctxs[i]->to_address);
+	output = sieve_smtp_send(sctx);
 
 	/* Remove unwanted headers */
 	input = i_stream_create_header_filter
@@ -408,22 +451,99 @@ static int act_redirect_send
 	if ( (ret=sieve_smtp_finish(sctx, &error)) <= 0 ) {
 		if ( ret < 0 ) {
 			sieve_result_global_error(aenv,
-				"failed to redirect message to <%s>: %s "
+				"failed to redirect message to %s: %s "
 				"(temporary failure)",
-				str_sanitize(ctx->to_address, 256), str_sanitize(error, 512));
+				act_redirect_get_addresses(ctxs, count),
+				str_sanitize(error, 512));
 			return SIEVE_EXEC_TEMP_FAILURE;
 		}
 
 		sieve_result_global_log_error(aenv,
-			"failed to redirect message to <%s>: %s "
+			"failed to redirect message to %s: %s "
 			"(permanent failure)",
-			str_sanitize(ctx->to_address, 256), str_sanitize(error, 512));
+			act_redirect_get_addresses(ctxs, count),
+			str_sanitize(error, 512));
 		return SIEVE_EXEC_FAILURE;
 	}
 
 	return SIEVE_EXEC_OK;
 }
 
+static struct mail *act_redirect_get_mail
+(const struct sieve_action *action, const struct sieve_action_exec_env *aenv)
+{
+	return ( action->mail != NULL ?
+		action->mail : sieve_message_get_mail(aenv->msgctx) );
+}
+
+static void act_redirect_get_batch
+(const struct sieve_action *action, const struct sieve_action_exec_env *aenv,
+	struct mail *mail, const char *dupeid_prefix, const char *dupeid_suffix,
+	ARRAY_TYPE(act_redirect_context) *batch)
+{
+	const struct sieve_script_env *senv = aenv->scriptenv;
+	pool_t pool = sieve_result_pool(aenv->result);
+	struct sieve_result_iterate_context *rictx;
+	const struct sieve_action *act;
+	bool found = FALSE;
+
+	/* Redirects directly following this one that send the same message are
+	   sent in the same SMTP transaction. Only adjacent actions are
+	   considered, so that the order of outgoing messages is retained. */
+	rictx = sieve_result_iterate_init(aenv->result);
+	while ( (act=sieve_result_iterate_next(rictx, NULL)) != NULL ) {
+		struct act_redirect_context *ctx;
+		const char *dupeid;
+
+		if ( !found ) {
+			found = ( act == action );
+			continue;
+		}
+
+		if ( !sieve_action_is(act, act_redirect) || act->executed ||
+			act_redirect_get_mail(act, aenv) != mail )
+			break;
+
+		ctx = (struct act_redirect_context *) act->context;
+		if ( ctx->batched )
+			break;
+
+		/* Duplicates are left to the action itself */
+		dupeid = t_strconcat
+			(dupeid_prefix, ctx->to_address, dupeid_suffix, NULL);
+		if ( sieve_action_duplicate_check(senv, dupeid, strlen(dupeid)) )
+			continue;
+
+		ctx->dupeid = p_strdup(pool, dupeid);
+		array_append(batch, &ctx, 1);
+	}
+}
+
+static int act_redirect_finish
+(const struct sieve_action_exec_env *aenv, struct act_redirect_context *ctx,
+	int status, bool *keep)
+{
+	const struct sieve_script_env *senv = aenv->scriptenv;
+
+	if ( status != SIEVE_EXEC_OK )
+		return status;
+
+	/* Mark this message id as forwarded to the specified destination */
+	sieve_action_duplicate_mark(senv, ctx->dupeid, strlen(ctx->dupeid),
+		ioloop_time + CMD_REDIRECT_DUPLICATE_KEEP);
+
+	sieve_result_global_log(aenv, "forwarded to <%s>",
+		str_sanitize(ctx->to_address, 128));
+
+	/* Indicate that message was successfully forwarded */
+	aenv->exec_status->message_forwarded = TRUE;
+
+	/* Cancel implicit keep */
+	*keep = FALSE;
+
+	return SIEVE_EXEC_OK;
+}
+
 static int act_redirect_commit
 (const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void *tr_context ATTR_UNUSED,
@@ -431,16 +551,23 @@ static int act_redirect_commit
 {
 	struct act_redirect_context *ctx =
 		(struct act_redirect_context *) action->context;
-	struct mail *mail =	( action->mail != NULL ?
-		action->mail : sieve_message_get_mail(aenv->msgctx) );
+	struct mail *mail =	act_redirect_get_mail(action, aenv);
 	const struct sieve_message_data *msgdata = aenv->msgdata;
 	const struct sieve_script_env *senv = aenv->scriptenv;
 	const char *orig_recipient = sieve_message_get_orig_recipient(aenv->msgctx);
 	const char *msg_id = msgdata->id, *new_msg_id = NULL;
-	const char *dupeid = NULL, *resent_id = NULL;
+	const char *dupeid_prefix, *dupeid_suffix, *dupeid = NULL;
+	const char *resent_id = NULL;
 	const char *list_id = NULL;
+	ARRAY_TYPE(act_redirect_context) batch;
+	struct act_redirect_context *const *ctxs;
+	unsigned int count, i;
 	int ret;
 
+	/* Message was already sent along with a preceding redirect */
+	if ( ctx->batched )
+		return act_redirect_finish(aenv, ctx, ctx->batch_status, keep);
+
 	/*
 	 * Prevent mail loops
 	 */
@@ -478,10 +605,12 @@ static int act_redirect_commit
 		   the original message
 	   - if the message came through a mailing list: the mailinglist ID
 	 */
-	dupeid = t_strdup_printf("%s-%s-%s-%s-%s", msg_id,
-		orig_recipient, ctx->to_address,
+	dupeid_prefix = t_strdup_printf("%s-%s-", msg_id, orig_recipient);
+	dupeid_suffix = t_strdup_printf("-%s-%s",
 		(resent_id != NULL ? resent_id : ""),
 		(list_id != NULL ? list_id : ""));
+	dupeid = t_strconcat
+		(dupeid_prefix, ctx->to_address, dupeid_suffix, NULL);
 
 	/* Check whether we've seen this message before */
 	if (sieve_action_duplicate_check
@@ -492,33 +621,25 @@ static int act_redirect_commit
 		*keep = FALSE;
 		return SIEVE_EXEC_OK;
 	}
+	ctx->dupeid = dupeid;
 
 	/*
 	 * Try to forward the message
 	 */
 
-	if ( (ret=act_redirect_send
-		(aenv, mail, ctx, new_msg_id)) == SIEVE_EXEC_OK) {
+	t_array_init(&batch, 4);
+	array_append(&batch, &ctx, 1);
+	act_redirect_get_batch(action, aenv, mail,
+		dupeid_prefix, dupeid_suffix, &batch);
 
-		/* Mark this message id as forwarded to the specified destination */
-		if (dupeid != NULL) {
-			sieve_action_duplicate_mark(senv, dupeid, strlen(dupeid),
-				ioloop_time + CMD_REDIRECT_DUPLICATE_KEEP);
-		}
+	ctxs = array_get(&batch, &count);
+	for ( i = 1; i < count; i++ )
+		ctxs[i]->batched = TRUE;
 
-		sieve_result_global_log(aenv, "forwarded to <%s>",
-			str_sanitize(ctx->to_address, 128));
+	ret = act_redirect_send(aenv, mail, ctxs, count, new_msg_id);
 
-		/* Indicate that message was successfully forwarded */
-		aenv->exec_status->message_forwarded = TRUE;
+	for ( i = 1; i < count; i++ )
+		ctxs[i]->batch_status = ret;
 
-		/* Cancel implicit keep */
-		*keep = FALSE;
-
-		return SIEVE_EXEC_OK;
-	}
-
-	return ret;
+	return act_redirect_finish(aenv, ctx, ret, keep);
 }
-
-
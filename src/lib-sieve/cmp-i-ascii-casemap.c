@@ -24,6 +24,9 @@ static int cmp_i_ascii_casemap_compare
 static bool cmp_i_ascii_casemap_char_match
 	(const struct sieve_comparator *cmp, const char **val1, const char *val1_end,
 		const char **val2, const char *val2_end);
+static bool cmp_i_ascii_casemap_substring_find
+	(const struct sieve_comparator *cmp, const char **val, const char *val_end,
+		const char *key, const char *key_end);
 
 /*
  * Comparator object
@@ -39,7 +42,8 @@ const struct sieve_comparator_def i_ascii_casemap_comparator = {
 		SIEVE_COMPARATOR_FLAG_PREFIX_MATCH,
 	.compare = cmp_i_ascii_casemap_compare,
 	.char_match = cmp_i_ascii_casemap_char_match,
-	.char_skip = sieve_comparator_octet_skip
+	.char_skip = sieve_comparator_octet_skip,
+	.substring_find = cmp_i_ascii_casemap_substring_find
 };
 
 /*
@@ -96,4 +100,60 @@ static bool cmp_i_ascii_casemap_char_match
 	return TRUE;
 }
 
+static inline const char *_find_char
+(const char *vp, const char *vlast, char c)
+{
+	const char *p = memchr(vp, c, vlast - vp + 1);
+
+	return ( p == NULL ? vlast + 1 : p );
+}
+
+static bool cmp_i_ascii_casemap_substring_find
+	(const struct sieve_comparator *cmp ATTR_UNUSED,
+		const char **val, const char *val_end,
+		const char *key, const char *key_end)
+{
+	size_t key_size = key_end - key, i;
+	const char *vp = *val, *vlast;
+	const char *next_lower, *next_upper;
+	char lower, upper;
+
+	if ( key_size == 0 )
+		return TRUE;
+	if ( (size_t)(val_end - vp) < key_size )
+		return FALSE;
 
+	lower = i_tolower(key[0]);
+	upper = i_toupper(key[0]);
+
+	/* Scan for the first key character using memchr(), which is normally
+	   vectorized by the C library, and verify the rest case-insensitively */
+	vlast = val_end - key_size;
+	next_lower = _find_char(vp, vlast, lower);
+	next_upper = ( lower == upper ? NULL : _find_char(vp, vlast, upper) );
+	for (;;) {
+		/* Find the next occurrence of either case of the first character. The
+		   position found for each case is remembered, so that the value is
+		   scanned only once for each. */
+		if ( next_lower < vp )
+			next_lower = _find_char(vp, vlast, lower);
+		if ( next_upper != NULL && next_upper < vp )
+			next_upper = _find_char(vp, vlast, upper);
+
+		vp = ( next_upper == NULL || next_lower < next_upper ?
+			next_lower : next_upper );
+		if ( vp > vlast )
+			return FALSE;
+
+		for ( i = 1; i < key_size; i++ ) {
+			if ( i_tolower(vp[i]) != i_tolower(key[i]) )
+				break;
+		}
+
+		if ( i == key_size ) {
+			*val = vp + key_size;
+			return TRUE;
+		}
+		vp++;
+	}
+}
@@ -23,6 +23,9 @@ static int cmp_i_octet_compare
 static bool cmp_i_octet_char_match
 	(const struct sieve_comparator *cmp, const char **val1, const char *val1_end,
 		const char **val2, const char *val2_end);
+static bool cmp_i_octet_substring_find
+	(const struct sieve_comparator *cmp, const char **val, const char *val_end,
+		const char *key, const char *key_end);
 
 /*
  * Comparator object
@@ -38,7 +41,8 @@ const struct sieve_comparator_def i_octet_comparator = {
 		SIEVE_COMPARATOR_FLAG_PREFIX_MATCH,
 	.compare = cmp_i_octet_compare,
 	.char_match = cmp_i_octet_char_match,
-	.char_skip = sieve_comparator_octet_skip
+	.char_skip = sieve_comparator_octet_skip,
+	.substring_find = cmp_i_octet_substring_find
 };
 
 /*
@@ -94,4 +98,33 @@ static bool cmp_i_octet_char_match
 	return TRUE;
 }
 
+static bool cmp_i_octet_substring_find
+	(const struct sieve_comparator *cmp ATTR_UNUSED,
+		const char **val, const char *val_end,
+		const char *key, const char *key_end)
+{
+	size_t key_size = key_end - key;
+	const char *vp = *val, *vlast;
+
+	if ( key_size == 0 )
+		return TRUE;
+	if ( (size_t)(val_end - vp) < key_size )
+		return FALSE;
+
+	/* Scan for the first key character using memchr(), which is normally
+	   vectorized by the C library, and verify the rest with memcmp() */
+	vlast = val_end - key_size;
+	while ( vp <= vlast ) {
+		vp = memchr(vp, key[0], vlast - vp + 1);
+		if ( vp == NULL )
+			return FALSE;
+
+		if ( memcmp(vp + 1, key + 1, key_size - 1) == 0 ) {
+			*val = vp + key_size;
+			return TRUE;
+		}
+		vp++;
+	}
 
+	return FALSE;
+}
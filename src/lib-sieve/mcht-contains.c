@@ -36,9 +36,6 @@ const struct sieve_match_type_def contains_match_type = {
  * Match-type implementation
  */
 
-/* FIXME: Naive substring match implementation. Should switch to more
- * efficient algorithm if large values need to be searched (e.g. message body).
- */
 static int mcht_contains_match_key
 (struct sieve_match_context *mctx, const char *val, size_t val_size,
 	const char *key, size_t key_size)
@@ -52,15 +49,11 @@ static int mcht_contains_match_key
 	if ( val_size == 0 )
 		return ( key_size == 0 );
 
-	if ( cmp->def == NULL || cmp->def->char_match == NULL )
+	if ( cmp->def == NULL || (cmp->def->char_match == NULL &&
+		cmp->def->substring_find == NULL) )
 		return FALSE;
 
-	while ( (vp < vend) && (kp < kend) ) {
-		if ( !cmp->def->char_match(cmp, &vp, vend, &kp, kend) )
-			vp++;
-	}
-
-	return (kp == kend);
+	return sieve_comparator_find_substring(cmp, &vp, vend, &kp, kend);
 }
 
 
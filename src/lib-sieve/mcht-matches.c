@@ -45,19 +45,6 @@ const struct sieve_match_type_def matches_match_type = {
 #define debug_printf(...)
 #endif
 
-/* FIXME: Naive implementation, substitute this with dovecot src/lib/str-find.c
- */
-static inline bool _string_find(const struct sieve_comparator *cmp,
-	const char **valp, const char *vend, const char **keyp, const char *kend)
-{
-	while ( (*valp < vend) && (*keyp < kend) ) {
-		if ( !cmp->def->char_match(cmp, valp, vend, keyp, kend) )
-			(*valp)++;
-	}
-
-	return (*keyp == kend);
-}
-
 static char _scan_key_section
 	(string_t *section, const char **wcardp, const char *key_end)
 {
@@ -266,7 +253,7 @@ static int mcht_matches_match_key
 
 				/* Match may happen at any offset (>= key offset): find substring */
 				vp += key_offset;
-				if ( (vp >= vend) || !_string_find(cmp, &vp, vend, &needle, nend) ) {
+				if ( (vp >= vend) || !sieve_comparator_find_substring(cmp, &vp, vend, &needle, nend) ) {
 					debug_printf("  failed to find needle at an offset\n");
 					break;
 				}
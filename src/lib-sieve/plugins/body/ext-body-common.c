@@ -12,8 +12,11 @@
 #include "sieve-common.h"
 #include "sieve-stringlist.h"
 #include "sieve-code.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
 #include "sieve-message.h"
 #include "sieve-interpreter.h"
+#include "sieve-runtime-trace.h"
 
 #include "ext-body-common.h"
 
@@ -100,3 +103,186 @@ static void ext_body_stringlist_reset
 
 	strlist->body_parts_iter = strlist->body_parts;
 }
+
+/*
+ * Streaming body match
+ */
+
+/* For the :contains match type, the body parts are matched incrementally
+ * while they are read, so that large messages need not be held in memory.
+ * The last bytes of each chunk are carried over to the next, so that keys
+ * spanning a chunk boundary are found as well.
+ */
+
+struct ext_body_stream_key {
+	const char *data;
+	size_t size;
+};
+
+struct ext_body_stream_match_context {
+	const struct sieve_comparator *cmp;
+
+	ARRAY(struct ext_body_stream_key) keys;
+	size_t max_key_size;
+
+	/* Tail of the data read so far from the current part */
+	buffer_t *carry;
+
+	unsigned int matched:1;
+};
+
+bool ext_body_stream_match_supported
+(const struct sieve_match_type *mcht, const struct sieve_comparator *cmp)
+{
+	/* Carry-over assumes keys match the same number of value octets, which
+	   holds for the comparators that implement substring_find() */
+	return ( sieve_match_type_is(mcht, contains_match_type) &&
+		cmp->def != NULL && cmp->def->substring_find != NULL );
+}
+
+static bool ext_body_stream_find
+(struct ext_body_stream_match_context *mctx, const unsigned char *data,
+	size_t size)
+{
+	const struct ext_body_stream_key *keys;
+	unsigned int count, i;
+
+	keys = array_get(&mctx->keys, &count);
+	for ( i = 0; i < count; i++ ) {
+		const char *vp = (const char *)data, *vend = vp + size;
+		const char *kp = keys[i].data, *kend = kp + keys[i].size;
+
+		if ( sieve_comparator_find_substring(mctx->cmp, &vp, vend, &kp, kend) )
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static int ext_body_stream_match_more
+(void *context, const unsigned char *data, size_t size)
+{
+	struct ext_body_stream_match_context *mctx =
+		(struct ext_body_stream_match_context *)context;
+	size_t tail = mctx->max_key_size - 1;
+
+	/* Find keys starting in the carried-over tail of the previous chunk */
+	if ( mctx->carry->used > 0 ) {
+		buffer_append(mctx->carry, data, I_MIN(size, tail));
+		if ( ext_body_stream_find(mctx, mctx->carry->data, mctx->carry->used) ) {
+			mctx->matched = TRUE;
+			return 1;
+		}
+	}
+
+	/* Find keys within this chunk */
+	if ( ext_body_stream_find(mctx, data, size) ) {
+		mctx->matched = TRUE;
+		return 1;
+	}
+
+	/* Retain the tail for the next chunk */
+	if ( size >= tail ) {
+		buffer_set_used_size(mctx->carry, 0);
+		buffer_append(mctx->carry, data + size - tail, tail);
+	} else if ( mctx->carry->used > tail ) {
+		buffer_delete(mctx->carry, 0, mctx->carry->used - tail);
+	} else if ( mctx->carry->used == 0 ) {
+		buffer_append(mctx->carry, data, size);
+	}
+	return 0;
+}
+
+static void ext_body_stream_match_part_end(void *context)
+{
+	struct ext_body_stream_match_context *mctx =
+		(struct ext_body_stream_match_context *)context;
+
+	/* Body parts are matched separately */
+	buffer_set_used_size(mctx->carry, 0);
+}
+
+static const struct sieve_message_body_sink ext_body_stream_match_sink = {
+	ext_body_stream_match_more,
+	ext_body_stream_match_part_end
+};
+
+int ext_body_stream_match
+(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
+	const char * const *content_types, const struct sieve_comparator *cmp,
+	struct sieve_stringlist *key_list, int *exec_status)
+{
+	struct ext_body_stream_match_context mctx;
+	string_t *key_item;
+	int ret;
+
+	*exec_status = SIEVE_EXEC_OK;
+
+	memset(&mctx, 0, sizeof(mctx));
+	mctx.cmp = cmp;
+	t_array_init(&mctx.keys, 8);
+
+	/* Read all keys */
+	sieve_stringlist_reset(key_list);
+	while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+		struct ext_body_stream_key *key;
+
+		/* The empty key matches any body part, including empty ones */
+		if ( str_len(key_item) == 0 ) {
+			struct sieve_stringlist *value_list;
+			string_t *value;
+
+			if ( (ret=ext_body_get_part_list
+				(renv, transform, content_types, &value_list)) <= 0 ) {
+				*exec_status = ret;
+				return -1;
+			}
+			if ( (ret=sieve_stringlist_next_item(value_list, &value)) < 0 ) {
+				*exec_status = value_list->exec_status;
+				return -1;
+			}
+			return ret;
+		}
+
+		key = array_append_space(&mctx.keys);
+		key->data = t_strdup_noconst(str_c(key_item));
+		key->size = str_len(key_item);
+		if ( key->size > mctx.max_key_size )
+			mctx.max_key_size = key->size;
+	}
+	if ( ret < 0 ) {
+		*exec_status = key_list->exec_status;
+		return -1;
+	}
+	if ( array_count(&mctx.keys) == 0 )
+		return 0;
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_MATCHING,
+		"matching %u keys while streaming body",
+		array_count(&mctx.keys));
+
+	mctx.carry = buffer_create_dynamic(pool_datastack_create(),
+		2 * mctx.max_key_size);
+
+	switch ( transform ) {
+	case TST_BODY_TRANSFORM_RAW:
+		ret = sieve_message_body_stream_raw
+			(renv, &ext_body_stream_match_sink, &mctx);
+		break;
+	case TST_BODY_TRANSFORM_CONTENT:
+		ret = sieve_message_body_stream_content
+			(renv, content_types, &ext_body_stream_match_sink, &mctx);
+		break;
+	case TST_BODY_TRANSFORM_TEXT:
+		ret = sieve_message_body_stream_text
+			(renv, &ext_body_stream_match_sink, &mctx);
+		break;
+	default:
+		i_unreached();
+	}
+
+	if ( ret <= 0 ) {
+		*exec_status = ret;
+		return -1;
+	}
+	return ( mctx.matched ? 1 : 0 );
+}
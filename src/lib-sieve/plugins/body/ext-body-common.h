@@ -40,4 +40,15 @@ int ext_body_get_part_list
 	(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
 		const char * const *content_types, struct sieve_stringlist **strlist_r);
 
+/*
+ * Streaming body match
+ */
+
+bool ext_body_stream_match_supported
+	(const struct sieve_match_type *mcht, const struct sieve_comparator *cmp);
+int ext_body_stream_match
+	(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
+		const char * const *content_types, const struct sieve_comparator *cmp,
+		struct sieve_stringlist *key_list, int *exec_status);
+
 #endif /* __EXT_BODY_COMMON_H */
@@ -362,6 +362,18 @@ static int ext_body_operation_execute
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "body test");
 
+	/* Match :contains while reading the body */
+	if ( ext_body_stream_match_supported(&mcht, &cmp) ) {
+		if ( (match=ext_body_stream_match(renv,
+			(enum tst_body_transform) transform, content_types, &cmp, key_list,
+			&ret)) < 0 )
+			return ret;
+
+		/* Set test result for subsequent conditional jump */
+		sieve_interpreter_set_test_result(renv->interp, match > 0);
+		return SIEVE_EXEC_OK;
+	}
+
 	/* Extract requested parts */
 	if ( (ret=ext_body_get_part_list(renv,
 		(enum tst_body_transform) transform, content_types,&value_list)) <= 0 )
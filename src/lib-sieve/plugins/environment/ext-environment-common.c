@@ -39,10 +39,14 @@ struct ext_environment_interpreter_context {
 static void ext_environment_interpreter_extension_free
 	(const struct sieve_extension *ext, struct sieve_interpreter *interp,
 		void *context);
+static void ext_environment_interpreter_extension_reset
+	(const struct sieve_extension *ext, struct sieve_interpreter *interp,
+		void *context);
 
 struct sieve_interpreter_extension environment_interpreter_extension = {
 	.ext_def = &environment_extension,
 	.free = ext_environment_interpreter_extension_free,
+	.reset = ext_environment_interpreter_extension_reset,
 };
 
 static struct ext_environment_interpreter_context *
@@ -72,6 +76,14 @@ static void ext_environment_interpreter_extension_free
 	hash_table_destroy(&ctx->environment_items);
 }
 
+static void ext_environment_interpreter_extension_reset
+(const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_interpreter *interp ATTR_UNUSED,
+	void *context ATTR_UNUSED)
+{
+	/* Items are only registered while loading; nothing changes at runtime */
+}
+
 static struct ext_environment_interpreter_context *
 ext_environment_interpreter_context_get
 (const struct sieve_extension *this_ext, struct sieve_interpreter *interp)
@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "hash.h"
 
 #include "sieve-common.h"
 #include "sieve-error.h"
@@ -12,6 +13,7 @@
 #include "sieve-generator.h"
 #include "sieve-interpreter.h"
 #include "sieve-dump.h"
+#include "sieve.h"
 
 #include "sieve-ext-variables.h"
 
@@ -20,6 +22,12 @@
 #include "ext-include-variables.h"
 #include "ext-include-binary.h"
 
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#endif
+
 /*
  * Forward declarations
  */
@@ -197,6 +205,288 @@ struct sieve_variable_scope_binary *ext_include_binary_get_global_scope
 	return binctx->global_vars;
 }
 
+/*
+ * Dependency validation cache
+ */
+
+/* Validating the dependencies of a binary means opening each included script
+   and checking its metadata. For included script files, the outcome is
+   remembered for the lifetime of the process, so that it can be reused for
+   scripts that have not changed since. Whether a script changed is checked
+   with a single stat() or, in inotify mode, not at all until a change is
+   reported. */
+
+#define EXT_INCLUDE_VALIDATION_CACHE_MAX_ENTRIES 1024
+
+#define EXT_INCLUDE_INOTIFY_EVENTS \
+	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+struct ext_include_validation {
+	char *key;
+
+	/* Metadata in the binary */
+	time_t bin_mtime;
+	char *driver_name, *location;
+	unsigned int version;
+
+	/* Script file */
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+
+	/* Watch descriptor, or -1 */
+	int wd;
+};
+
+static HASH_TABLE(char *, struct ext_include_validation *)
+	include_validations;
+#ifdef HAVE_SYS_INOTIFY_H
+static int include_inotify_fd = -1;
+#endif
+
+static void ext_include_validation_free
+(struct ext_include_validation *valid)
+{
+	i_free(valid->key);
+	i_free(valid->driver_name);
+	i_free(valid->location);
+	i_free(valid->path);
+	i_free(valid);
+}
+
+static void ext_include_validation_remove
+(struct ext_include_validation *valid)
+{
+	hash_table_remove(include_validations, valid->key);
+	ext_include_validation_free(valid);
+}
+
+static void ext_include_validation_clear(void)
+{
+	struct hash_iterate_context *iter;
+	struct ext_include_validation *valid;
+	char *key;
+
+	iter = hash_table_iterate_init(include_validations);
+	while ( hash_table_iterate(iter, include_validations, &key, &valid) )
+		ext_include_validation_remove(valid);
+	hash_table_iterate_deinit(&iter);
+
+#ifdef HAVE_SYS_INOTIFY_H
+	/* Drop all watches at once */
+	if ( include_inotify_fd != -1 ) {
+		if ( close(include_inotify_fd) < 0 )
+			i_error("include: close(inotify) failed: %m");
+		include_inotify_fd = -1;
+	}
+#endif
+}
+
+static const char *ext_include_validation_key
+(struct sieve_binary *sbin, struct sieve_script *script)
+{
+	const char *bin_path = sieve_binary_path(sbin);
+
+	if ( bin_path == NULL )
+		return NULL;
+	return t_strconcat(bin_path, "\n", sieve_script_location(script), NULL);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+static void ext_include_validation_invalidate(int wd)
+{
+	struct hash_iterate_context *iter;
+	struct ext_include_validation *valid;
+	char *key;
+
+	iter = hash_table_iterate_init(include_validations);
+	while ( hash_table_iterate(iter, include_validations, &key, &valid) ) {
+		if ( valid->wd == wd )
+			ext_include_validation_remove(valid);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static void ext_include_validation_read_events
+(struct sieve_instance *svinst)
+{
+	union {
+		struct inotify_event event;
+		char data[4096];
+	} buf;
+	const struct inotify_event *event;
+	size_t pos;
+	ssize_t ret;
+
+	if ( include_inotify_fd == -1 ||
+		!hash_table_is_created(include_validations) )
+		return;
+
+	while ( (ret=read(include_inotify_fd, buf.data, sizeof(buf.data))) > 0 ) {
+		for ( pos = 0; pos < (size_t)ret;
+			pos += sizeof(*event) + event->len ) {
+			event = (const struct inotify_event *)(buf.data + pos);
+			ext_include_validation_invalidate(event->wd);
+		}
+	}
+
+	if ( ret < 0 && errno != EAGAIN ) {
+		sieve_sys_error(svinst,
+			"include: read(inotify) failed: %m");
+		ext_include_validation_clear();
+	}
+}
+
+static int ext_include_validation_watch
+(struct sieve_instance *svinst, const char *path)
+{
+	int wd;
+
+	if ( include_inotify_fd == -1 ) {
+		include_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if ( include_inotify_fd == -1 ) {
+			sieve_sys_error(svinst,
+				"include: inotify_init1() failed: %m");
+			return -1;
+		}
+	}
+
+	wd = inotify_add_watch
+		(include_inotify_fd, path, EXT_INCLUDE_INOTIFY_EVENTS);
+	if ( wd == -1 ) {
+		sieve_sys_error(svinst,
+			"include: inotify_add_watch(%s) failed: %m", path);
+	}
+	return wd;
+}
+
+#endif
+
+static bool ext_include_validation_lookup
+(enum ext_include_validation_cache mode, struct sieve_binary *sbin,
+	struct sieve_script *script, struct sieve_binary_block *sblock,
+	sieve_size_t *offset)
+{
+	struct ext_include_validation *valid;
+	string_t *driver_name, *location;
+	unsigned int version;
+	const char *key;
+	struct stat st;
+
+	if ( !hash_table_is_created(include_validations) ||
+		(key=ext_include_validation_key(sbin, script)) == NULL )
+		return FALSE;
+
+	valid = hash_table_lookup(include_validations, key);
+	if ( valid == NULL )
+		return FALSE;
+	if ( valid->bin_mtime != sieve_binary_mtime(sbin) ) {
+		ext_include_validation_remove(valid);
+		return FALSE;
+	}
+
+	/* Unchanged script file? */
+	if ( mode != EXT_INCLUDE_VALIDATION_CACHE_INOTIFY || valid->wd == -1 ) {
+		if ( stat(valid->path, &st) < 0 || st.st_dev != valid->dev ||
+			st.st_ino != valid->ino || st.st_mtime != valid->mtime ||
+			st.st_size != valid->size ) {
+			ext_include_validation_remove(valid);
+			return FALSE;
+		}
+	}
+
+	/* Same metadata in the binary? Only the generic part is present for
+	   script files. */
+	if ( !sieve_binary_read_string(sblock, offset, &driver_name) ||
+		!sieve_binary_read_unsigned(sblock, offset, &version) ||
+		!sieve_binary_read_string(sblock, offset, &location) ||
+		strcmp(str_c(driver_name), valid->driver_name) != 0 ||
+		version != valid->version ||
+		strcmp(str_c(location), valid->location) != 0 )
+		return FALSE;
+	return TRUE;
+}
+
+static void ext_include_validation_update
+(enum ext_include_validation_cache mode, struct sieve_binary *sbin,
+	struct sieve_script *script, struct sieve_binary_block *sblock,
+	sieve_size_t offset, sieve_size_t end_offset)
+{
+	struct sieve_instance *svinst = sieve_binary_svinst(sbin);
+	struct ext_include_validation *valid;
+	string_t *driver_name, *location;
+	unsigned int version;
+	const char *key, *path;
+	struct stat st;
+	int wd = -1;
+
+	/* Only script files, with nothing but generic metadata */
+	if ( (path=sieve_file_script_get_path(script)) == NULL ||
+		(key=ext_include_validation_key(sbin, script)) == NULL )
+		return;
+	if ( !sieve_binary_read_string(sblock, &offset, &driver_name) ||
+		!sieve_binary_read_unsigned(sblock, &offset, &version) ||
+		!sieve_binary_read_string(sblock, &offset, &location) ||
+		offset != end_offset )
+		return;
+
+	if ( !hash_table_is_created(include_validations) ) {
+		hash_table_create(&include_validations, default_pool, 0,
+			str_hash, strcmp);
+	}
+
+	valid = hash_table_lookup(include_validations, key);
+	if ( valid != NULL ) {
+		ext_include_validation_remove(valid);
+	} else if ( hash_table_count(include_validations) >=
+		EXT_INCLUDE_VALIDATION_CACHE_MAX_ENTRIES ) {
+		ext_include_validation_clear();
+	}
+
+#ifdef HAVE_SYS_INOTIFY_H
+	/* Watch before stat(), so that no change goes unnoticed */
+	if ( mode == EXT_INCLUDE_VALIDATION_CACHE_INOTIFY )
+		wd = ext_include_validation_watch(svinst, path);
+#else
+	(void)mode;
+	(void)svinst;
+#endif
+	if ( stat(path, &st) < 0 )
+		return;
+	if ( st.st_mtime >= sieve_binary_mtime(sbin) ) {
+		/* Changed while we were looking */
+		return;
+	}
+
+	valid = i_new(struct ext_include_validation, 1);
+	valid->key = i_strdup(key);
+	valid->bin_mtime = sieve_binary_mtime(sbin);
+	valid->driver_name = i_strdup(str_c(driver_name));
+	valid->version = version;
+	valid->location = i_strdup(str_c(location));
+	valid->path = i_strdup(path);
+	valid->dev = st.st_dev;
+	valid->ino = st.st_ino;
+	valid->mtime = st.st_mtime;
+	valid->size = st.st_size;
+	valid->wd = wd;
+
+	hash_table_insert(include_validations, valid->key, valid);
+}
+
+void sieve_include_validation_cache_deinit(void)
+{
+	if ( !hash_table_is_created(include_validations) )
+		return;
+
+	/* Also closes the inotify instance */
+	ext_include_validation_clear();
+	hash_table_destroy(&include_validations);
+}
+
 /*
  * Binary extension
  */
@@ -247,10 +537,16 @@ static bool ext_include_binary_open
 		(struct ext_include_context *)ext->context;
 	struct ext_include_binary_context *binctx =
 		(struct ext_include_binary_context *) context;
+	enum ext_include_validation_cache vcache = ext_ctx->validation_cache;
 	struct sieve_binary_block *sblock;
 	unsigned int depcount, i, block_id;
 	sieve_size_t offset;
 
+#ifdef HAVE_SYS_INOTIFY_H
+	if ( vcache == EXT_INCLUDE_VALIDATION_CACHE_INOTIFY )
+		ext_include_validation_read_events(svinst);
+#endif
+
 	sblock = sieve_binary_extension_get_block(sbin, ext);
 	block_id = sieve_binary_block_get_id(sblock);
 
@@ -281,6 +577,7 @@ static bool ext_include_binary_open
 		struct sieve_storage *storage;
 		struct sieve_script *script;
 		enum sieve_error error;
+		sieve_size_t meta_offset;
 		int ret;
 
 		if (
@@ -330,6 +627,19 @@ static bool ext_include_binary_open
 			/* No, recompile */
 			return FALSE;
 		}
+
+		/* Unchanged since it was last validated? */
+		meta_offset = offset;
+		if ( vcache != EXT_INCLUDE_VALIDATION_CACHE_NONE && inc_block != NULL &&
+			ext_include_validation_lookup
+				(vcache, sbin, script, sblock, &offset) ) {
+			(void)ext_include_binary_script_include
+				(binctx, location, flags, script, inc_block);
+			sieve_script_unref(&script);
+			continue;
+		}
+		offset = meta_offset;
+
 		if ( sieve_script_open(script, &error) < 0 ) {
 			if ( error != SIEVE_ERROR_NOT_FOUND ) {
 				/* No, recompile */
@@ -371,8 +681,13 @@ static bool ext_include_binary_open
 			return FALSE;
 		}
 
-		if ( ret == 0 )
+		if ( ret == 0 ) {
 			binctx->outdated = TRUE;
+		} else if ( vcache != EXT_INCLUDE_VALIDATION_CACHE_NONE &&
+			inc_block != NULL ) {
+			ext_include_validation_update
+				(vcache, sbin, script, sblock, meta_offset, offset);
+		}
 
 		(void)ext_include_binary_script_include
 			(binctx, location, flags, script, inc_block);
@@ -17,6 +17,7 @@
 #include "sieve-validator.h"
 #include "sieve-generator.h"
 #include "sieve-interpreter.h"
+#include "sieve-profile.h"
 
 #include "ext-include-common.h"
 #include "ext-include-limits.h"
@@ -47,6 +48,9 @@ struct ext_include_interpreter_global {
 
 	struct sieve_variable_scope_binary *var_scope;
 	struct sieve_variable_storage *var_storage;
+
+	/* Sub-interpreters that ended and can be started again */
+	ARRAY(struct ext_include_interpreter_context *) recycled;
 };
 
 struct ext_include_interpreter_context {
@@ -63,6 +67,14 @@ struct ext_include_interpreter_context {
 
 	const struct ext_include_script_info *include;
 	bool returned;
+
+	/* Profile entry of the include operation that started this
+	   sub-interpreter, and of the include it deferred to the top-level
+	   interpreter. Time spent in a deferred include is added to the
+	   entry of the operation that deferred it. */
+	struct sieve_profile_entry *profile_parent;
+	struct sieve_profile_entry *include_profile;
+	struct sieve_profile_timer profile_timer;
 };
 
 /*
@@ -76,7 +88,7 @@ bool ext_include_load
 {
 	struct sieve_instance *svinst = ext->svinst;
 	struct ext_include_context *ctx;
-	const char *location;
+	const char *location, *setting;
 	unsigned long long int uint_setting;
 
 	if ( *context != NULL ) {
@@ -111,6 +123,30 @@ bool ext_include_load
 		ctx->max_includes = (unsigned int) uint_setting;
 	}
 
+	/* Get dependency validation cache mode */
+	ctx->validation_cache = EXT_INCLUDE_VALIDATION_CACHE_NONE;
+	setting = sieve_setting_get(svinst, "sieve_include_validation_cache");
+	if ( setting != NULL && *setting != '\0' ) {
+		if ( strcasecmp(setting, "no") == 0 ) {
+			ctx->validation_cache = EXT_INCLUDE_VALIDATION_CACHE_NONE;
+		} else if ( strcasecmp(setting, "stat") == 0 ) {
+			ctx->validation_cache = EXT_INCLUDE_VALIDATION_CACHE_STAT;
+		} else if ( strcasecmp(setting, "inotify") == 0 ) {
+#ifdef HAVE_SYS_INOTIFY_H
+			ctx->validation_cache = EXT_INCLUDE_VALIDATION_CACHE_INOTIFY;
+#else
+			sieve_sys_warning(svinst, "include: "
+				"inotify is not supported on this system; "
+				"using stat for sieve_include_validation_cache");
+			ctx->validation_cache = EXT_INCLUDE_VALIDATION_CACHE_STAT;
+#endif
+		} else {
+			sieve_sys_warning(svinst, "include: "
+				"invalid value `%s' for sieve_include_validation_cache",
+				str_sanitize(setting, 80));
+		}
+	}
+
 	/* Extension dependencies */
 	ctx->var_ext = sieve_ext_variables_get_extension(ext->svinst);
 
@@ -339,6 +375,7 @@ static void ext_include_runtime_init
 	if ( ctx->parent == NULL ) {
 		ctx->global = p_new(ctx->pool, struct ext_include_interpreter_global, 1);
 		p_array_init(&ctx->global->included_scripts, ctx->pool, 10);
+		p_array_init(&ctx->global->recycled, ctx->pool, 4);
 
 
 		ctx->global->var_scope =
@@ -353,10 +390,54 @@ static void ext_include_runtime_init
 		(ectx->var_ext, renv, this_ext, ctx->global->var_storage);
 }
 
+static void ext_include_runtime_free
+(const struct sieve_extension *this_ext ATTR_UNUSED,
+	struct sieve_interpreter *interp ATTR_UNUSED, void *context)
+{
+	struct ext_include_interpreter_context *ctx =
+		(struct ext_include_interpreter_context *) context;
+	struct ext_include_interpreter_context *const *rctxs;
+	struct sieve_interpreter *rinterp;
+	unsigned int count, i;
+
+	if ( ctx->global == NULL )
+		return;
+
+	/* Recycled sub-interpreters cannot outlive their parent */
+	for (;;) {
+		rctxs = array_get(&ctx->global->recycled, &count);
+		for ( i = 0; i < count; i++ ) {
+			if ( rctxs[i]->parent == ctx )
+				break;
+		}
+		if ( i == count )
+			break;
+
+		rinterp = rctxs[i]->interp;
+		array_delete(&ctx->global->recycled, i, 1);
+
+		/* This frees the children of the recycled interpreter as well */
+		sieve_interpreter_free(&rinterp);
+	}
+}
+
+static void ext_include_runtime_reset
+(const struct sieve_extension *this_ext ATTR_UNUSED,
+	struct sieve_interpreter *interp ATTR_UNUSED, void *context)
+{
+	struct ext_include_interpreter_context *ctx =
+		(struct ext_include_interpreter_context *) context;
+
+	ctx->include = NULL;
+	ctx->include_profile = NULL;
+	ctx->returned = FALSE;
+}
+
 static struct sieve_interpreter_extension include_interpreter_extension = {
 	&include_extension,
 	ext_include_runtime_init,
-	NULL,
+	ext_include_runtime_free,
+	ext_include_runtime_reset
 };
 
 /*
@@ -639,6 +720,76 @@ static bool ext_include_runtime_include_mark
 	return TRUE;
 }
 
+static struct ext_include_interpreter_context *
+ext_include_runtime_get_subinterp
+(const struct sieve_runtime_env *renv, struct ext_include_interpreter_context *ctx,
+	const struct ext_include_script_info *include,
+	struct sieve_profile_entry *profile_parent)
+{
+	const struct sieve_extension *this_ext = renv->oprtn->ext;
+	struct ext_include_interpreter_context *const *rctxs;
+	struct ext_include_interpreter_context *subctx = NULL;
+	struct sieve_interpreter *subinterp;
+	enum sieve_execute_flags exflags = renv->flags;
+	unsigned int count, i;
+
+	/* Reuse a sub-interpreter that ran this include before */
+	rctxs = array_get(&ctx->global->recycled, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( rctxs[i]->parent == ctx && rctxs[i]->script_info == include ) {
+			subctx = rctxs[i];
+			array_delete(&ctx->global->recycled, i, 1);
+			break;
+		}
+	}
+
+	if ( subctx == NULL ) {
+		if ( include->location != EXT_INCLUDE_LOCATION_GLOBAL )
+			exflags |= SIEVE_EXECUTE_FLAG_NOGLOBAL;
+		else
+			exflags &= ~SIEVE_EXECUTE_FLAG_NOGLOBAL;
+
+		subinterp = sieve_interpreter_create_for_block
+			(include->block, include->script, ctx->interp, renv->msgdata,
+				renv->scriptenv, renv->ehandler, exflags);
+		if ( subinterp == NULL )
+			return NULL;
+
+		subctx = ext_include_interpreter_context_init_child
+			(this_ext, subinterp, ctx, include->script, include);
+	}
+
+	/* The including operation is not necessarily the one currently executed
+	   by the parent interpreter, so the profile parent is always set
+	   explicitly, also for reused sub-interpreters */
+	subctx->profile_parent = profile_parent;
+	sieve_interpreter_set_profile_parent(subctx->interp, profile_parent);
+	return subctx;
+}
+
+static void ext_include_runtime_profile_end
+(struct ext_include_interpreter_context *subctx)
+{
+	/* Account the deferred include to the operation that requested it */
+	if ( subctx->profile_parent != NULL && subctx->parent->parent != NULL ) {
+		sieve_profile_timer_add
+			(&subctx->profile_timer, subctx->profile_parent);
+	}
+	subctx->profile_parent = NULL;
+}
+
+static void ext_include_runtime_put_subinterp
+(struct ext_include_interpreter_context *subctx)
+{
+	struct sieve_interpreter *subinterp = subctx->interp;
+
+	/* Keep it for the next include of the same script from the same parent */
+	if ( sieve_interpreter_recycle(subinterp) )
+		array_append(&subctx->global->recycled, &subctx, 1);
+	else
+		sieve_interpreter_free(&subinterp);
+}
+
 int ext_include_execute_include
 (const struct sieve_runtime_env *renv, unsigned int include_id,
 	enum ext_include_flags flags)
@@ -692,30 +843,20 @@ int ext_include_execute_include
 
 	if ( ctx->parent == NULL ) {
 		struct ext_include_interpreter_context *curctx = NULL;
-		struct sieve_error_handler *ehandler = renv->ehandler;
 		struct sieve_interpreter *subinterp;
 		bool interrupted = FALSE;
 
 		/* We are the top-level interpreter instance */
 
 		if ( result == SIEVE_EXEC_OK ) {
-			enum sieve_execute_flags exflags = renv->flags;
-
-			if ( included->location != EXT_INCLUDE_LOCATION_GLOBAL )
-				exflags |= SIEVE_EXECUTE_FLAG_NOGLOBAL;
-			else
-				exflags &= ~SIEVE_EXECUTE_FLAG_NOGLOBAL;
-
-			/* Create interpreter for top-level included script
+			/* Get interpreter for top-level included script
 			 * (first sub-interpreter)
 			 */
-			subinterp = sieve_interpreter_create_for_block
-				(included->block, included->script, renv->interp,
-					renv->msgdata, renv->scriptenv, ehandler, exflags);
+			curctx = ext_include_runtime_get_subinterp
+				(renv, ctx, included, renv->profile_entry);
 
-			if ( subinterp != NULL ) {
-				curctx = ext_include_interpreter_context_init_child
-					(this_ext, subinterp, ctx, included->script, included);
+			if ( curctx != NULL ) {
+				subinterp = curctx->interp;
 
 				/* Activate and start the top-level included script */
 				result = ( sieve_interpreter_start
@@ -733,6 +874,7 @@ int ext_include_execute_include
 
 				if ( ( (interrupted && curctx->returned) || (!interrupted) ) &&
 					curctx->parent != NULL ) {
+					struct ext_include_interpreter_context *endedctx = curctx;
 					const struct ext_include_script_info *ended_script =
 						curctx->script_info;
 
@@ -740,7 +882,8 @@ int ext_include_execute_include
 
 					/* Ascend interpreter stack */
 					curctx = curctx->parent;
-					sieve_interpreter_free(&subinterp);
+					ext_include_runtime_profile_end(endedctx);
+					ext_include_runtime_put_subinterp(endedctx);
 
 					sieve_runtime_trace(renv, SIEVE_TRLVL_NONE,
 						"include: script '%s' ended [inc id: %d, block: %d]",
@@ -762,23 +905,18 @@ int ext_include_execute_include
 						/* Sub-include requested */
 
 						if ( result == SIEVE_EXEC_OK ) {
-							enum sieve_execute_flags exflags = renv->flags;
+							struct ext_include_interpreter_context *subctx;
 
-							if ( curctx->include->location != EXT_INCLUDE_LOCATION_GLOBAL )
-								exflags |= SIEVE_EXECUTE_FLAG_NOGLOBAL;
-							else
-								exflags &= ~SIEVE_EXECUTE_FLAG_NOGLOBAL;
+							/* Get sub-interpreter */
+							subctx = ext_include_runtime_get_subinterp
+								(renv, curctx, curctx->include, curctx->include_profile);
 
-							/* Create sub-interpreter */
-							subinterp = sieve_interpreter_create_for_block
-								(curctx->include->block, curctx->include->script,
-									curctx->interp, renv->msgdata,
-									renv->scriptenv, ehandler, exflags);
+							if ( subctx != NULL ) {
+								curctx = subctx;
+								subinterp = curctx->interp;
 
-							if ( subinterp != NULL ) {
-								curctx = ext_include_interpreter_context_init_child
-									(this_ext, subinterp, curctx, curctx->include->script,
-										curctx->include);
+								if ( curctx->profile_parent != NULL )
+									sieve_profile_timer_start(&curctx->profile_timer);
 
 								/* Start the sub-include's interpreter */
 								curctx->include = NULL;
@@ -807,8 +945,13 @@ int ext_include_execute_include
 			const struct ext_include_script_info *ended_script =
 				curctx->script_info;
 
-			/* This kills curctx too */
-			sieve_interpreter_free(&killed_interp);
+			ext_include_runtime_profile_end(curctx);
+			if ( result == SIEVE_EXEC_OK ) {
+				ext_include_runtime_put_subinterp(curctx);
+			} else {
+				/* This kills curctx too */
+				sieve_interpreter_free(&killed_interp);
+			}
 
 			sieve_runtime_trace(renv, SIEVE_TRLVL_NONE,
 				"include: script '%s' ended [id: %d, block: %d]",
@@ -823,6 +966,7 @@ int ext_include_execute_include
 		/* We are an included script already, defer inclusion to main interpreter */
 
 		ctx->include = included;
+		ctx->include_profile = renv->profile_entry;
 		sieve_interpreter_interrupt(renv->interp);
 	}
 
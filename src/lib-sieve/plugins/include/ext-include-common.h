@@ -51,6 +51,12 @@ static inline const char *ext_include_script_location_name
 }
 
 
+enum ext_include_validation_cache {
+	EXT_INCLUDE_VALIDATION_CACHE_NONE,
+	EXT_INCLUDE_VALIDATION_CACHE_STAT,
+	EXT_INCLUDE_VALIDATION_CACHE_INOTIFY
+};
+
 /*
  * Extension
  */
@@ -115,6 +121,8 @@ struct ext_include_context {
 
 	unsigned int max_nesting_depth;
 	unsigned int max_includes;
+
+	enum ext_include_validation_cache validation_cache;
 };
 
 static inline struct ext_include_context *ext_include_get_context
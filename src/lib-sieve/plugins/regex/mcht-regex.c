@@ -21,6 +21,7 @@
 #include "sieve-comparators.h"
 #include "sieve-match-types.h"
 #include "sieve-match.h"
+#include "sieve-regex-cache.h"
 
 #include "ext-regex-common.h"
 
@@ -170,7 +171,7 @@ static bool mcht_regex_validate_context
  */
 
 struct mcht_regex_key {
-	regex_t regexp;
+	struct sieve_regex *regex;
 	int status;
 };
 
@@ -298,28 +299,29 @@ static int mcht_regex_match_keys
 
 					if ( rkey->status >= 0 ) {
 						const char *regex_str = str_c(key_item);
-						int rxret;
+						const char *error;
 
 						/* Indicate whether match values need to be produced */
 						if ( ctx->nmatch == 0 ) cflags |= REG_NOSUB;
 
-						/* Compile regular expression */
-						if ( (rxret=regcomp(&rkey->regexp, regex_str, cflags)) != 0 ) {
+						/* Compile regular expression (or obtain it from the cache) */
+						rkey->regex = sieve_regex_compile
+							(renv->svinst, regex_str, cflags, &error);
+						if ( rkey->regex == NULL ) {
 							sieve_runtime_error(renv, NULL,
 								"invalid regular expression '%s' for regex match: %s",
-								str_sanitize(regex_str, 128),
-								_regexp_error(&rkey->regexp, rxret));
+								str_sanitize(regex_str, 128), error);
 							rkey->status = -1;
 						} else {
 							rkey->status = 1;
 						}
 					}
 				} else {
-					rkey = array_idx_modifiable(&ctx->reg_expressions, 1);
+					rkey = array_idx_modifiable(&ctx->reg_expressions, i);
 				}
 
 				if ( rkey->status > 0 ) {
-					match = mcht_regex_match_key(mctx, val, &rkey->regexp);
+					match = mcht_regex_match_key(mctx, val, &rkey->regex->regexp);
 
 					if ( trace ) {
 						sieve_runtime_trace(renv, 0,
@@ -352,7 +354,7 @@ static int mcht_regex_match_keys
 		match = 0;
 		while ( match == 0 && i < count ) {
 			if ( rkeys[i].status > 0 ) {
-				match = mcht_regex_match_key(mctx, val, &rkeys[i].regexp);
+				match = mcht_regex_match_key(mctx, val, &rkeys[i].regex->regexp);
 
 				if ( trace ) {
 					sieve_runtime_trace(renv, 0,
@@ -378,7 +380,8 @@ void mcht_regex_match_deinit
 	if ( array_is_created(&ctx->reg_expressions) ) {
 		rkeys = array_get_modifiable(&ctx->reg_expressions, &count);
 		for ( i = 0; i < count; i++ ) {
-			regfree(&rkeys[i].regexp);
+			if ( rkeys[i].regex != NULL )
+				sieve_regex_unref(&rkeys[i].regex);
 		}
 	}
 }
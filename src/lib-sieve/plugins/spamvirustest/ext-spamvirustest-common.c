@@ -12,6 +12,7 @@
 #include "sieve-message.h"
 #include "sieve-interpreter.h"
 #include "sieve-runtime-trace.h"
+#include "sieve-regex-cache.h"
 
 #include "ext-spamvirustest-common.h"
 
@@ -31,7 +32,7 @@ enum ext_spamvirustest_status_type {
 
 struct ext_spamvirustest_header_spec {
 	const char *header_name;
-	regex_t regexp;
+	struct sieve_regex *regexp;
 	bool regexp_match;
 };
 
@@ -54,34 +55,6 @@ struct ext_spamvirustest_data {
  * Regexp utility
  */
 
-static bool _regexp_compile
-(regex_t *regexp, const char *data, const char **error_r)
-{
-	size_t errsize;
-	int ret;
-
-	*error_r = "";
-
-	if ( (ret=regcomp(regexp, data, REG_EXTENDED)) == 0 ) {
-		return TRUE;
-	}
-
-	errsize = regerror(ret, regexp, NULL, 0);
-
-	if ( errsize > 0 ) {
-		char *errbuf = t_malloc(errsize);
-
-		(void)regerror(ret, regexp, errbuf, errsize);
-
-		/* We don't want the error to start with a capital letter */
-		errbuf[0] = i_tolower(errbuf[0]);
-
-		*error_r = errbuf;
-	}
-
-	return FALSE;
-}
-
 static const char *_regexp_match_get_value
 (const char *string, int index, regmatch_t pmatch[], int nmatch)
 {
@@ -97,8 +70,8 @@ static const char *_regexp_match_get_value
  */
 
 static bool ext_spamvirustest_header_spec_parse
-(struct ext_spamvirustest_header_spec *spec, pool_t pool, const char *data,
-	const char **error_r)
+(struct sieve_instance *svinst, struct ext_spamvirustest_header_spec *spec,
+	pool_t pool, const char *data, const char **error_r)
 {
 	const char *p;
 	const char *regexp_error;
@@ -138,7 +111,8 @@ static bool ext_spamvirustest_header_spec_parse
 	while ( *p == ' ' || *p == '\t' ) p++;
 
 	spec->regexp_match = TRUE;
-	if ( !_regexp_compile(&spec->regexp, p, &regexp_error) ) {
+	spec->regexp = sieve_regex_compile(svinst, p, REG_EXTENDED, &regexp_error);
+	if ( spec->regexp == NULL ) {
 		*error_r = t_strdup_printf("failed to compile regular expression '%s': "
 			"%s", p, regexp_error);
 		return FALSE;
@@ -150,7 +124,8 @@ static bool ext_spamvirustest_header_spec_parse
 static void ext_spamvirustest_header_spec_free
 (struct ext_spamvirustest_header_spec *spec)
 {
-	regfree(&spec->regexp);
+	if ( spec->regexp != NULL )
+		sieve_regex_unref(&spec->regexp);
 }
 
 static bool ext_spamvirustest_parse_strlen_value
@@ -344,7 +319,7 @@ bool ext_spamvirustest_load
 	ext_data->status_type = type;
 
 	if ( !ext_spamvirustest_header_spec_parse
-		(&ext_data->status_header, ext_data->pool, status_header, &error) ) {
+		(svinst, &ext_data->status_header, ext_data->pool, status_header, &error) ) {
 		sieve_sys_error(svinst,
 			"%s: invalid status header specification "
 			"'%s': %s", ext_name, status_header, error);
@@ -356,7 +331,7 @@ bool ext_spamvirustest_load
 			/* Parse max header */
 
 			if ( max_header != NULL && !ext_spamvirustest_header_spec_parse
-				(&ext_data->max_header, ext_data->pool, max_header, &error) ) {
+				(svinst, &ext_data->max_header, ext_data->pool, max_header, &error) ) {
 				sieve_sys_error(svinst,
 					"%s: invalid max header specification "
 					"'%s': %s", ext_name, max_header, error);
@@ -459,6 +434,7 @@ int ext_spamvirustest_get_value
 	struct ext_spamvirustest_message_context *mctx;
 	struct mail *mail;
 	regmatch_t match_values[2];
+	const char *const *header_values;
 	const char *header_value, *error;
 	const char *status = NULL, *max = NULL;
 	float status_value, max_value;
@@ -508,12 +484,13 @@ int ext_spamvirustest_get_value
 	if ( ext_data->status_type != EXT_SPAMVIRUSTEST_STATUS_TYPE_TEXT ) {
 		if ( max_header->header_name != NULL ) {
 			/* Get header from message */
-			if ( mail_get_first_header_utf8
-				(mail, max_header->header_name, &header_value) < 0 ) {
+			if ( sieve_message_get_header_values(msgctx,
+				max_header->header_name, TRUE, &header_values) < 0 ) {
 				return sieve_runtime_mail_error	(renv, mail,
 					"%s test: failed to read header field `%s'",
 					sieve_extension_name(ext), max_header->header_name);
 			}
+			header_value = header_values[0];
 			if (	header_value == NULL ) {
 				sieve_runtime_trace(renv,  SIEVE_TRLVL_TESTS,
 					"header '%s' not found in message",
@@ -523,7 +500,7 @@ int ext_spamvirustest_get_value
 
 			if ( max_header->regexp_match ) {
 				/* Execute regex */
-				if ( regexec(&max_header->regexp, header_value, 2, match_values, 0)
+				if ( regexec(&max_header->regexp->regexp, header_value, 2, match_values, 0)
 					!= 0 ) {
 					sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
 						"regexp for header '%s' did not match "
@@ -565,12 +542,13 @@ int ext_spamvirustest_get_value
 	 */
 
 	/* Get header from message */
-	if ( mail_get_first_header_utf8
-		(mail, status_header->header_name, &header_value) < 0 ) {
+	if ( sieve_message_get_header_values(msgctx,
+		status_header->header_name, TRUE, &header_values) < 0 ) {
 		return sieve_runtime_mail_error	(renv, mail,
 			"%s test: failed to read header field `%s'",
 			sieve_extension_name(ext), status_header->header_name);
 	}
+	header_value = header_values[0];
 	if ( header_value == NULL ) {
 		sieve_runtime_trace(renv,  SIEVE_TRLVL_TESTS,
 			"header '%s' not found in message",
@@ -580,7 +558,7 @@ int ext_spamvirustest_get_value
 
 	/* Execute regex */
 	if ( status_header->regexp_match ) {
-		if ( regexec(&status_header->regexp, header_value, 2, match_values, 0)
+		if ( regexec(&status_header->regexp->regexp, header_value, 2, match_values, 0)
 			!= 0 ) {
 			sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
 				"regexp for header '%s' did not match on value '%s'",
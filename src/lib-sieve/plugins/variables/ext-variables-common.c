@@ -717,10 +717,26 @@ static void ext_variables_interpreter_free
 	sieve_variable_scope_binary_unref(&ctx->local_scope_bin);
 }
 
+static void ext_variables_interpreter_reset
+(const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_interpreter *interp ATTR_UNUSED, void *context)
+{
+	struct ext_variables_interpreter_context *ctx =
+		(struct ext_variables_interpreter_context *)context;
+	string_t *const *varval;
+
+	/* Local variables start out empty; keep the allocated strings */
+	array_foreach(&ctx->local_storage->var_values, varval) {
+		if ( *varval != NULL )
+			str_truncate(*varval, 0);
+	}
+}
+
 static struct sieve_interpreter_extension variables_interpreter_extension = {
 	&variables_extension,
 	NULL,
-	ext_variables_interpreter_free
+	ext_variables_interpreter_free,
+	ext_variables_interpreter_reset
 };
 
 static struct ext_variables_interpreter_context *
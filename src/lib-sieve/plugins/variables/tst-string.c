@@ -28,6 +28,9 @@ static bool tst_string_registered
 		struct sieve_command_registration *cmd_reg);
 static bool tst_string_validate
 	(struct sieve_validator *valdtr, struct sieve_command *tst);
+static bool tst_string_validate_const
+	(struct sieve_validator *valdtr, struct sieve_command *tst,
+		int *const_current, int const_next);
 static bool tst_string_generate
 	(const struct sieve_codegen_env *cgenv, struct sieve_command *ctx);
 
@@ -40,6 +43,7 @@ const struct sieve_command_def tst_string = {
 	.block_required = FALSE,
 	.registered = tst_string_registered,
 	.validate = tst_string_validate,
+	.validate_const = tst_string_validate_const,
 	.generate = tst_string_generate
 };
 
@@ -121,6 +125,23 @@ static bool tst_string_validate
 		(valdtr, tst, arg, &mcht_default, &cmp_default);
 }
 
+static bool tst_string_validate_const
+(struct sieve_validator *valdtr, struct sieve_command *tst,
+	int *const_current, int const_next ATTR_UNUSED)
+{
+	struct sieve_ast_argument *source = tst->first_positional;
+	const struct sieve_match_type mcht_default =
+		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
+	const struct sieve_comparator cmp_default =
+		SIEVE_COMPARATOR_DEFAULT(i_octet_comparator);
+
+	/* Comparing string literals can be done at compile time */
+	*const_current = sieve_match_type_validate_const(valdtr, tst,
+		source, sieve_ast_argument_next(source), &mcht_default, &cmp_default);
+
+	return TRUE;
+}
+
 /*
  * Test generation
  */
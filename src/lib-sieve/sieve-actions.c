@@ -187,6 +187,8 @@ static int act_store_check_duplicate
 	(const struct sieve_runtime_env *renv,
 		const struct sieve_action *act,
 		const struct sieve_action *act_other);
+static const char *act_store_get_duplicate_key
+	(const struct sieve_script_env *senv, const struct sieve_action *action);
 static void act_store_print
 	(const struct sieve_action *action,
 		const struct sieve_result_print_env *rpenv, bool *keep);
@@ -213,6 +215,7 @@ const struct sieve_action_def act_store = {
 		SIEVE_ACTFLAG_MAIL_STORAGE,
 	.equals = act_store_equals,
 	.check_duplicate = act_store_check_duplicate,
+	.get_duplicate_key = act_store_get_duplicate_key,
 	.print = act_store_print,
 	.start = act_store_start,
 	.execute = act_store_execute,
@@ -325,6 +328,21 @@ static int act_store_check_duplicate
 	return ( act_store_equals(renv->scriptenv, act, act_other) ? 1 : 0 );
 }
 
+static const char *act_store_get_duplicate_key
+(const struct sieve_script_env *senv, const struct sieve_action *action)
+{
+	struct act_store_context *ctx = (struct act_store_context *) action->context;
+	const char *mailbox;
+
+	mailbox = ( ctx == NULL ?
+		SIEVE_SCRIPT_DEFAULT_MAILBOX(senv) : ctx->mailbox );
+
+	/* Must match act_store_equals() */
+	if ( strcasecmp(mailbox, "INBOX") == 0 )
+		return "INBOX";
+	return mailbox;
+}
+
 /* Result printing */
 
 static void act_store_print
@@ -64,6 +64,13 @@ struct sieve_action_def {
 			const struct sieve_action *act,
 			const struct sieve_action *act_other);
 
+	/* Returns a (data stack) key for the target of the action (e.g. a mailbox
+	   or an address). Actions for which check_duplicate() can report a
+	   duplicate must yield the same key, so that the result only needs to
+	   compare actions with the same key. Optional. */
+	const char *(*get_duplicate_key)
+		(const struct sieve_script_env *senv, const struct sieve_action *action);
+
 	/* Result printing */
 
 	void (*print)
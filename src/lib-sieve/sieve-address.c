@@ -8,7 +8,9 @@
 #include "message-address.h"
 
 #include "sieve-common.h"
+#include "sieve-runtime.h"
 #include "sieve-runtime-trace.h"
+#include "sieve-message.h"
 
 #include "sieve-address.h"
 
@@ -36,7 +38,8 @@ struct sieve_header_address_list {
 	struct sieve_address_list addrlist;
 
 	struct sieve_stringlist *field_values;
-	const struct message_address *cur_address;
+	const struct sieve_message_addresses *cur_addresses;
+	unsigned int cur_index;
 };
 
 struct sieve_address_list *sieve_header_address_list_create
@@ -63,14 +66,16 @@ static int sieve_header_address_list_next_item
 {
 	struct sieve_header_address_list *addrlist =
 		(struct sieve_header_address_list *) _addrlist;
-	const struct message_address *aitem;
-	bool valid = TRUE;
+	const struct sieve_runtime_env *renv = _addrlist->strlist.runenv;
+	const struct sieve_address *address;
 
 	if ( addr_r != NULL ) addr_r->local_part = NULL;
 	if ( unparsed_r != NULL ) *unparsed_r = NULL;
 
 	/* Parse next header field value if necessary */
-	while ( addrlist->cur_address == NULL ) {
+	while ( addrlist->cur_addresses == NULL ||
+		addrlist->cur_index >= addrlist->cur_addresses->count ) {
+		const struct sieve_message_addresses *maddrs;
 		string_t *value_item = NULL;
 		int ret;
 
@@ -80,54 +85,33 @@ static int sieve_header_address_list_next_item
 			return ret;
 
 		if ( _addrlist->strlist.trace ) {
-			sieve_runtime_trace(_addrlist->strlist.runenv, 0,
+			sieve_runtime_trace(renv, 0,
 				"parsing address header value `%s'",
 				str_sanitize(str_c(value_item), 80));
 		}
 
-		addrlist->cur_address = message_address_parse
-			(pool_datastack_create(), (const unsigned char *) str_data(value_item),
-				str_len(value_item), 256, FALSE);
-
-		/* Check validity of all addresses simultaneously. Unfortunately,
-		 * errorneous addresses cannot be extracted from the address list.
-		 */
-		aitem = addrlist->cur_address;
-		while ( aitem != NULL) {
-			if ( aitem->invalid_syntax )
-				valid = FALSE;
-			aitem = aitem->next;
-		}
+		/* Parsed values are cached with the message context */
+		maddrs = sieve_message_get_addresses
+			(renv->msgctx, str_c(value_item), str_len(value_item));
 
-		if ( addrlist->cur_address == NULL || !valid ) {
-			addrlist->cur_address = NULL;
+		if ( maddrs->invalid ) {
+			addrlist->cur_addresses = NULL;
 
 			if ( unparsed_r != NULL) *unparsed_r = value_item;
 			return 1;
 		}
 
-		/* Find first usable address */
-		aitem = addrlist->cur_address;
-		while ( aitem != NULL && aitem->domain == NULL ) {
-			aitem = aitem->next;
-		}
-
-		addrlist->cur_address = aitem;
+		addrlist->cur_addresses = maddrs;
+		addrlist->cur_index = 0;
 	}
 
 	/* Return next item */
 
+	address = &addrlist->cur_addresses->addresses[addrlist->cur_index++];
 	if ( addr_r != NULL ) {
-		addr_r->local_part = addrlist->cur_address->mailbox;
-		addr_r->domain = addrlist->cur_address->domain;
-	}
-
-	/* Find next usable address */
-	aitem = addrlist->cur_address->next;
-	while ( aitem != NULL && aitem->domain == NULL ) {
-		aitem = aitem->next;
+		addr_r->local_part = address->local_part;
+		addr_r->domain = address->domain;
 	}
-	addrlist->cur_address = aitem;
 
 	return 1;
 }
@@ -158,7 +142,7 @@ static void sieve_header_address_list_reset
 		(struct sieve_header_address_list *)_strlist;
 
 	sieve_stringlist_reset(addrlist->field_values);
-	addrlist->cur_address = NULL;
+	addrlist->cur_addresses = NULL;
 }
 
 static void sieve_header_address_list_set_trace
@@ -0,0 +1,156 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "hash.h"
+#include "llist.h"
+
+#include "sieve-common.h"
+#include "sieve-error.h"
+
+#include "sieve.h"
+#include "sieve-binary-private.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Binary cache
+ */
+
+/* The binary cache keeps the images of recently loaded binary files in memory
+ * for the lifetime of the process. Binary objects themselves are bound to a
+ * particular Sieve instance, so these are still created for every delivery,
+ * but with a cache hit no more than a single stat() is needed to obtain the
+ * binary data.
+ */
+
+struct sieve_binary_cache {
+	HASH_TABLE(const char *, struct sieve_binary_image *) images;
+
+	/* LRU list; most recently used image first */
+	struct sieve_binary_image *lru_head, *lru_tail;
+
+	unsigned int max_entries;
+	struct sieve_binary_cache_stats stats;
+};
+
+static struct sieve_binary_cache *sieve_binary_cache = NULL;
+
+static struct sieve_binary_cache *sieve_binary_cache_init(void)
+{
+	struct sieve_binary_cache *cache;
+
+	cache = i_new(struct sieve_binary_cache, 1);
+	hash_table_create(&cache->images, default_pool, 0, str_hash, strcmp);
+
+	return cache;
+}
+
+static void sieve_binary_cache_drop
+(struct sieve_binary_cache *cache, struct sieve_binary_image *image)
+{
+	i_assert(image->cached);
+
+	hash_table_remove(cache->images, image->path);
+	DLLIST2_REMOVE(&cache->lru_head, &cache->lru_tail, image);
+	image->cached = FALSE;
+
+	sieve_binary_image_unref(&image);
+}
+
+static bool sieve_binary_image_is_current
+(struct sieve_binary_image *image, const struct stat *st)
+{
+	return ( image->st.st_ino == st->st_ino &&
+		CMP_DEV_T(image->st.st_dev, st->st_dev) &&
+		image->st.st_mtime == st->st_mtime &&
+		image->st.st_ctime == st->st_ctime &&
+		image->st.st_size == st->st_size );
+}
+
+struct sieve_binary_image *sieve_binary_cache_get
+(struct sieve_instance *svinst, const char *path, enum sieve_error *error_r)
+{
+	struct sieve_binary_cache *cache;
+	struct sieve_binary_image *image;
+	struct stat st;
+
+	if ( sieve_binary_cache == NULL )
+		sieve_binary_cache = sieve_binary_cache_init();
+	cache = sieve_binary_cache;
+	cache->max_entries = svinst->binary_cache_size;
+
+	image = hash_table_lookup(cache->images, path);
+	if ( image != NULL ) {
+		if ( stat(path, &st) == 0 && sieve_binary_image_is_current(image, &st) ) {
+			/* Cache hit */
+			cache->stats.hits++;
+			DLLIST2_REMOVE(&cache->lru_head, &cache->lru_tail, image);
+			DLLIST2_PREPEND(&cache->lru_head, &cache->lru_tail, image);
+
+			if ( svinst->debug ) {
+				sieve_sys_debug(svinst, "binary cache: "
+					"using cached image of binary %s", path);
+			}
+
+			if ( error_r != NULL )
+				*error_r = SIEVE_ERROR_NONE;
+			sieve_binary_image_ref(image);
+			return image;
+		}
+
+		/* Binary was changed or removed */
+		sieve_binary_cache_drop(cache, image);
+	}
+
+	/* Cache miss */
+	cache->stats.misses++;
+	if ( (image=sieve_binary_image_load(svinst, path, error_r)) == NULL )
+		return NULL;
+
+	if ( svinst->debug ) {
+		sieve_sys_debug(svinst, "binary cache: "
+			"loaded image of binary %s into cache", path);
+	}
+
+	sieve_binary_image_ref(image);
+	image->cached = TRUE;
+	hash_table_insert(cache->images, image->path, image);
+	DLLIST2_PREPEND(&cache->lru_head, &cache->lru_tail, image);
+
+	/* Evict least recently used images */
+	while ( hash_table_count(cache->images) > cache->max_entries ) {
+		i_assert( cache->lru_tail != NULL );
+		cache->stats.evictions++;
+		sieve_binary_cache_drop(cache, cache->lru_tail);
+	}
+
+	return image;
+}
+
+void sieve_binary_cache_get_stats(struct sieve_binary_cache_stats *stats_r)
+{
+	memset(stats_r, 0, sizeof(*stats_r));
+
+	if ( sieve_binary_cache == NULL )
+		return;
+
+	*stats_r = sieve_binary_cache->stats;
+	stats_r->entries = hash_table_count(sieve_binary_cache->images);
+}
+
+void sieve_binary_cache_deinit(void)
+{
+	struct sieve_binary_cache *cache = sieve_binary_cache;
+
+	if ( cache == NULL )
+		return;
+
+	while ( cache->lru_head != NULL )
+		sieve_binary_cache_drop(cache, cache->lru_head);
+
+	hash_table_destroy(&cache->images);
+	i_free(cache);
+	sieve_binary_cache = NULL;
+}
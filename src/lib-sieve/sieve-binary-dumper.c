@@ -57,6 +57,12 @@ pool_t sieve_binary_dumper_pool(struct sieve_binary_dumper *dumper)
 	return dumper->pool;
 }
 
+void sieve_binary_dumper_set_profile
+(struct sieve_binary_dumper *dumper, struct sieve_profile *profile)
+{
+	dumper->dumpenv.profile = profile;
+}
+
 /*
  * Formatted output
  */
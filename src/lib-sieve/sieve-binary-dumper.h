@@ -20,6 +20,10 @@ void sieve_binary_dumper_free
 pool_t sieve_binary_dumper_pool
 	(struct sieve_binary_dumper *dumper);
 
+/* Annotate the code with the statistics recorded in the execution profile */
+void sieve_binary_dumper_set_profile
+	(struct sieve_binary_dumper *dumper, struct sieve_profile *profile);
+
 /*
  * Formatted output
  */
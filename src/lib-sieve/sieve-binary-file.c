@@ -22,6 +22,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -451,6 +452,9 @@ bool sieve_binary_file_open
 
 void sieve_binary_file_close(struct sieve_binary_file **file)
 {
+	if ( (*file)->image != NULL )
+		sieve_binary_image_unref(&(*file)->image);
+
 	if ( (*file)->fd != -1 ) {
 		if ( close((*file)->fd) < 0 ) {
 			sieve_sys_error((*file)->svinst,
@@ -464,119 +468,176 @@ void sieve_binary_file_close(struct sieve_binary_file **file)
 	*file = NULL;
 }
 
-#if 0 /* file_memory is currently unused */
+/* Binary image (whole file loaded or mapped into memory) */
 
-/* File loaded/mapped to memory */
+static bool sieve_binary_image_mmap
+(struct sieve_instance *svinst, struct sieve_binary_image *image, int fd)
+{
+	void *data;
 
-struct _file_memory {
-	struct sieve_binary_file binfile;
+	data = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if ( data == MAP_FAILED ) {
+		sieve_sys_warning(svinst,
+			"binary read: mmap() failed for binary %s "
+			"(reading it instead): %m", image->path);
+		return FALSE;
+	}
 
-	/* Pointer to the binary in memory */
-	const void *memory;
-	off_t memory_size;
-};
+	/* Binaries are always replaced using rename(), so the mapped file is
+	   never modified underneath us */
+	image->data = data;
+	image->mmaped = TRUE;
+	return TRUE;
+}
 
-static const void *_file_memory_load_data
-	(struct sieve_binary_file *file, off_t *offset, size_t size)
+struct sieve_binary_image *sieve_binary_image_load
+(struct sieve_instance *svinst, const char *path, enum sieve_error *error_r)
 {
-	struct _file_memory *fmem = (struct _file_memory *) file;
+	struct sieve_binary_file file;
+	struct sieve_binary_image *image;
+	void *indata;
+	size_t insize;
+	ssize_t ret;
 
-	*offset = SIEVE_BINARY_ALIGN(*offset);
+	memset(&file, 0, sizeof(file));
+	file.path = path;
 
-	if ( (*offset) + size <= fmem->memory_size ) {
-		const void *data = PTR_OFFSET(fmem->memory, *offset);
-		*offset += size;
-		file->offset = *offset;
+	if ( !sieve_binary_file_open(&file, svinst, path, error_r) )
+		return NULL;
 
-		return data;
-	}
+	image = i_new(struct sieve_binary_image, 1);
+	image->refcount = 1;
+	image->path = i_strdup(path);
+	image->st = file.st;
+	image->size = file.st.st_size;
 
-	return NULL;
-}
+	insize = 0;
+	if ( image->size > 0 && (!svinst->binary_mmap ||
+		!sieve_binary_image_mmap(svinst, image, file.fd)) ) {
+		image->data = i_malloc(image->size);
+		insize = image->size;
+	}
 
-static buffer_t *_file_memory_load_buffer
-	(struct sieve_binary_file *file, off_t *offset, size_t size)
-{
-	struct _file_memory *fmem = (struct _file_memory *) file;
+	/* Read the whole file into memory */
+	indata = image->data;
+	while ( insize > 0 ) {
+		if ( (ret=read(file.fd, indata, insize)) <= 0 ) {
+			if ( ret == 0 ) {
+				sieve_sys_error(svinst,
+					"binary read: binary %s is truncated (more data expected)",
+					path);
+			} else {
+				sieve_sys_error(svinst,
+					"binary read: failed to read from binary %s: %m", path);
+			}
+			break;
+		}
 
-	*offset = SIEVE_BINARY_ALIGN(*offset);
+		indata = PTR_OFFSET(indata, ret);
+		insize -= ret;
+	}
 
-	if ( (*offset) + size <= fmem->memory_size ) {
-		const void *data = PTR_OFFSET(fmem->memory, *offset);
-		*offset += size;
-		file->offset = *offset;
+	if ( close(file.fd) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary read: close(fd=%s) failed: %m", path);
+	}
 
-		return buffer_create_const_data(file->pool, data, size);
+	if ( insize != 0 ) {
+		/* Failed to read the whole file */
+		sieve_binary_image_unref(&image);
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_TEMP_FAILURE;
+		return NULL;
 	}
 
-	return NULL;
+	return image;
 }
 
-static bool _file_memory_load(struct sieve_binary_file *file)
+void sieve_binary_image_ref(struct sieve_binary_image *image)
 {
-	struct _file_memory *fmem = (struct _file_memory *) file;
-	int ret;
-	size_t size;
-	void *indata;
+	i_assert(image->refcount > 0);
+	image->refcount++;
+}
 
-	i_assert(file->fd > 0);
+void sieve_binary_image_unref(struct sieve_binary_image **_image)
+{
+	struct sieve_binary_image *image = *_image;
 
-	/* Allocate memory buffer
-	 */
-	indata = p_malloc(file->pool, file->st.st_size);
-	size = file->st.st_size;
+	*_image = NULL;
 
-	file->offset = 0;
-	fmem->memory = indata;
-	fmem->memory_size = file->st.st_size;
+	i_assert(image->refcount > 0);
+	if ( --image->refcount > 0 )
+		return;
 
-	/* Return to beginning of the file */
-	if ( lseek(file->fd, 0, SEEK_SET) == (off_t) -1 ) {
-		sieve_sys_error("failed to seek() in binary %s: %m", file->path);
-		return FALSE;
+	i_assert(!image->cached);
+	if ( image->runtime_pool != NULL )
+		pool_unref(&image->runtime_pool);
+	if ( !image->mmaped ) {
+		i_free(image->data);
+	} else if ( munmap(image->data, image->size) < 0 ) {
+		i_error("munmap(%s) failed: %m", image->path);
 	}
+	i_free(image->path);
+	i_free(image);
+}
 
-	/* Read the whole file into memory */
-	while (size > 0) {
-		if ( (ret=read(file->fd, indata, size)) <= 0 ) {
-			sieve_sys_error("failed to read from binary %s: %m", file->path);
-			break;
-		}
+/* File backed by a binary image */
 
-		indata = PTR_OFFSET(indata, ret);
-		size -= ret;
-	}
+static const void *_file_image_load_data
+(struct sieve_binary_file *file, off_t *offset, size_t size)
+{
+	struct sieve_binary_image *image = file->image;
 
-	if ( size != 0 ) {
-		/* Failed to read the whole file */
-		return FALSE;
+	*offset = SIEVE_BINARY_ALIGN(*offset);
+
+	if ( (size_t)(*offset) + size <= image->size ) {
+		const void *data = CONST_PTR_OFFSET(image->data, *offset);
+		*offset += size;
+		file->offset = *offset;
+
+		return data;
 	}
 
-	return TRUE;
+	return NULL;
 }
 
-static struct sieve_binary_file *_file_memory_open(const char *path)
+static buffer_t *_file_image_load_buffer
+(struct sieve_binary_file *file, off_t *offset, size_t size)
 {
-	pool_t pool;
-	struct _file_memory *file;
-
-	pool = pool_alloconly_create("sieve_binary_file_memory", 1024);
-	file = p_new(pool, struct _file_memory, 1);
-	file->binfile.pool = pool;
-	file->binfile.path = p_strdup(pool, path);
-	file->binfile.load = _file_memory_load;
-	file->binfile.load_data = _file_memory_load_data;
-	file->binfile.load_buffer = _file_memory_load_buffer;
+	const void *data;
+	buffer_t *buffer;
 
-	if ( !sieve_binary_file_open(&file->binfile, path) ) {
-		pool_unref(&pool);
+	if ( (data=_file_image_load_data(file, offset, size)) == NULL )
 		return NULL;
-	}
 
-	return &file->binfile;
+	/* Refer to the image directly; the data is not copied */
+	buffer = p_new(file->pool, buffer_t, 1);
+	buffer_create_from_const_data(buffer, data, size);
+	return buffer;
 }
 
-#endif /* file_memory is currently unused */
+static struct sieve_binary_file *_file_image_open
+(struct sieve_instance *svinst, const char *path,
+	struct sieve_binary_image *image)
+{
+	pool_t pool;
+	struct sieve_binary_file *file;
+
+	pool = pool_alloconly_create("sieve_binary_file_image", 1024);
+	file = p_new(pool, struct sieve_binary_file, 1);
+	file->pool = pool;
+	file->path = p_strdup(pool, path);
+	file->svinst = svinst;
+	file->fd = -1;
+	file->st = image->st;
+	file->load_data = _file_image_load_data;
+	file->load_buffer = _file_image_load_buffer;
+
+	sieve_binary_image_ref(image);
+	file->image = image;
+
+	return file;
+}
 
 /* File open in lazy mode (only read what is needed into memory) */
 
@@ -705,6 +766,7 @@ bool sieve_binary_load_block
 	}
 
 	sblock->data = sbin->file->load_buffer(sbin->file, &offset, header->size);
+	sblock->data_readonly = ( sbin->file->image != NULL );
 	if ( sblock->data == NULL ) {
 		sieve_sys_error(sbin->svinst,
 			"binary load: failed to read block %d of binary %s (size=%d)",
@@ -897,9 +959,25 @@ struct sieve_binary *sieve_binary_open
 
 	i_assert( script == NULL || sieve_script_svinst(script) == svinst );
 
-	//file = _file_memory_open(path);
-	if ( (file=_file_lazy_open(svinst, path, error_r)) == NULL )
+	if ( sieve_binary_cache_enabled(svinst) ) {
+		struct sieve_binary_image *image;
+
+		/* Obtain the binary image from the process-wide cache */
+		if ( (image=sieve_binary_cache_get(svinst, path, error_r)) == NULL )
+			return NULL;
+		file = _file_image_open(svinst, path, image);
+		sieve_binary_image_unref(&image);
+	} else if ( svinst->binary_mmap ) {
+		struct sieve_binary_image *image;
+
+		/* Map the binary into memory */
+		if ( (image=sieve_binary_image_load(svinst, path, error_r)) == NULL )
+			return NULL;
+		file = _file_image_open(svinst, path, image);
+		sieve_binary_image_unref(&image);
+	} else if ( (file=_file_lazy_open(svinst, path, error_r)) == NULL ) {
 		return NULL;
+	}
 
 	/* Create binary object */
 	sbin = sieve_binary_create(svinst, script);
@@ -10,6 +10,82 @@
 
 #include <sys/stat.h>
 
+/*
+ * Runtime data
+ */
+
+struct sieve_binary_runtime_data {
+	/* Offset of the block in the binary file (only used for images) */
+	uoff_t block_offset;
+	sieve_size_t address;
+	void *data;
+};
+ARRAY_DEFINE_TYPE(sieve_binary_runtime_data, struct sieve_binary_runtime_data);
+
+/* Operations decoded from a code block */
+struct sieve_binary_operations {
+	/* Offset of the block in the binary file (only used for images) */
+	uoff_t block_offset;
+
+	/* The index covers the code present when it was created; it maps the
+	   address of an operation to its position in the array plus one */
+	size_t size;
+	unsigned int *index;
+	ARRAY(struct sieve_binary_operation) operations;
+};
+
+/*
+ * Binary image
+ */
+
+/* A binary file read into memory as a whole or, when the sieve_binary_mmap
+ * setting is enabled, mapped into memory read-only. Images are reference
+ * counted, so that a single image can be shared by several binary objects
+ * through the binary cache.
+ */
+struct sieve_binary_image {
+	int refcount;
+
+	char *path;
+	struct stat st;
+
+	void *data;
+	size_t size;
+
+	/* Runtime data derived from the code in this image, sorted by block
+	   offset and address. It lives as long as the image, so a cached image
+	   keeps it across deliveries. */
+	pool_t runtime_pool;
+	ARRAY_TYPE(sieve_binary_runtime_data) runtime_data;
+	ARRAY(struct sieve_binary_operations *) operations;
+
+	/* Binary cache LRU list */
+	struct sieve_binary_image *prev, *next;
+	unsigned int cached:1;
+	unsigned int mmaped:1;
+};
+
+struct sieve_binary_image *sieve_binary_image_load
+	(struct sieve_instance *svinst, const char *path,
+		enum sieve_error *error_r);
+void sieve_binary_image_ref(struct sieve_binary_image *image);
+void sieve_binary_image_unref(struct sieve_binary_image **image);
+
+/*
+ * Binary cache
+ */
+
+static inline bool sieve_binary_cache_enabled
+(struct sieve_instance *svinst)
+{
+	return ( (svinst->flags & SIEVE_FLAG_BINARY_CACHE) != 0 &&
+		svinst->binary_cache_size > 0 );
+}
+
+struct sieve_binary_image *sieve_binary_cache_get
+	(struct sieve_instance *svinst, const char *path,
+		enum sieve_error *error_r);
+
 /*
  * Binary file
  */
@@ -23,6 +99,9 @@ struct sieve_binary_file {
 	int fd;
 	off_t offset;
 
+	/* Set when the file is loaded into memory as a whole */
+	struct sieve_binary_image *image;
+
 	const void *(*load_data)
 		(struct sieve_binary_file *file, off_t *offset, size_t size);
 	buffer_t *(*load_buffer)
@@ -70,6 +149,17 @@ struct sieve_binary_block {
 	buffer_t *data;
 
 	uoff_t offset;
+
+	/* Runtime data, sorted by address; blocks that refer to a binary image
+	   use the runtime data of the image instead */
+	ARRAY_TYPE(sieve_binary_runtime_data) runtime_data;
+
+	/* Decoded operations; for blocks that refer to a binary image, these
+	   belong to the image */
+	struct sieve_binary_operations *operations;
+
+	/* Data refers directly to a (shared) binary image */
+	unsigned int data_readonly:1;
 };
 
 /*
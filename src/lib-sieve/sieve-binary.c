@@ -274,6 +274,17 @@ struct sieve_binary_block *sieve_binary_block_get
 void sieve_binary_block_clear
 (struct sieve_binary_block *sblock)
 {
+	if ( array_is_created(&sblock->runtime_data) )
+		array_clear(&sblock->runtime_data);
+	sblock->operations = NULL;
+
+	if ( sblock->data_readonly ) {
+		/* Never modify the underlying binary image */
+		sblock->data = buffer_create_dynamic(sblock->sbin->pool, 64);
+		sblock->data_readonly = FALSE;
+		return;
+	}
+
 	buffer_reset(sblock->data);
 }
 
@@ -304,6 +315,161 @@ size_t sieve_binary_block_get_size
 	return _sieve_binary_block_get_size(sblock);
 }
 
+static int sieve_binary_runtime_data_cmp
+(const struct sieve_binary_runtime_data *key,
+	const struct sieve_binary_runtime_data *rdata)
+{
+	if ( key->block_offset != rdata->block_offset )
+		return ( key->block_offset < rdata->block_offset ? -1 : 1 );
+	if ( key->address != rdata->address )
+		return ( key->address < rdata->address ? -1 : 1 );
+	return 0;
+}
+
+static inline struct sieve_binary_image *sieve_binary_block_get_image
+(struct sieve_binary_block *sblock)
+{
+	/* Only code that is read directly from the image is the same for every
+	   binary object that shares the image */
+	if ( !sblock->data_readonly )
+		return NULL;
+	i_assert( sblock->sbin->file != NULL && sblock->sbin->file->image != NULL );
+	return sblock->sbin->file->image;
+}
+
+pool_t sieve_binary_block_get_runtime_pool
+(struct sieve_binary_block *sblock)
+{
+	struct sieve_binary_image *image = sieve_binary_block_get_image(sblock);
+
+	if ( image == NULL )
+		return sblock->sbin->pool;
+
+	if ( image->runtime_pool == NULL ) {
+		image->runtime_pool =
+			pool_alloconly_create("sieve_binary_image_runtime", 4096);
+	}
+	return image->runtime_pool;
+}
+
+void *sieve_binary_block_get_runtime_data
+(struct sieve_binary_block *sblock, sieve_size_t address)
+{
+	struct sieve_binary_image *image = sieve_binary_block_get_image(sblock);
+	ARRAY_TYPE(sieve_binary_runtime_data) *rdatas;
+	const struct sieve_binary_runtime_data *rdata;
+	struct sieve_binary_runtime_data key;
+
+	rdatas = ( image == NULL ? &sblock->runtime_data : &image->runtime_data );
+	if ( !array_is_created(rdatas) )
+		return NULL;
+
+	memset(&key, 0, sizeof(key));
+	key.block_offset = ( image == NULL ? 0 : sblock->offset );
+	key.address = address;
+
+	rdata = array_bsearch(rdatas, &key, sieve_binary_runtime_data_cmp);
+	return ( rdata == NULL ? NULL : rdata->data );
+}
+
+void sieve_binary_block_set_runtime_data
+(struct sieve_binary_block *sblock, sieve_size_t address, void *data)
+{
+	struct sieve_binary_image *image = sieve_binary_block_get_image(sblock);
+	ARRAY_TYPE(sieve_binary_runtime_data) *rdatas;
+	struct sieve_binary_runtime_data *items, rdata;
+	unsigned int count, i;
+
+	rdatas = ( image == NULL ? &sblock->runtime_data : &image->runtime_data );
+	if ( !array_is_created(rdatas) ) {
+		p_array_init(rdatas, sieve_binary_block_get_runtime_pool(sblock), 8);
+	}
+
+	memset(&rdata, 0, sizeof(rdata));
+	rdata.block_offset = ( image == NULL ? 0 : sblock->offset );
+	rdata.address = address;
+	rdata.data = data;
+
+	items = array_get_modifiable(rdatas, &count);
+	for ( i = 0; i < count &&
+		sieve_binary_runtime_data_cmp(&items[i], &rdata) < 0; i++ );
+
+	if ( i < count && sieve_binary_runtime_data_cmp(&items[i], &rdata) == 0 ) {
+		items[i].data = data;
+		return;
+	}
+
+	array_insert(rdatas, i, &rdata, 1);
+}
+
+static struct sieve_binary_operations *sieve_binary_block_get_operations
+(struct sieve_binary_block *sblock, bool create)
+{
+	struct sieve_binary_image *image = sieve_binary_block_get_image(sblock);
+	struct sieve_binary_operations *const *opsp, *ops;
+	pool_t pool;
+
+	if ( sblock->operations != NULL )
+		return sblock->operations;
+
+	if ( image != NULL && array_is_created(&image->operations) ) {
+		array_foreach(&image->operations, opsp) {
+			if ( (*opsp)->block_offset == sblock->offset ) {
+				sblock->operations = *opsp;
+				return *opsp;
+			}
+		}
+	}
+
+	if ( !create )
+		return NULL;
+
+	pool = sieve_binary_block_get_runtime_pool(sblock);
+	ops = p_new(pool, struct sieve_binary_operations, 1);
+	ops->block_offset = ( image == NULL ? 0 : sblock->offset );
+	ops->size = _sieve_binary_block_get_size(sblock);
+	ops->index = p_new(pool, unsigned int, ops->size + 1);
+	p_array_init(&ops->operations, pool, 64);
+
+	if ( image != NULL ) {
+		if ( !array_is_created(&image->operations) )
+			p_array_init(&image->operations, pool, 4);
+		array_append(&image->operations, &ops, 1);
+	}
+
+	sblock->operations = ops;
+	return ops;
+}
+
+const struct sieve_binary_operation *sieve_binary_block_get_operation
+(struct sieve_binary_block *sblock, sieve_size_t address)
+{
+	struct sieve_binary_operations *ops =
+		sieve_binary_block_get_operations(sblock, FALSE);
+	unsigned int idx;
+
+	if ( ops == NULL || address >= ops->size ||
+		(idx=ops->index[address]) == 0 )
+		return NULL;
+
+	return array_idx(&ops->operations, idx - 1);
+}
+
+void sieve_binary_block_add_operation
+(struct sieve_binary_block *sblock, sieve_size_t address,
+	const struct sieve_binary_operation *bop)
+{
+	struct sieve_binary_operations *ops =
+		sieve_binary_block_get_operations(sblock, TRUE);
+
+	/* Operations emitted after the index was created are not recorded */
+	if ( address >= ops->size || ops->index[address] != 0 )
+		return;
+
+	array_append(&ops->operations, bop, 1);
+	ops->index[address] = array_count(&ops->operations);
+}
+
 /*
  * Up-to-date checking
  */
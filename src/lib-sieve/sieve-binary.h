@@ -13,7 +13,7 @@
  */
 
 #define SIEVE_BINARY_VERSION_MAJOR     1
-#define SIEVE_BINARY_VERSION_MINOR     3
+#define SIEVE_BINARY_VERSION_MINOR     4
 
 /*
  * Binary object
@@ -104,6 +104,37 @@ struct sieve_binary *sieve_binary_block_get_binary
 unsigned int sieve_binary_block_get_id
 	(const struct sieve_binary_block *sblock);
 
+/* Runtime data derived from the code at a particular address (e.g.
+   preprocessed constant operands). The data is to be allocated from the
+   runtime pool of the block. When the block is read directly from a binary
+   image, the data is kept with the image and it is shared by all binary
+   objects that use it; for cached images this spans deliveries. Otherwise,
+   it lives as long as the binary itself. */
+pool_t sieve_binary_block_get_runtime_pool
+	(struct sieve_binary_block *sblock);
+void *sieve_binary_block_get_runtime_data
+	(struct sieve_binary_block *sblock, sieve_size_t address);
+void sieve_binary_block_set_runtime_data
+	(struct sieve_binary_block *sblock, sieve_size_t address, void *data);
+
+/* Operations decoded before, kept along with the runtime data. Only the
+   binary's own encoding is recorded, not the definitions, since those belong
+   to the Sieve instance (and its plugins) that executes the binary. */
+struct sieve_binary_operation {
+	/* Index of the extension in the binary; -1 for core operations */
+	int ext_index;
+	/* Code of the operation */
+	unsigned int code;
+	/* Address of the first operand */
+	sieve_size_t operands;
+};
+
+const struct sieve_binary_operation *sieve_binary_block_get_operation
+	(struct sieve_binary_block *sblock, sieve_size_t address);
+void sieve_binary_block_add_operation
+	(struct sieve_binary_block *sblock, sieve_size_t address,
+		const struct sieve_binary_operation *bop);
+
 /*
  * Extension support
  */
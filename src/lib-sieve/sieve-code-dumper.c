@@ -18,6 +18,7 @@
 #include "sieve-binary.h"
 #include "sieve-result.h"
 #include "sieve-comparators.h"
+#include "sieve-profile.h"
 
 #include "sieve-dump.h"
 
@@ -41,6 +42,10 @@ struct sieve_code_dumper {
 	unsigned int mark_last_line;
 	unsigned int indent;
 
+	/* Address of the operation that still needs its profile annotation */
+	sieve_size_t profile_address;
+	bool profile_pending;
+
 	/* Dump environment */
 	struct sieve_dumptime_env *dumpenv;
 
@@ -134,6 +139,30 @@ void *sieve_dump_extension_get_context
 
 /* Dump functions */
 
+static void sieve_code_dumper_print_profile
+(const struct sieve_dumptime_env *denv, string_t *outbuf)
+{
+	struct sieve_code_dumper *cdumper = denv->cdumper;
+	struct sieve_profile_stats stats;
+
+	if ( !cdumper->profile_pending ) {
+		str_append(outbuf, "                                          ");
+		return;
+	}
+	cdumper->profile_pending = FALSE;
+
+	if ( !sieve_profile_get_stats(denv->profile, denv->sbin,
+		sieve_binary_block_get_id(denv->sblock), cdumper->profile_address,
+		&stats) ) {
+		str_append(outbuf, "       0                                  ");
+		return;
+	}
+
+	str_printfa(outbuf, "%8u %10llu %10llu %10llu ", stats.count,
+		stats.wall_usecs, stats.cpu_usecs,
+		(unsigned long long)stats.bytes_matched);
+}
+
 void sieve_code_dumpf
 (const struct sieve_dumptime_env *denv, const char *fmt, ...)
 {
@@ -146,6 +175,9 @@ void sieve_code_dumpf
 	va_start(args, fmt);
 	str_printfa(outbuf, "%08llx: ", (unsigned long long) cdumper->mark_address);
 
+	if ( denv->profile != NULL )
+		sieve_code_dumper_print_profile(denv, outbuf);
+
 	if ( cdumper->mark_line > 0 && (cdumper->indent == 0 ||
 		cdumper->mark_line != cdumper->mark_last_line) ) {
 		str_printfa(outbuf, "%4u: ", cdumper->mark_line);
@@ -211,6 +243,8 @@ static bool sieve_code_dumper_print_operation
 	/* Mark start address of operation */
 	cdumper->indent = 0;
 	cdumper->mark_address = *address;
+	cdumper->profile_address = *address;
+	cdumper->profile_pending = ( denv->profile != NULL );
 
 	sieve_code_line_mark(denv, *address);
 
@@ -246,7 +280,12 @@ void sieve_code_dumper_run(struct sieve_code_dumper *cdumper)
 	address = &(denv->offset);
 
 	/* Heading */
-	o_stream_send_str(denv->stream, "Address   Line  Code\n");
+	if ( denv->profile == NULL ) {
+		o_stream_send_str(denv->stream, "Address   Line  Code\n");
+	} else {
+		o_stream_send_str(denv->stream, "Address      Count   Wall(us)"
+			"    CPU(us)    Matched Line  Code\n");
+	}
 
 	/* Load debug block */
 	sieve_code_mark(denv);
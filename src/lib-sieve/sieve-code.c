@@ -855,6 +855,24 @@ int sieve_opr_stringlist_read_ex
 		(renv, &operand, address, field_name, strlist_r);
 }
 
+/* Obtains the address of the first item and the number of items when the
+   string list is read directly from the binary. The address can then be used
+   to identify the list across executions. */
+bool sieve_code_stringlist_get_location
+(struct sieve_stringlist *_strlist, sieve_size_t *address_r,
+	unsigned int *length_r)
+{
+	struct sieve_code_stringlist *strlist =
+		(struct sieve_code_stringlist *) _strlist;
+
+	if ( _strlist->next_item != sieve_code_stringlist_next_item )
+		return FALSE;
+
+	*address_r = strlist->start_address;
+	*length_r = strlist->length;
+	return TRUE;
+}
+
 static bool opr_stringlist_dump
 (const struct sieve_dumptime_env *denv, const struct sieve_operand *oprnd,
 	sieve_size_t *address)
@@ -1041,6 +1059,7 @@ extern const struct sieve_operation_def tst_header_operation;
 extern const struct sieve_operation_def tst_exists_operation;
 extern const struct sieve_operation_def tst_size_over_operation;
 extern const struct sieve_operation_def tst_size_under_operation;
+extern const struct sieve_operation_def tst_header_dispatch_operation;
 
 const struct sieve_operation_def *sieve_operations[] = {
 	NULL,
@@ -1058,7 +1077,8 @@ const struct sieve_operation_def *sieve_operations[] = {
 	&tst_header_operation,
 	&tst_exists_operation,
 	&tst_size_over_operation,
-	&tst_size_under_operation
+	&tst_size_under_operation,
+	&tst_header_dispatch_operation
 };
 
 const unsigned int sieve_operation_count =
@@ -1088,12 +1108,52 @@ sieve_size_t sieve_operation_emit
   return sieve_binary_emit_byte(sblock, op_def->code);
 }
 
+static bool sieve_operation_read_decoded
+(struct sieve_binary_block *sblock, sieve_size_t *address,
+	struct sieve_operation *oprtn)
+{
+	const struct sieve_binary_operation *bop;
+	const struct sieve_extension_objects *objs;
+
+	if ( (bop=sieve_binary_block_get_operation(sblock, *address)) == NULL )
+		return FALSE;
+
+	oprtn->address = *address;
+
+	if ( bop->ext_index < 0 ) {
+		oprtn->ext = NULL;
+		oprtn->def = sieve_operations[bop->code];
+	} else {
+		oprtn->ext = sieve_binary_extension_get_by_index
+			(sieve_binary_block_get_binary(sblock), bop->ext_index);
+		if ( oprtn->ext == NULL )
+			return FALSE;
+
+		objs = &oprtn->ext->def->operations;
+		if ( objs->count == 1 ) {
+			oprtn->def = objs->objects;
+		} else if ( bop->code < objs->count ) {
+			oprtn->def = ((const void *const *) objs->objects)[bop->code];
+		} else {
+			return FALSE;
+		}
+	}
+
+	*address = bop->operands;
+	return TRUE;
+}
+
 bool sieve_operation_read
 (struct sieve_binary_block *sblock, sieve_size_t *address,
 	struct sieve_operation *oprtn)
 {
+	struct sieve_binary_operation bop;
 	unsigned int code = sieve_operation_count;
 
+	/* Operations at a particular address are decoded only once */
+	if ( sieve_operation_read_decoded(sblock, address, oprtn) )
+		return TRUE;
+
 	oprtn->address = *address;
 	oprtn->def = NULL;
 	oprtn->ext = NULL;
@@ -1105,15 +1165,22 @@ bool sieve_operation_read
 		if ( code < sieve_operation_count ) {
 			oprtn->def = sieve_operations[code];
 		}
-
-		return ( oprtn->def != NULL );
+	} else {
+		oprtn->def = (const struct sieve_operation_def *)
+			sieve_binary_read_extension_object(sblock, address,
+				&oprtn->ext->def->operations);
 	}
 
-	oprtn->def = (const struct sieve_operation_def *)
-		sieve_binary_read_extension_object(sblock, address,
-			&oprtn->ext->def->operations);
+	if ( oprtn->def == NULL )
+		return FALSE;
 
-	return ( oprtn->def != NULL );
+	memset(&bop, 0, sizeof(bop));
+	bop.ext_index = ( oprtn->ext == NULL ?
+		-1 : (int)(code - sieve_operation_count) );
+	bop.code = oprtn->def->code;
+	bop.operands = *address;
+	sieve_binary_block_add_operation(sblock, oprtn->address, &bop);
+	return TRUE;
 }
 
 /*
@@ -360,6 +360,8 @@ void sieve_command_exit_block_unconditionally
 {
 	struct sieve_command *parent = sieve_command_parent(cmd);
 
+	cmd->exits_block = TRUE;
+
 	/* Only the first unconditional exit is of importance */
 	if ( parent != NULL && parent->block_exit_command == NULL )
 		parent->block_exit_command = cmd;
@@ -164,6 +164,10 @@ struct sieve_command {
 
 	/* Context data*/
 	void *data;
+
+	/* This command unconditionally exits the block it is part of, meaning that
+	   any subsequent commands in that block are never executed */
+	unsigned int exits_block:1;
 };
 
 #define sieve_command_is(cmd, definition) \
@@ -263,6 +267,15 @@ extern const struct sieve_command_def tst_size;
 extern const struct sieve_command_def *sieve_core_tests[];
 extern const unsigned int sieve_core_tests_count;
 
+/* Header test dispatch */
+
+bool tst_header_dispatch_compatible
+	(struct sieve_command *tst1, struct sieve_command *tst2);
+bool tst_header_dispatch_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *const *tsts,
+		unsigned int count, sieve_size_t *branch_jumps_r,
+		sieve_size_t *default_jump_r);
+
 /*
  * Command utility functions
  */
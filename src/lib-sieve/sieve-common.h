@@ -214,6 +214,13 @@ struct sieve_instance {
 	unsigned int max_actions;
 	unsigned int max_redirects;
 	struct sieve_mail_sender redirect_from;
+	unsigned int binary_cache_size;
+	bool binary_mmap;
+	unsigned int regex_cache_size;
+
+	/* Raw mail user for substituted messages; shared by all message
+	   contexts of this instance */
+	struct mail_user *raw_mail_user;
 };
 
 #endif /* __SIEVE_COMMON_H */
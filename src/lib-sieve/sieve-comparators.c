@@ -258,3 +258,30 @@ bool sieve_comparator_octet_skip
 
 	return FALSE;
 }
+
+/*
+ * Substring search
+ */
+
+bool sieve_comparator_find_substring
+(const struct sieve_comparator *cmp,
+	const char **val, const char *val_end,
+	const char **key, const char *key_end)
+{
+	if ( cmp->def->substring_find != NULL ) {
+		if ( !cmp->def->substring_find(cmp, val, val_end, *key, key_end) ) {
+			*val = val_end;
+			return FALSE;
+		}
+		*key = key_end;
+		return TRUE;
+	}
+
+	/* Naive implementation using the character matching function */
+	while ( (*val < val_end) && (*key < key_end) ) {
+		if ( !cmp->def->char_match(cmp, val, val_end, key, key_end) )
+			(*val)++;
+	}
+
+	return (*key == key_end);
+}
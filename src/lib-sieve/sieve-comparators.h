@@ -56,6 +56,12 @@ struct sieve_comparator_def {
 		const char **key, const char *key_end);
 	bool (*char_skip)(const struct sieve_comparator *cmp,
 		const char **val, const char *val_end);
+
+	/* Substring search (optional; char_match is used otherwise) */
+
+	bool (*substring_find)(const struct sieve_comparator *cmp,
+		const char **val, const char *val_end,
+		const char *key, const char *key_end);
 };
 
 /*
@@ -153,4 +159,15 @@ bool sieve_comparator_octet_skip
 	(const struct sieve_comparator *cmp ATTR_UNUSED,
 		const char **val, const char *val_end);
 
+/*
+ * Substring search
+ */
+
+/* Searches the value for the first occurrence of the key. Upon success, val is
+   moved beyond the match and key to key_end. */
+bool sieve_comparator_find_substring
+	(const struct sieve_comparator *cmp,
+		const char **val, const char *val_end,
+		const char **key, const char *key_end);
+
 #endif /* __SIEVE_COMPARATORS_H */
@@ -28,6 +28,9 @@ struct sieve_dumptime_env {
 
 	/* Output stream */
 	struct ostream *stream;
+
+	/* Execution profile used to annotate the code (optional) */
+	struct sieve_profile *profile;
 };
 
 #endif /* __SIEVE_DUMP_H */
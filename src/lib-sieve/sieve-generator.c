@@ -422,16 +422,38 @@ static bool sieve_generate_command
 	return TRUE;
 }
 
+static bool sieve_generate_command_is_redundant
+(struct sieve_command *prev, struct sieve_command *cmd)
+{
+	/* A plain keep command directly following another one would only yield a
+	   duplicate action */
+	return ( prev != NULL && sieve_command_is(cmd, cmd_keep) &&
+		sieve_command_is(prev, cmd_keep) &&
+		sieve_ast_argument_first(cmd->ast_node) == NULL &&
+		sieve_ast_argument_first(prev->ast_node) == NULL );
+}
+
 bool sieve_generate_block
 (const struct sieve_codegen_env *cgenv, struct sieve_ast_node *block)
 {
 	bool result = TRUE;
 	struct sieve_ast_node *cmd_node;
+	struct sieve_command *prev = NULL;
 
 	T_BEGIN {
 		cmd_node = sieve_ast_command_first(block);
 		while ( result && cmd_node != NULL ) {
-			result = sieve_generate_command(cgenv, cmd_node);
+			struct sieve_command *cmd = cmd_node->command;
+
+			if ( !sieve_generate_command_is_redundant(prev, cmd) )
+				result = sieve_generate_command(cgenv, cmd_node);
+
+			/* Commands following an unconditional exit (e.g. stop) are
+			   unreachable; don't generate code for them */
+			if ( cmd->exits_block )
+				break;
+
+			prev = cmd;
 			cmd_node = sieve_ast_command_next(cmd_node);
 		}
 	} T_END;
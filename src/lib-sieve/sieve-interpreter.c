@@ -22,6 +22,7 @@
 #include "sieve-result.h"
 #include "sieve-comparators.h"
 #include "sieve-runtime-trace.h"
+#include "sieve-profile.h"
 
 #include "sieve-interpreter.h"
 
@@ -78,12 +79,29 @@ struct sieve_interpreter {
 	struct sieve_runtime_env runenv;
 	struct sieve_runtime_trace trace;
 
+	/* Execution profile */
+	struct sieve_profile *profile;
+	const char *profile_binary;
+	unsigned int profile_block_id;
+	struct sieve_profile_entry *profile_parent;
+
 	/* Current operation */
 	struct sieve_operation oprtn;
 
 	/* Location information */
 	struct sieve_binary_debug_reader *dreader;
 	unsigned int command_line;
+
+	/* Pools of finished match contexts, kept for reuse */
+	pool_t match_pools[SIEVE_INTERPRETER_MATCH_POOLS];
+	unsigned int match_pools_count;
+
+	/* Recycled since the last run */
+	bool recycled;
+
+	/* Statistics; logged when the interpreter is freed */
+	unsigned int match_contexts;      /* Match contexts started */
+	unsigned int match_pools_created; /* Match context pools allocated */
 };
 
 static struct sieve_interpreter *_sieve_interpreter_create
@@ -127,13 +145,22 @@ static struct sieve_interpreter *_sieve_interpreter_create
 	interp->runenv.msgdata = msgdata;
 	interp->runenv.scriptenv = senv;
 
-	if ( senv->trace_stream != NULL ) {
+	if ( senv->trace_stream != NULL &&
+		(flags & SIEVE_EXECUTE_FLAG_NO_TRACE) == 0 ) {
 		interp->trace.stream = senv->trace_stream;
 		interp->trace.config = senv->trace_config;
 		interp->trace.indent = 0;
 		interp->runenv.trace = &interp->trace;
 	}
 
+	if ( senv->profile != NULL ) {
+		interp->profile = senv->profile;
+		interp->profile_binary = sieve_profile_get_binary(senv->profile, sbin);
+		interp->profile_block_id = sieve_binary_block_get_id(sblock);
+		if ( parent != NULL )
+			interp->profile_parent = parent->runenv.profile_entry;
+	}
+
 	if ( senv->exec_status == NULL )
 		interp->runenv.exec_status = p_new(interp->pool, struct sieve_exec_status, 1);
 	else
@@ -258,22 +285,42 @@ struct sieve_interpreter *sieve_interpreter_create_for_block
 			parent, msgdata, senv, ehandler, flags);
 }
 
+static void sieve_interpreter_loops_free(struct sieve_interpreter *interp)
+{
+	struct sieve_interpreter_loop *loops;
+	unsigned int count, i;
+
+	if ( !array_is_created(&interp->loop_stack) )
+		return;
+
+	loops = array_get_modifiable(&interp->loop_stack, &count);
+	for ( i = 0; i < count; i++ )
+		pool_unref(&loops[i].pool);
+	array_clear(&interp->loop_stack);
+	interp->loop_limit = 0;
+}
+
 void sieve_interpreter_free(struct sieve_interpreter **_interp)
 {
 	struct sieve_interpreter *interp = *_interp;
 	struct sieve_runtime_env *renv = &interp->runenv;
 	const struct sieve_interpreter_extension_reg *eregs;
-	struct sieve_interpreter_loop *loops;
 	unsigned int count, i;
 
-	if ( array_is_created(&interp->loop_stack) ) {
-		loops = array_get_modifiable(&interp->loop_stack, &count);
-		for ( i = 0; i < count; i++ )
-			pool_unref(&loops[i].pool);
-	}
+	sieve_interpreter_loops_free(interp);
 
 	interp->trace.indent = 0;
-	sieve_runtime_trace_end(renv);
+	if ( !interp->recycled )
+		sieve_runtime_trace_end(renv);
+
+	if ( renv->svinst->debug && interp->match_contexts > 0 ) {
+		sieve_sys_debug(renv->svinst, "interpreter: "
+			"started %u match contexts using %u pools",
+			interp->match_contexts, interp->match_pools_created);
+	}
+
+	for ( i = 0; i < interp->match_pools_count; i++ )
+		pool_unref(&interp->match_pools[i]);
 
 	/* Signal registered extensions that the interpreter is being destroyed */
 	eregs = array_get(&interp->extensions, &count);
@@ -290,6 +337,70 @@ void sieve_interpreter_free(struct sieve_interpreter **_interp)
 	*_interp = NULL;
 }
 
+bool sieve_interpreter_recycle(struct sieve_interpreter *interp)
+{
+	struct sieve_runtime_env *renv = &interp->runenv;
+	const struct sieve_interpreter_extension_reg *eregs;
+	unsigned int count, i;
+
+	i_assert( !interp->recycled );
+
+	eregs = array_get(&interp->extensions, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( eregs[i].intext != NULL && eregs[i].context != NULL &&
+			eregs[i].intext->reset == NULL )
+			return FALSE;
+	}
+
+	sieve_interpreter_loops_free(interp);
+
+	interp->trace.indent = 0;
+	sieve_runtime_trace_end(renv);
+
+	for ( i = 0; i < count; i++ ) {
+		if ( eregs[i].intext != NULL && eregs[i].intext->reset != NULL )
+			eregs[i].intext->reset(eregs[i].ext, interp, eregs[i].context);
+	}
+
+	sieve_interpreter_reset(interp);
+	interp->command_line = 0;
+	interp->profile_parent = NULL;
+	interp->recycled = TRUE;
+	return TRUE;
+}
+
+/*
+ * Match context pools
+ */
+
+pool_t sieve_interpreter_match_pool_get(struct sieve_interpreter *interp)
+{
+	interp->match_contexts++;
+
+	if ( interp->match_pools_count > 0 )
+		return interp->match_pools[--interp->match_pools_count];
+
+	interp->match_pools_created++;
+	return pool_alloconly_create("sieve_match_context", 1024);
+}
+
+void sieve_interpreter_match_pool_put
+(struct sieve_interpreter *interp, pool_t *_pool)
+{
+	pool_t pool = *_pool;
+
+	*_pool = NULL;
+
+	if ( interp->match_pools_count >= SIEVE_INTERPRETER_MATCH_POOLS ) {
+		pool_unref(&pool);
+		return;
+	}
+
+	/* Only the first block of the pool is retained */
+	p_clear(pool);
+	interp->match_pools[interp->match_pools_count++] = pool;
+}
+
 /*
  * Accessors
  */
@@ -323,6 +434,12 @@ struct sieve_instance *sieve_interpreter_svinst
 	return interp->runenv.svinst;
 }
 
+void sieve_interpreter_set_profile_parent
+(struct sieve_interpreter *interp, struct sieve_profile_entry *parent)
+{
+	interp->profile_parent = parent;
+}
+
 /* Do not use this function for normal sieve extensions. This is intended for
  * the testsuite only.
  */
@@ -848,14 +965,45 @@ bool sieve_interpreter_get_test_result
  * Code execute
  */
 
+static void sieve_interpreter_profile_start
+(struct sieve_interpreter *interp, struct sieve_profile_timer *timer)
+{
+	struct sieve_runtime_env *renv = &interp->runenv;
+	struct sieve_profile_entry *entry;
+
+	entry = sieve_profile_lookup(interp->profile, interp->profile_parent,
+		interp->profile_binary, interp->profile_block_id,
+		interp->oprtn.address);
+	if ( entry == NULL ) {
+		const char *script_name = ( renv->script != NULL ?
+			sieve_script_name(renv->script) : interp->profile_binary );
+
+		entry = sieve_profile_add(interp->profile, interp->profile_parent,
+			interp->profile_binary, interp->profile_block_id,
+			interp->oprtn.address, script_name,
+			sieve_runtime_get_command_location(renv),
+			sieve_operation_mnemonic(&interp->oprtn));
+	}
+
+	renv->profile_entry = entry;
+	sieve_profile_timer_start(timer);
+}
+
+static void sieve_interpreter_profile_stop
+(struct sieve_interpreter *interp, struct sieve_profile_timer *timer)
+{
+	struct sieve_runtime_env *renv = &interp->runenv;
+
+	sieve_profile_timer_stop(timer, renv->profile_entry);
+	renv->profile_entry = NULL;
+}
+
 static int sieve_interpreter_operation_execute
 (struct sieve_interpreter *interp)
 {
 	struct sieve_operation *oprtn = &(interp->oprtn);
 	sieve_size_t *address = &(interp->runenv.pc);
 
-	sieve_runtime_trace_toplevel(&interp->runenv);
-
 	/* Read the operation */
 	if ( sieve_operation_read(interp->runenv.sblock, address, oprtn) ) {
 		const struct sieve_operation_def *op = oprtn->def;
@@ -866,9 +1014,15 @@ static int sieve_interpreter_operation_execute
 
 		/* Execute the operation */
 		if ( op->execute != NULL ) { /* Noop ? */
-			T_BEGIN {
-				result = op->execute(&(interp->runenv), address);
-			} T_END;
+			struct sieve_profile_timer timer;
+
+			if ( interp->profile != NULL )
+				sieve_interpreter_profile_start(interp, &timer);
+
+			result = op->execute(&(interp->runenv), address);
+
+			if ( interp->profile != NULL )
+				sieve_interpreter_profile_stop(interp, &timer);
 		} else {
 			sieve_runtime_trace
 				(&interp->runenv, SIEVE_TRLVL_COMMANDS, "OP: %s (NOOP)",
@@ -883,11 +1037,44 @@ static int sieve_interpreter_operation_execute
 	return SIEVE_EXEC_BIN_CORRUPT;
 }
 
+static int sieve_interpreter_operation_execute_batch
+(struct sieve_interpreter *interp, sieve_size_t code_size, bool trace)
+{
+	const struct sieve_runtime_env *renv = &interp->runenv;
+	sieve_size_t *address = &(interp->runenv.pc);
+	unsigned int count = 0;
+	int ret = SIEVE_EXEC_OK;
+
+	/* Operations share a data stack frame, which is popped after at most
+	   SIEVE_INTERPRETER_FRAME_OPERATIONS operations. Jumping out of the
+	   frame is not allowed, so the loop must not break. */
+	T_BEGIN {
+		while ( ret == SIEVE_EXEC_OK && !interp->interrupted &&
+			*address < code_size &&
+			count++ < SIEVE_INTERPRETER_FRAME_OPERATIONS ) {
+			if ( interp->loop_limit != 0 && *address > interp->loop_limit ) {
+				sieve_runtime_trace_error(renv,
+					"program crossed loop boundary");
+				ret = SIEVE_EXEC_BIN_CORRUPT;
+			} else {
+				if ( trace )
+					sieve_runtime_trace_toplevel(renv);
+
+				ret = sieve_interpreter_operation_execute(interp);
+			}
+		}
+	} T_END;
+
+	return ret;
+}
+
 int sieve_interpreter_continue
 (struct sieve_interpreter *interp, bool *interrupted)
 {
 	const struct sieve_runtime_env *renv = &interp->runenv;
 	sieve_size_t *address = &(interp->runenv.pc);
+	sieve_size_t code_size = sieve_binary_block_get_size(renv->sblock);
+	bool trace = sieve_runtime_trace_enabled(renv);
 	int ret = SIEVE_EXEC_OK;
 
 	sieve_result_ref(renv->result);
@@ -897,15 +1084,9 @@ int sieve_interpreter_continue
 		*interrupted = FALSE;
 
 	while ( ret == SIEVE_EXEC_OK && !interp->interrupted &&
-		*address < sieve_binary_block_get_size(renv->sblock) ) {
-		if ( interp->loop_limit != 0 && *address > interp->loop_limit ) {
-			sieve_runtime_trace_error(renv,
-				"program crossed loop boundary");
-			ret = SIEVE_EXEC_BIN_CORRUPT;
-			break;
-		}
-
-		ret = sieve_interpreter_operation_execute(interp);
+		*address < code_size ) {
+		ret = sieve_interpreter_operation_execute_batch
+			(interp, code_size, trace);
 	}
 
 	if ( ret != SIEVE_EXEC_OK ) {
@@ -929,6 +1110,11 @@ int sieve_interpreter_start
 	interp->runenv.result = result;
 	interp->runenv.msgctx = sieve_result_get_message_context(result);
 
+	if ( interp->recycled ) {
+		interp->recycled = FALSE;
+		sieve_runtime_trace_begin(&interp->runenv);
+	}
+
 	/* Signal registered extensions that the interpreter is being run */
 	eregs = array_get(&interp->extensions, &ext_count);
 	for ( i = 0; i < ext_count; i++ ) {
@@ -34,6 +34,13 @@ struct sieve_interpreter *sieve_interpreter_create_for_block
 	ATTR_NULL(3);
 void sieve_interpreter_free(struct sieve_interpreter **_interp);
 
+/* Finishes the interpreter's current run and prepares it to be started again
+   for the same block (with the same parent, message and environment). This
+   avoids loading the binary block and its extensions once more. Returns FALSE
+   when a registered extension cannot reset its context; the interpreter is
+   left untouched and needs to be freed instead. */
+bool sieve_interpreter_recycle(struct sieve_interpreter *interp);
+
 /*
  * Accessors
  */
@@ -49,6 +56,11 @@ struct sieve_error_handler *sieve_interpreter_get_error_handler
 struct sieve_instance *sieve_interpreter_svinst
 	(struct sieve_interpreter *interp);
 
+/* Sets the profile entry of the operation that runs this (sub-)interpreter.
+   The operations of this interpreter are recorded below that entry. */
+void sieve_interpreter_set_profile_parent
+	(struct sieve_interpreter *interp, struct sieve_profile_entry *parent);
+
 /* Do not use this function for normal sieve extensions. This is intended for
  * the testsuite only.
  */
@@ -106,6 +118,19 @@ sieve_size_t sieve_interpreter_program_counter
 int sieve_interpreter_program_jump
 	(struct sieve_interpreter *interp, bool jump, bool break_loops);
 
+/*
+ * Match context pools
+ */
+
+/* Maximum number of idle match context pools kept by an interpreter */
+#define SIEVE_INTERPRETER_MATCH_POOLS 4
+
+/* Match contexts are created for every test evaluation; their pools are
+   cleared and reused rather than created anew each time */
+pool_t sieve_interpreter_match_pool_get(struct sieve_interpreter *interp);
+void sieve_interpreter_match_pool_put
+	(struct sieve_interpreter *interp, pool_t *pool);
+
 /*
  * Test results
  */
@@ -160,6 +185,12 @@ struct sieve_interpreter_extension {
 	void (*free)
 		(const struct sieve_extension *ext, struct sieve_interpreter *interp,
 			void *context);
+	/* Discards the state of the previous run when the interpreter is
+	   recycled. Required for recycling when the extension registers a
+	   context. */
+	void (*reset)
+		(const struct sieve_extension *ext, struct sieve_interpreter *interp,
+			void *context);
 };
 
 void sieve_interpreter_extension_register
@@ -35,6 +35,8 @@
 
 #define SIEVE_MAX_MATCH_VALUES         32
 
+#define SIEVE_INTERPRETER_FRAME_OPERATIONS 64
+
 /*
  * Actions
  */
@@ -42,4 +44,22 @@
 #define SIEVE_DEFAULT_MAX_ACTIONS      32
 #define SIEVE_DEFAULT_MAX_REDIRECTS    4
 
+/*
+ * Binary cache
+ */
+
+#define SIEVE_DEFAULT_BINARY_CACHE_SIZE 32
+
+/*
+ * Regex cache
+ */
+
+#define SIEVE_DEFAULT_REGEX_CACHE_SIZE 256
+
+/*
+ * Storage lookup cache
+ */
+
+#define SIEVE_STORAGE_CACHE_MAX_ENTRIES 1024
+
 #endif /* __SIEVE_LIMITS_H */
@@ -0,0 +1,426 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "mempool.h"
+#include "array.h"
+#include "str.h"
+
+#include "sieve-common.h"
+#include "sieve-stringlist.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
+#include "sieve-runtime.h"
+#include "sieve-match.h"
+
+#include "sieve-match-keyset.h"
+
+#include <stdlib.h>
+
+/*
+ * Key set object
+ */
+
+struct sieve_match_keyset_key {
+	const unsigned char *data;
+	size_t size;
+};
+
+struct sieve_match_keyset_edge {
+	unsigned char c;
+	unsigned int target;
+};
+
+struct sieve_match_keyset_node {
+	ARRAY(struct sieve_match_keyset_edge) edges;
+	unsigned int fail;
+	bool output;
+};
+
+struct sieve_match_keyset {
+	const struct sieve_match_type_def *mcht_def;
+	const struct sieve_comparator_def *cmp_def;
+
+	unsigned int usable:1;
+	unsigned int casemap:1;
+	unsigned int empty_key:1;
+
+	/* :is - sorted keys */
+	struct sieve_match_keyset_key *keys;
+	unsigned int keys_count;
+
+	/* :contains - Aho-Corasick automaton; node 0 is the root, which has a
+	   dense transition table */
+	ARRAY(struct sieve_match_keyset_node) nodes;
+	unsigned int root_next[256];
+};
+
+static inline unsigned char
+sieve_match_keyset_char(struct sieve_match_keyset *kset, unsigned char c)
+{
+	return ( kset->casemap ? (unsigned char)i_tolower(c) : c );
+}
+
+/*
+ * Sorted keys (:is)
+ */
+
+static int sieve_match_keyset_key_cmp
+(const struct sieve_match_keyset_key *key1,
+	const struct sieve_match_keyset_key *key2)
+{
+	int ret;
+
+	ret = memcmp(key1->data, key2->data, I_MIN(key1->size, key2->size));
+	if ( ret != 0 )
+		return ret;
+
+	if ( key1->size < key2->size )
+		return -1;
+	return ( key1->size > key2->size ? 1 : 0 );
+}
+
+static int sieve_match_keyset_key_qsort_cmp
+(const void *key1, const void *key2)
+{
+	return sieve_match_keyset_key_cmp(key1, key2);
+}
+
+static int sieve_match_keyset_value_cmp
+(struct sieve_match_keyset *kset, const unsigned char *value,
+	size_t value_size, const struct sieve_match_keyset_key *key)
+{
+	size_t size = I_MIN(value_size, key->size), i;
+
+	for ( i = 0; i < size; i++ ) {
+		unsigned char c = sieve_match_keyset_char(kset, value[i]);
+
+		if ( c != key->data[i] )
+			return ( c < key->data[i] ? -1 : 1 );
+	}
+
+	if ( value_size < key->size )
+		return -1;
+	return ( value_size > key->size ? 1 : 0 );
+}
+
+static int sieve_match_keyset_is_match
+(struct sieve_match_keyset *kset, const unsigned char *value,
+	size_t value_size)
+{
+	unsigned int left = 0, right = kset->keys_count;
+
+	while ( left < right ) {
+		unsigned int idx = (left + right) / 2;
+		int ret;
+
+		ret = sieve_match_keyset_value_cmp
+			(kset, value, value_size, &kset->keys[idx]);
+		if ( ret == 0 )
+			return 1;
+
+		if ( ret < 0 )
+			right = idx;
+		else
+			left = idx + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Aho-Corasick automaton (:contains)
+ */
+
+static unsigned int sieve_match_keyset_goto
+(struct sieve_match_keyset *kset, unsigned int state, unsigned char c)
+{
+	const struct sieve_match_keyset_node *node;
+	const struct sieve_match_keyset_edge *edges;
+	unsigned int count, i;
+
+	if ( state == 0 )
+		return kset->root_next[c];
+
+	node = array_idx(&kset->nodes, state);
+	edges = array_get(&node->edges, &count);
+	for ( i = 0; i < count && edges[i].c <= c; i++ ) {
+		if ( edges[i].c == c )
+			return edges[i].target;
+	}
+
+	/* No transition (the root is never a target) */
+	return 0;
+}
+
+static unsigned int sieve_match_keyset_node_add
+(struct sieve_match_keyset *kset, pool_t pool)
+{
+	struct sieve_match_keyset_node *node;
+
+	node = array_append_space(&kset->nodes);
+	p_array_init(&node->edges, pool, 2);
+
+	return array_count(&kset->nodes) - 1;
+}
+
+static void sieve_match_keyset_trie_add
+(struct sieve_match_keyset *kset, pool_t pool, const unsigned char *key,
+	size_t key_size)
+{
+	struct sieve_match_keyset_node *node;
+	unsigned int state = 0;
+	size_t i;
+
+	for ( i = 0; i < key_size; i++ ) {
+		unsigned char c = sieve_match_keyset_char(kset, key[i]);
+		unsigned int next = sieve_match_keyset_goto(kset, state, c);
+
+		if ( next == 0 ) {
+			struct sieve_match_keyset_edge edge, *edges;
+			unsigned int count, j;
+
+			next = sieve_match_keyset_node_add(kset, pool);
+
+			if ( state == 0 ) {
+				kset->root_next[c] = next;
+			} else {
+				/* Keep edges sorted */
+				node = array_idx_modifiable(&kset->nodes, state);
+				edges = array_get_modifiable(&node->edges, &count);
+				for ( j = 0; j < count && edges[j].c < c; j++ );
+
+				edge.c = c;
+				edge.target = next;
+				array_insert(&node->edges, j, &edge, 1);
+			}
+		}
+		state = next;
+	}
+
+	node = array_idx_modifiable(&kset->nodes, state);
+	node->output = TRUE;
+}
+
+static void sieve_match_keyset_add_edge_fail
+(struct sieve_match_keyset *kset, ARRAY_TYPE(uint) *queue,
+	unsigned int state, unsigned char c, unsigned int target)
+{
+	struct sieve_match_keyset_node *nodes;
+	unsigned int fail = 0;
+
+	nodes = array_idx_modifiable(&kset->nodes, 0);
+	if ( state != 0 ) {
+		/* Follow failure links of the parent until a state with a transition
+		   for this character is found */
+		fail = nodes[state].fail;
+		while ( fail != 0 && sieve_match_keyset_goto(kset, fail, c) == 0 )
+			fail = nodes[fail].fail;
+		fail = sieve_match_keyset_goto(kset, fail, c);
+	}
+
+	nodes[target].fail = fail;
+	if ( nodes[fail].output )
+		nodes[target].output = TRUE;
+
+	array_append(queue, &target, 1);
+}
+
+static void sieve_match_keyset_build_failure_links
+(struct sieve_match_keyset *kset)
+{
+	ARRAY_TYPE(uint) queue;
+	unsigned int c, qidx;
+
+	t_array_init(&queue, array_count(&kset->nodes));
+
+	/* Breadth-first traversal of the trie */
+	for ( c = 0; c < 256; c++ ) {
+		if ( kset->root_next[c] != 0 ) {
+			sieve_match_keyset_add_edge_fail
+				(kset, &queue, 0, c, kset->root_next[c]);
+		}
+	}
+
+	for ( qidx = 0; qidx < array_count(&queue); qidx++ ) {
+		unsigned int state = *array_idx(&queue, qidx);
+		const struct sieve_match_keyset_node *node;
+		const struct sieve_match_keyset_edge *edges;
+		unsigned int count, i;
+
+		node = array_idx(&kset->nodes, state);
+		edges = array_get(&node->edges, &count);
+		for ( i = 0; i < count; i++ ) {
+			sieve_match_keyset_add_edge_fail
+				(kset, &queue, state, edges[i].c, edges[i].target);
+		}
+	}
+}
+
+static int sieve_match_keyset_contains_match
+(struct sieve_match_keyset *kset, const unsigned char *value,
+	size_t value_size)
+{
+	const struct sieve_match_keyset_node *nodes;
+	unsigned int state = 0;
+	size_t i;
+
+	nodes = array_idx(&kset->nodes, 0);
+	for ( i = 0; i < value_size; i++ ) {
+		unsigned char c = sieve_match_keyset_char(kset, value[i]);
+		unsigned int next;
+
+		for (;;) {
+			next = sieve_match_keyset_goto(kset, state, c);
+			if ( next != 0 || state == 0 )
+				break;
+			state = nodes[state].fail;
+		}
+
+		state = next;
+		if ( nodes[state].output )
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Key set construction
+ */
+
+static struct sieve_match_keyset *sieve_match_keyset_create
+(struct sieve_match_context *mctx, struct sieve_binary_block *sblock,
+	sieve_size_t address, unsigned int length)
+{
+	pool_t pool = sieve_binary_block_get_runtime_pool(sblock);
+	struct sieve_match_keyset *kset;
+	bool contains;
+	unsigned int i;
+
+	kset = p_new(pool, struct sieve_match_keyset, 1);
+	kset->mcht_def = mctx->match_type->def;
+	kset->cmp_def = mctx->comparator->def;
+	kset->casemap =
+		sieve_comparator_is(mctx->comparator, i_ascii_casemap_comparator);
+
+	contains = sieve_match_type_is(mctx->match_type, contains_match_type);
+	if ( contains ) {
+		p_array_init(&kset->nodes, pool, length * 4);
+		(void)sieve_match_keyset_node_add(kset, pool);
+	} else {
+		kset->keys = p_new(pool, struct sieve_match_keyset_key, length);
+	}
+
+	kset->usable = TRUE;
+	T_BEGIN {
+		for ( i = 0; i < length && kset->usable; i++ ) {
+			struct sieve_operand operand;
+			string_t *key_item;
+			const unsigned char *key;
+			size_t key_size;
+
+			/* Only string literals are the same for every execution */
+			if ( !sieve_operand_read(sblock, &address, NULL, &operand) ||
+				!sieve_operand_is_string_literal(&operand) ||
+				!sieve_binary_read_string(sblock, &address, &key_item) ) {
+				kset->usable = FALSE;
+				break;
+			}
+
+			key = str_data(key_item);
+			key_size = str_len(key_item);
+
+			if ( key_size == 0 ) {
+				kset->empty_key = TRUE;
+			} else if ( kset->casemap && !contains &&
+				memchr(key, '\0', key_size) != NULL ) {
+				/* Casemap comparison stops at NUL */
+				kset->usable = FALSE;
+			} else if ( contains ) {
+				sieve_match_keyset_trie_add(kset, pool, key, key_size);
+			} else {
+				unsigned char *data = p_malloc(pool, key_size);
+				size_t j;
+
+				for ( j = 0; j < key_size; j++ )
+					data[j] = sieve_match_keyset_char(kset, key[j]);
+				kset->keys[kset->keys_count].data = data;
+				kset->keys[kset->keys_count].size = key_size;
+				kset->keys_count++;
+			}
+		}
+
+		if ( kset->usable ) {
+			if ( contains ) {
+				sieve_match_keyset_build_failure_links(kset);
+			} else {
+				qsort(kset->keys, kset->keys_count, sizeof(kset->keys[0]),
+					sieve_match_keyset_key_qsort_cmp);
+			}
+		}
+	} T_END;
+
+	return kset;
+}
+
+struct sieve_match_keyset *sieve_match_keyset_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list)
+{
+	struct sieve_binary_block *sblock = key_list->runenv->sblock;
+	struct sieve_match_keyset *kset;
+	sieve_size_t address;
+	unsigned int length;
+
+	if ( !sieve_match_type_is(mctx->match_type, is_match_type) &&
+		!sieve_match_type_is(mctx->match_type, contains_match_type) )
+		return NULL;
+	if ( !sieve_comparator_is(mctx->comparator, i_octet_comparator) &&
+		!sieve_comparator_is(mctx->comparator, i_ascii_casemap_comparator) )
+		return NULL;
+
+	if ( !sieve_code_stringlist_get_location(key_list, &address, &length) ||
+		length < SIEVE_MATCH_KEYSET_MIN_KEYS )
+		return NULL;
+
+	kset = (struct sieve_match_keyset *)
+		sieve_binary_block_get_runtime_data(sblock, address);
+	if ( kset == NULL ) {
+		kset = sieve_match_keyset_create(mctx, sblock, address, length);
+		sieve_binary_block_set_runtime_data(sblock, address, kset);
+	}
+
+	if ( !kset->usable || kset->mcht_def != mctx->match_type->def ||
+		kset->cmp_def != mctx->comparator->def )
+		return NULL;
+
+	return kset;
+}
+
+/*
+ * Key set matching
+ */
+
+int sieve_match_keyset_match
+(struct sieve_match_keyset *kset, const char *value, size_t value_size)
+{
+	const unsigned char *data = (const unsigned char *)value;
+
+	if ( array_is_created(&kset->nodes) ) {
+		/* :contains */
+		if ( kset->empty_key )
+			return 1;
+		return sieve_match_keyset_contains_match(kset, data, value_size);
+	}
+
+	/* :is */
+	if ( value_size == 0 )
+		return ( kset->empty_key ? 1 : 0 );
+	if ( kset->casemap && memchr(data, '\0', value_size) != NULL ) {
+		/* Casemap comparison stops at NUL */
+		return -1;
+	}
+	return sieve_match_keyset_is_match(kset, data, value_size);
+}
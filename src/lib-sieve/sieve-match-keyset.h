@@ -0,0 +1,36 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_MATCH_KEYSET_H
+#define __SIEVE_MATCH_KEYSET_H
+
+#include "sieve-common.h"
+
+/*
+ * Key set
+ */
+
+/* Large lists of constant keys used with the :is or :contains match types are
+ * preprocessed once per binary into a key set, which matches a value against
+ * all keys in a single pass: a sorted array for :is and an Aho-Corasick
+ * automaton for :contains. Key sets are stored as runtime data of the code
+ * block, so with the binary cache they are kept with the cached binary image
+ * and reused for later deliveries.
+ */
+
+/* Minimum number of keys for which a key set is built */
+#define SIEVE_MATCH_KEYSET_MIN_KEYS 16
+
+struct sieve_match_keyset;
+
+/* Returns the key set for the key list, building it if necessary. Returns NULL
+   when the match type, comparator or key list are not suitable. */
+struct sieve_match_keyset *sieve_match_keyset_get
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list);
+
+/* Returns 1 for a match, 0 for no match and -1 when the key set cannot be used
+   for this particular value (the keys need to be matched one by one). */
+int sieve_match_keyset_match
+	(struct sieve_match_keyset *kset, const char *value, size_t value_size);
+
+#endif /* __SIEVE_MATCH_KEYSET_H */
@@ -18,6 +18,7 @@
 #include "sieve-generator.h"
 #include "sieve-interpreter.h"
 #include "sieve-dump.h"
+#include "sieve-match.h"
 
 #include "sieve-match-types.h"
 
@@ -144,10 +145,24 @@ static void mtch_interpreter_free
 	}
 }
 
+static void mtch_interpreter_reset
+(const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_interpreter *interp ATTR_UNUSED, void *context)
+{
+	struct mtch_interpreter_context *mctx =
+		(struct mtch_interpreter_context *) context;
+
+	if ( mctx->match_values != NULL ) {
+		pool_unref(&mctx->match_values->pool);
+		mctx->match_values = NULL;
+	}
+}
+
 struct sieve_interpreter_extension mtch_interpreter_extension = {
 	&match_type_extension,
 	NULL,
-	mtch_interpreter_free
+	mtch_interpreter_free,
+	mtch_interpreter_reset
 };
 
 static inline struct mtch_interpreter_context *get_interpreter_context
@@ -503,6 +518,97 @@ bool sieve_match_type_validate
 	return TRUE;
 }
 
+static bool sieve_match_const_list_is_literal
+(struct sieve_ast_argument *list)
+{
+	struct sieve_ast_argument *item;
+
+	if ( sieve_ast_argument_type(list) == SAAT_STRING ) {
+		return ( list->argument != NULL &&
+			sieve_argument_is_string_literal(list) );
+	}
+
+	if ( sieve_ast_argument_type(list) != SAAT_STRING_LIST )
+		return FALSE;
+
+	item = sieve_ast_strlist_first(list);
+	while ( item != NULL ) {
+		if ( item->argument == NULL || !sieve_argument_is_string_literal(item) )
+			return FALSE;
+		item = sieve_ast_strlist_next(item);
+	}
+	return TRUE;
+}
+
+static struct sieve_ast_argument *sieve_match_const_list_next
+(struct sieve_ast_argument *list, struct sieve_ast_argument *item)
+{
+	if ( sieve_ast_argument_type(list) == SAAT_STRING )
+		return ( item == NULL ? list : NULL );
+	return ( item == NULL ?
+		sieve_ast_strlist_first(list) : sieve_ast_strlist_next(item) );
+}
+
+int sieve_match_type_validate_const
+(struct sieve_validator *valdtr ATTR_UNUSED, struct sieve_command *cmd,
+	struct sieve_ast_argument *value_arg, struct sieve_ast_argument *key_arg,
+	const struct sieve_match_type *mcht_default,
+	const struct sieve_comparator *cmp_default)
+{
+	struct sieve_ast_argument *arg = sieve_command_first_argument(cmd);
+	const struct sieve_match_type *mcht = mcht_default;
+	const struct sieve_comparator *cmp = cmp_default;
+	struct sieve_match_context mctx;
+	struct sieve_ast_argument *value, *key;
+
+	/* Find match type and comparator among the arguments */
+	while ( arg != NULL && arg != cmd->first_positional ) {
+		if ( sieve_argument_is_comparator(arg) ) {
+			cmp = sieve_comparator_tag_get(arg);
+		} else if ( sieve_argument_is_match_type(arg) ) {
+			struct sieve_match_type_context *mtctx =
+				(struct sieve_match_type_context *) arg->argument->data;
+
+			if ( mtctx == NULL )
+				return -1;
+			mcht = mtctx->match_type;
+		}
+		arg = sieve_ast_argument_next(arg);
+	}
+
+	/* Only match types that have no side effects (e.g. match values) and
+	   that need no runtime context are evaluated */
+	if ( mcht == NULL || cmp == NULL || mcht->def == NULL ||
+		mcht->def->match_key == NULL ||
+		(!sieve_match_type_is(mcht, is_match_type) &&
+			!sieve_match_type_is(mcht, contains_match_type)) )
+		return -1;
+
+	if ( !sieve_match_const_list_is_literal(value_arg) ||
+		!sieve_match_const_list_is_literal(key_arg) )
+		return -1;
+
+	memset(&mctx, 0, sizeof(mctx));
+	mctx.match_type = mcht;
+	mctx.comparator = cmp;
+
+	value = NULL;
+	while ( (value=sieve_match_const_list_next(value_arg, value)) != NULL ) {
+		string_t *value_str = sieve_ast_argument_str(value);
+
+		key = NULL;
+		while ( (key=sieve_match_const_list_next(key_arg, key)) != NULL ) {
+			string_t *key_str = sieve_ast_argument_str(key);
+
+			if ( mcht->def->match_key(&mctx,
+				str_c(value_str), str_len(value_str),
+				str_c(key_str), str_len(key_str)) > 0 )
+				return 1;
+		}
+	}
+	return 0;
+}
+
 void sieve_match_type_arguments_remove
 (struct sieve_validator *valdtr ATTR_UNUSED, struct sieve_command *cmd)
 {
@@ -181,6 +181,15 @@ bool sieve_match_type_validate
 		const struct sieve_match_type *mcht_default,
 		const struct sieve_comparator *cmp_default);
 
+/* Evaluates the match at compile time when both the value and key lists
+   consist of string literals only. Returns the match result (0 or 1) or -1
+   when the result is not known until runtime. */
+int sieve_match_type_validate_const
+	(struct sieve_validator *valdtr, struct sieve_command *cmd,
+		struct sieve_ast_argument *value_arg, struct sieve_ast_argument *key_arg,
+		const struct sieve_match_type *mcht_default,
+		const struct sieve_comparator *cmp_default);
+
 void sieve_match_type_arguments_remove
 	(struct sieve_validator *valdtr, struct sieve_command *cmd);
 
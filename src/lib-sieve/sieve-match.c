@@ -19,6 +19,8 @@
 #include "sieve-comparators.h"
 #include "sieve-match-types.h"
 #include "sieve-runtime-trace.h"
+#include "sieve-profile.h"
+#include "sieve-match-keyset.h"
 
 #include "sieve-match.h"
 
@@ -40,7 +42,7 @@ struct sieve_match_context *sieve_match_begin
 			return NULL;
 
 	/* Create match context */
-	pool = pool_alloconly_create("sieve_match_context", 1024);
+	pool = sieve_interpreter_match_pool_get(renv->interp);
 	mctx = p_new(pool, struct sieve_match_context, 1);
 	mctx->pool = pool;
 	mctx->runenv = renv;
@@ -78,6 +80,8 @@ int sieve_match_value
 			"matching value `%s'", str_sanitize(value, 80));
 	}
 
+	sieve_runtime_profile_matched(renv, value_size);
+
 	/* Match to key values */
 
 	sieve_stringlist_reset(key_list);
@@ -93,20 +97,37 @@ int sieve_match_value
 	} else {
 		string_t *key_item = NULL;
 
-		/* Default key match loop */
-		match = 0;
-		while ( match == 0 &&
-			(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
-			T_BEGIN {
-				match = mcht->def->match_key
-					(mctx, value, value_size, str_c(key_item), str_len(key_item));
-
-				if ( mctx->trace ) {
-					sieve_runtime_trace(renv, 0,
-						"with key `%s' => %d", str_sanitize(str_c(key_item), 80),
-						match);
-				}
-			} T_END;
+		/* Large constant key lists are matched in a single pass; keys are
+		   matched one by one when tracing */
+		ret = 0;
+		match = -1;
+		if ( !mctx->trace ) {
+			if ( mctx->keyset_list != key_list ) {
+				mctx->keyset_list = key_list;
+				mctx->keyset = sieve_match_keyset_get(mctx, key_list);
+			}
+			if ( mctx->keyset != NULL ) {
+				match = sieve_match_keyset_match
+					(mctx->keyset, value, value_size);
+			}
+		}
+
+		if ( match < 0 ) {
+			/* Default key match loop */
+			match = 0;
+			while ( match == 0 &&
+				(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+				T_BEGIN {
+					match = mcht->def->match_key
+						(mctx, value, value_size, str_c(key_item), str_len(key_item));
+
+					if ( mctx->trace ) {
+						sieve_runtime_trace(renv, 0,
+							"with key `%s' => %d", str_sanitize(str_c(key_item), 80),
+							match);
+					}
+				} T_END;
+			}
 		}
 
 		if ( ret < 0 ) {
@@ -137,7 +158,7 @@ int sieve_match_end(struct sieve_match_context **mctx, int *exec_status)
 	if ( exec_status != NULL )
 		*exec_status = (*mctx)->exec_status;
 
-	pool_unref(&(*mctx)->pool);
+	sieve_interpreter_match_pool_put(renv->interp, &(*mctx)->pool);
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_MATCHING,
 		"finishing match with result: %s",
@@ -20,6 +20,10 @@ struct sieve_match_context {
 
 	void *data;
 
+	/* Preprocessed key set for the last constant key list */
+	struct sieve_stringlist *keyset_list;
+	struct sieve_match_keyset *keyset;
+
 	int match_status;
 	int exec_status;
 
@@ -5,11 +5,13 @@
 #include "ioloop.h"
 #include "mempool.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "istream.h"
 #include "rfc822-parser.h"
 #include "message-date.h"
+#include "message-address.h"
 #include "message-parser.h"
 #include "message-decoder.h"
 #include "message-header-decode.h"
@@ -84,6 +86,12 @@ struct sieve_message_version {
 	struct edit_mail *edit_mail;
 };
 
+struct sieve_message_header_values {
+	/* Right-trimmed values; NULL when not fetched yet */
+	const char *const *raw;
+	const char *const *decoded;
+};
+
 struct sieve_message_context {
 	pool_t pool;
 	pool_t context_pool;
@@ -95,6 +103,9 @@ struct sieve_message_context {
 	struct mail_user *mail_user;
 	const struct sieve_message_data *msgdata;
 
+	/* Views materialized during this delivery */
+	struct sieve_message_context_stats stats;
+
 	/* Normalized envelope addresses */
 
 	bool envelope_parsed;
@@ -105,19 +116,27 @@ struct sieve_message_context {
 
 	/* Message versioning */
 
-	struct mail_user *raw_mail_user;
 	ARRAY(struct sieve_message_version) versions;
 
 	/* Context data for extensions */
 
 	ARRAY(void *) ext_contexts;
 
+	/* Header index (values already fetched from the current version) */
+
+	HASH_TABLE(const char *, struct sieve_message_header_values *) headers;
+
+	/* Parsed addresses (indexed by the header field value) */
+
+	HASH_TABLE(const char *, struct sieve_message_addresses *) addresses;
+
 	/* Body */
 
 	ARRAY(struct sieve_message_part *) cached_body_parts;
 	ARRAY(struct sieve_message_part_data) return_body_parts;
 	buffer_t *raw_body;
 
+	unsigned int time_set:1;
 	unsigned int edit_snapshot:1;
 	unsigned int substitute_snapshot:1;
 };
@@ -126,9 +145,24 @@ struct sieve_message_context {
  * Message versions
  */
 
+/* The message context pool and the version list are only created once an
+   envelope address is parsed or the message is modified */
+static void sieve_message_context_pool_init
+(struct sieve_message_context *msgctx)
+{
+	if ( msgctx->pool != NULL )
+		return;
+
+	msgctx->pool = pool_alloconly_create("sieve_message_context", 1024);
+	p_array_init(&msgctx->versions, msgctx->pool, 4);
+}
+
 static inline struct sieve_message_version *sieve_message_version_new
 (struct sieve_message_context *msgctx)
 {
+	sieve_message_context_pool_init(msgctx);
+
+	msgctx->stats.versions++;
 	return array_append_space(&msgctx->versions);
 }
 
@@ -138,9 +172,13 @@ static inline struct sieve_message_version *sieve_message_version_get
 	struct sieve_message_version *versions;
 	unsigned int count;
 
+	sieve_message_context_pool_init(msgctx);
+
 	versions = array_get_modifiable(&msgctx->versions, &count);
-	if ( count == 0 )
+	if ( count == 0 ) {
+		msgctx->stats.versions++;
 		return array_append_space(&msgctx->versions);
+	}
 
 	return &versions[count-1];
 }
@@ -178,10 +216,7 @@ struct sieve_message_context *sieve_message_context_create
 	msgctx->mail_user = mail_user;
 	msgctx->msgdata = msgdata;
 
-	if (gettimeofday(&msgctx->time, NULL) < 0)
-		i_fatal("gettimeofday(): %m");
-
-	sieve_message_context_reset(msgctx);
+	/* Everything else is initialized upon first use */
 
 	return msgctx;
 }
@@ -191,6 +226,20 @@ void sieve_message_context_ref(struct sieve_message_context *msgctx)
 	msgctx->refcount++;
 }
 
+static void sieve_message_header_index_clear
+(struct sieve_message_context *msgctx)
+{
+	if ( hash_table_is_created(msgctx->headers) )
+		hash_table_destroy(&msgctx->headers);
+}
+
+static void sieve_message_address_cache_clear
+(struct sieve_message_context *msgctx)
+{
+	if ( hash_table_is_created(msgctx->addresses) )
+		hash_table_destroy(&msgctx->addresses);
+}
+
 static void sieve_message_context_clear(struct sieve_message_context *msgctx)
 {
 	struct sieve_message_version *versions;
@@ -219,10 +268,20 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx)
 	if (--(*msgctx)->refcount != 0)
 		return;
 
-	if ( (*msgctx)->raw_mail_user != NULL )
-		mail_user_unref(&(*msgctx)->raw_mail_user);
+	if ( (*msgctx)->svinst->debug ) {
+		const struct sieve_message_context_stats *stats = &(*msgctx)->stats;
+
+		sieve_sys_debug((*msgctx)->svinst, "message context: "
+			"materialized views: envelope=%u, header-fields=%u, "
+			"address-values=%u, body-parses=%u, part-trees=%u, raw-body=%u, "
+			"versions=%u", stats->envelope, stats->header_fields,
+			stats->address_values, stats->body_parses, stats->part_trees,
+			stats->raw_body, stats->versions);
+	}
 
 	sieve_message_context_clear(*msgctx);
+	sieve_message_header_index_clear(*msgctx);
+	sieve_message_address_cache_clear(*msgctx);
 
 	if ( (*msgctx)->context_pool != NULL )
 		pool_unref(&((*msgctx)->context_pool));
@@ -233,42 +292,51 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx)
 
 static void sieve_message_context_flush(struct sieve_message_context *msgctx)
 {
-	pool_t pool;
+	sieve_message_header_index_clear(msgctx);
+	sieve_message_address_cache_clear(msgctx);
 
+	/* Data is allocated anew upon first use */
 	if ( msgctx->context_pool != NULL )
 		pool_unref(&(msgctx->context_pool));
 
-	msgctx->context_pool = pool =
-		pool_alloconly_create("sieve_message_context_data", 1024);
-
-	p_array_init(&msgctx->ext_contexts, pool,
-		sieve_extensions_get_count(msgctx->svinst));
-
-	p_array_init(&msgctx->cached_body_parts, pool, 8);
-	p_array_init(&msgctx->return_body_parts, pool, 8);
+	memset(&msgctx->ext_contexts, 0, sizeof(msgctx->ext_contexts));
+	memset(&msgctx->cached_body_parts, 0, sizeof(msgctx->cached_body_parts));
+	memset(&msgctx->return_body_parts, 0, sizeof(msgctx->return_body_parts));
 	msgctx->raw_body = NULL;
 }
 
 void sieve_message_context_reset(struct sieve_message_context *msgctx)
 {
 	sieve_message_context_clear(msgctx);
-
-	msgctx->pool = pool_alloconly_create("sieve_message_context", 1024);
-
-	p_array_init(&msgctx->versions, msgctx->pool, 4);
-
 	sieve_message_context_flush(msgctx);
 }
 
 pool_t sieve_message_context_pool(struct sieve_message_context *msgctx)
 {
+	if ( msgctx->context_pool == NULL ) {
+		msgctx->context_pool =
+			pool_alloconly_create("sieve_message_context_data", 1024);
+	}
 	return msgctx->context_pool;
 }
 
 void sieve_message_context_time(struct sieve_message_context *msgctx,
    struct timeval *time)
 {
-   *time = msgctx->time;
+	/* Determined once upon first request */
+	if ( !msgctx->time_set ) {
+		if (gettimeofday(&msgctx->time, NULL) < 0)
+			i_fatal("gettimeofday(): %m");
+		msgctx->time_set = TRUE;
+	}
+
+	*time = msgctx->time;
+}
+
+void sieve_message_context_get_stats(struct sieve_message_context *msgctx,
+	struct sieve_message_context_stats *stats_r)
+{
+	*stats_r = msgctx->stats;
 }
 
 /* Extension support */
@@ -279,6 +347,11 @@ void sieve_message_context_extension_set
 {
 	if ( ext->id < 0 ) return;
 
+	if ( !array_is_created(&msgctx->ext_contexts) ) {
+		p_array_init(&msgctx->ext_contexts, sieve_message_context_pool(msgctx),
+			sieve_extensions_get_count(msgctx->svinst));
+	}
+
 	array_idx_set(&msgctx->ext_contexts, (unsigned int) ext->id, &context);
 }
 
@@ -287,7 +360,8 @@ const void *sieve_message_context_extension_get
 {
 	void * const *ctx;
 
-	if  ( ext->id < 0 || ext->id >= (int) array_count(&msgctx->ext_contexts) )
+	if  ( ext->id < 0 || !array_is_created(&msgctx->ext_contexts) ||
+		ext->id >= (int) array_count(&msgctx->ext_contexts) )
 		return NULL;
 
 	ctx = array_idx(&msgctx->ext_contexts, (unsigned int) ext->id);
@@ -304,6 +378,9 @@ static void sieve_message_envelope_parse(struct sieve_message_context *msgctx)
 
 	/* FIXME: log parse problems properly; logs only 'failure' now */
 
+	sieve_message_context_pool_init(msgctx);
+	msgctx->stats.envelope++;
+
 	msgctx->envelope_orig_recipient = sieve_address_parse_envelope_path
 		(msgctx->pool, msgdata->orig_envelope_to);
 
@@ -404,31 +481,45 @@ const char *sieve_message_get_sender
  * Mail
  */
 
+static struct mail_user *sieve_message_raw_user_get
+(struct sieve_message_context *msgctx)
+{
+	struct sieve_instance *svinst = msgctx->svinst;
+
+	/* Created once per instance, so that the substitutions of subsequent
+	   messages need not set up the raw storage again */
+	if ( svinst->raw_mail_user == NULL ) {
+		void **sets = master_service_settings_get_others(master_service);
+
+		svinst->raw_mail_user =
+			raw_storage_create_from_set(msgctx->mail_user->set_info, sets[0]);
+	}
+	return svinst->raw_mail_user;
+}
+
+void sieve_message_raw_user_deinit(struct sieve_instance *svinst)
+{
+	if ( svinst->raw_mail_user != NULL )
+		mail_user_unref(&svinst->raw_mail_user);
+}
+
 int sieve_message_substitute
 (struct sieve_message_context *msgctx, struct istream *input)
 {
 	static const char *wanted_headers[] = {
 		"From", "Message-ID", "Subject", "Return-Path", NULL
 	};
-	struct mail_user *mail_user = msgctx->mail_user;
 	struct sieve_message_version *version;
 	struct mailbox_header_lookup_ctx *headers_ctx;
 	struct mailbox *box = NULL;
 	const char *sender;
 	int ret;
 
-	if ( msgctx->raw_mail_user == NULL ) {
-		void **sets = master_service_settings_get_others(master_service);
-
-		msgctx->raw_mail_user =
-			raw_storage_create_from_set(mail_user->set_info, sets[0]);
-	}
-
 	i_stream_seek(input, 0);
 	sender = sieve_message_get_sender(msgctx);
 	sender = (sender == NULL ? DEFAULT_ENVELOPE_SENDER : sender );
-	ret = raw_mailbox_alloc_stream(msgctx->raw_mail_user, input, (time_t)-1,
-		sender, &box);
+	ret = raw_mailbox_alloc_stream(sieve_message_raw_user_get(msgctx), input,
+		(time_t)-1, sender, &box);
 
 	if ( ret < 0 ) {
 		sieve_sys_error(msgctx->svinst, "can't open substituted mail as raw: %s",
@@ -464,6 +555,9 @@ struct mail *sieve_message_get_mail
 	const struct sieve_message_version *versions;
 	unsigned int count;
 
+	if ( msgctx->pool == NULL )
+		return msgctx->msgdata->mail;
+
 	versions = array_get(&msgctx->versions, &count);
 	if ( count == 0 )
 		return msgctx->msgdata->mail;
@@ -481,6 +575,9 @@ struct edit_mail *sieve_message_edit
 
 	version = sieve_message_version_get(msgctx);
 
+	/* The headers may be modified from here on */
+	sieve_message_header_index_clear(msgctx);
+
 	if ( version->edit_mail == NULL ) {
 		version->edit_mail = edit_mail_wrap
 			(( version->mail == NULL ? msgctx->msgdata->mail : version->mail ));
@@ -500,6 +597,153 @@ void sieve_message_snapshot
 	msgctx->substitute_snapshot = TRUE;
 }
 
+/*
+ * Message header index
+ */
+
+static const char *const *
+sieve_message_header_values_trim(pool_t pool, const char *const *headers)
+{
+	const char **values;
+	unsigned int count, i;
+
+	count = ( headers == NULL ? 0 : str_array_length(headers) );
+	values = p_new(pool, const char *, count + 1);
+
+	for ( i = 0; i < count; i++ ) {
+		const char *raw = headers[i];
+		int len;
+
+		for ( len = strlen(raw); len > 0; len-- ) {
+			if ( raw[len-1] != ' ' && raw[len-1] != '\t' ) break;
+		}
+
+		values[i] = p_strndup(pool, raw, len);
+	}
+
+	return values;
+}
+
+int sieve_message_get_header_values
+(struct sieve_message_context *msgctx, const char *field_name,
+	bool mime_decode, const char *const **values_r)
+{
+	struct mail *mail = sieve_message_get_mail(msgctx);
+	struct sieve_message_header_values *hvalues;
+	const char *const *headers;
+	const char *const **values;
+	int ret;
+
+	if ( !hash_table_is_created(msgctx->headers) ) {
+		hash_table_create(&msgctx->headers, default_pool, 0,
+			strcase_hash, strcasecmp);
+	}
+
+	hvalues = hash_table_lookup(msgctx->headers, field_name);
+	if ( hvalues == NULL ) {
+		pool_t pool = sieve_message_context_pool(msgctx);
+
+		hvalues = p_new(pool, struct sieve_message_header_values, 1);
+		hash_table_insert(msgctx->headers, p_strdup(pool, field_name), hvalues);
+		msgctx->stats.header_fields++;
+	}
+
+	values = ( mime_decode ? &hvalues->decoded : &hvalues->raw );
+	if ( *values == NULL ) {
+		/* Fetch all matching headers from the e-mail */
+		if ( mime_decode )
+			ret = mail_get_headers_utf8(mail, field_name, &headers);
+		else
+			ret = mail_get_headers(mail, field_name, &headers);
+		if ( ret < 0 )
+			return -1;
+
+		*values = sieve_message_header_values_trim
+			(sieve_message_context_pool(msgctx), headers);
+	}
+
+	*values_r = *values;
+	return ( (*values)[0] == NULL ? 0 : 1 );
+}
+
+/*
+ * Parsed addresses
+ */
+
+static struct sieve_message_addresses *
+sieve_message_addresses_parse(pool_t pool, const char *value, size_t value_size)
+{
+	struct sieve_message_addresses *maddrs;
+
+	maddrs = p_new(pool, struct sieve_message_addresses, 1);
+
+	T_BEGIN {
+		const struct message_address *addrs, *aitem;
+		struct sieve_address *saddrs;
+		unsigned int count = 0;
+
+		addrs = message_address_parse(pool_datastack_create(),
+			(const unsigned char *)value, value_size, 256, FALSE);
+
+		/* Check validity of all addresses simultaneously. Unfortunately,
+		 * errorneous addresses cannot be extracted from the address list.
+		 */
+		if ( addrs == NULL )
+			maddrs->invalid = TRUE;
+		for ( aitem = addrs; aitem != NULL; aitem = aitem->next ) {
+			if ( aitem->invalid_syntax )
+				maddrs->invalid = TRUE;
+			if ( aitem->domain != NULL )
+				count++;
+		}
+
+		/* Keep the usable addresses */
+		if ( !maddrs->invalid && count > 0 ) {
+			saddrs = p_new(pool, struct sieve_address, count);
+			for ( aitem = addrs; aitem != NULL; aitem = aitem->next ) {
+				if ( aitem->domain == NULL )
+					continue;
+				saddrs[maddrs->count].local_part = p_strdup(pool, aitem->mailbox);
+				saddrs[maddrs->count].domain = p_strdup(pool, aitem->domain);
+				maddrs->count++;
+			}
+			maddrs->addresses = saddrs;
+		}
+	} T_END;
+
+	return maddrs;
+}
+
+const struct sieve_message_addresses *sieve_message_get_addresses
+(struct sieve_message_context *msgctx, const char *value, size_t value_size)
+{
+	struct sieve_message_addresses *maddrs;
+	pool_t pool;
+
+	/* Values with NUL characters cannot be used as key */
+	if ( memchr(value, '\0', value_size) != NULL ) {
+		return sieve_message_addresses_parse
+			(pool_datastack_create(), value, value_size);
+	}
+
+	if ( !hash_table_is_created(msgctx->addresses) ) {
+		hash_table_create(&msgctx->addresses, default_pool, 0,
+			str_hash, strcmp);
+	}
+
+	maddrs = hash_table_lookup(msgctx->addresses, value);
+	if ( maddrs == NULL ) {
+		pool = sieve_message_context_pool(msgctx);
+
+		maddrs = sieve_message_addresses_parse(pool, value, value_size);
+		hash_table_insert(msgctx->addresses,
+			p_strndup(pool, value, value_size), maddrs);
+		msgctx->stats.address_values++;
+	}
+
+	return maddrs;
+}
+
 /*
  * Message header list
  */
@@ -547,21 +791,6 @@ struct sieve_header_list *sieve_message_header_list_create
 	return &hdrlist->hdrlist;
 }
 
-// NOTE: get rid of this once we have a proper Sieve string type
-static inline string_t *_header_right_trim(const char *raw)
-{
-	string_t *result;
-	int i;
-
-	for ( i = strlen(raw)-1; i >= 0; i-- ) {
-		if ( raw[i] != ' ' && raw[i] != '\t' ) break;
-	}
-
-	result = t_str_new(i+1);
-	str_append_n(result, raw, i + 1);
-	return result;
-}
-
 /* String list implementation */
 
 static int sieve_message_header_list_next_item
@@ -571,7 +800,7 @@ static int sieve_message_header_list_next_item
 	struct sieve_message_header_list *hdrlist =
 		(struct sieve_message_header_list *) _hdrlist;
 	const struct sieve_runtime_env *renv = _hdrlist->strlist.runenv;
-	struct mail *mail = sieve_message_get_mail(renv->msgctx);
+	const char *value;
 
 	if ( name_r != NULL )
 		*name_r = NULL;
@@ -603,23 +832,17 @@ static int sieve_message_header_list_next_item
 				str_sanitize(str_c(hdr_item), 80));
 		}
 
-		/* Fetch all matching headers from the e-mail */
-		if ( hdrlist->mime_decode ) {
-			ret = mail_get_headers_utf8(mail,
-				str_c(hdr_item), &hdrlist->headers);
-		} else {
-			ret = mail_get_headers(mail,
-				str_c(hdr_item), &hdrlist->headers);
-		}
-
-		if (ret < 0) {
+		/* Fetch all matching headers from the e-mail (or the header index) */
+		if ( (ret=sieve_message_get_header_values(renv->msgctx,
+			str_c(hdr_item), hdrlist->mime_decode, &hdrlist->headers)) < 0 ) {
 			_hdrlist->strlist.exec_status =
-				sieve_runtime_mail_error(renv, mail,
+				sieve_runtime_mail_error(renv,
+					sieve_message_get_mail(renv->msgctx),
 					"failed to read header field `%s'", str_c(hdr_item));
 			return -1;
 		}
 
-		if ( hdrlist->headers == NULL || hdrlist->headers[0] == NULL ) {
+		if ( ret == 0 ) {
 			/* Try next item when no headers found */
 			hdrlist->headers = NULL;
 		}
@@ -628,7 +851,8 @@ static int sieve_message_header_list_next_item
 	/* Return next item */
 	if ( name_r != NULL )
 		*name_r = hdrlist->header_name;
-	*value_r = _header_right_trim(hdrlist->headers[hdrlist->headers_index++]);
+	value = hdrlist->headers[hdrlist->headers_index++];
+	*value_r = t_str_new_const(value, strlen(value));
 	return 1;
 }
 
@@ -926,6 +1150,18 @@ void sieve_message_part_get_data
  * Message body
  */
 
+static void sieve_message_body_init(struct sieve_message_context *msgctx)
+{
+	pool_t pool;
+
+	if ( array_is_created(&msgctx->cached_body_parts) )
+		return;
+
+	pool = sieve_message_context_pool(msgctx);
+	p_array_init(&msgctx->cached_body_parts, pool, 8);
+	p_array_init(&msgctx->return_body_parts, pool, 8);
+}
+
 static void str_replace_nuls(string_t *str)
 {
 	char *data = str_c_modifiable(str);
@@ -1139,17 +1375,152 @@ _parse_content_disposition(const struct message_header_line *hdr)
 	return str_c(content_disp);
 }
 
+/* Body streaming */
+
+/* While streaming, the decoded parts are collected for the body part cache,
+ * so that later body tests need not parse the message again. Parts larger than
+ * SIEVE_MESSAGE_BODY_STREAM_CACHE_LIMIT are not cached; keeping those in
+ * memory is what streaming avoids. Parts that are left unfinished because the
+ * stream was stopped early are not cached either.
+ */
+#define SIEVE_MESSAGE_BODY_STREAM_CACHE_LIMIT (64 * 1024)
+
+struct sieve_message_body_stream {
+	const struct sieve_message_body_sink *sink;
+	void *context;
+
+	struct mail_html2text *html2text;
+	buffer_t *text_buf;
+
+	unsigned int stopped:1;
+	unsigned int part_uncached:1;
+};
+
+static void sieve_message_body_stream_more
+(struct sieve_message_body_stream *stream,
+	struct sieve_message_part *body_part, bool extract_text,
+	const unsigned char *data, size_t size)
+{
+	if ( stream->stopped || size == 0 )
+		return;
+
+	/* Remove HTML markup incrementally if text is requested */
+	if ( extract_text && body_part->children == NULL &&
+		!body_part->epilogue && stream->html2text == NULL &&
+		mail_html2text_content_type_match(body_part->content_type) )
+		stream->html2text = mail_html2text_init(0);
+
+	if ( stream->html2text != NULL ) {
+		if ( stream->text_buf == NULL )
+			stream->text_buf = buffer_create_dynamic(default_pool, 4096);
+
+		mail_html2text_more(stream->html2text, data, size, stream->text_buf);
+		data = stream->text_buf->data;
+		size = stream->text_buf->used;
+	}
+
+	if ( size > 0 && stream->sink->more(stream->context, data, size) > 0 )
+		stream->stopped = TRUE;
+
+	if ( stream->text_buf != NULL )
+		buffer_set_used_size(stream->text_buf, 0);
+}
+
+static void sieve_message_body_stream_part_end
+(struct sieve_message_body_stream *stream)
+{
+	if ( stream->html2text != NULL )
+		mail_html2text_deinit(&stream->html2text);
+
+	if ( !stream->stopped )
+		stream->sink->part_end(stream->context);
+}
+
+static void sieve_message_body_stream_deinit
+(struct sieve_message_body_stream *stream)
+{
+	if ( stream->html2text != NULL )
+		mail_html2text_deinit(&stream->html2text);
+	if ( stream->text_buf != NULL )
+		buffer_free(&stream->text_buf);
+}
+
+static void sieve_message_body_stream_parts
+(struct sieve_message_body_stream *stream,
+	const struct sieve_message_part_data *parts)
+{
+	for (; parts->content != NULL && !stream->stopped; parts++ ) {
+		if ( parts->size > 0 &&
+			stream->sink->more(stream->context,
+				(const unsigned char *)parts->content, parts->size) > 0 ) {
+			stream->stopped = TRUE;
+			break;
+		}
+		stream->sink->part_end(stream->context);
+	}
+}
+
+/* sieve_message_part_append():
+ *   Add decoded data to the body part; collect it in the buffer for the cache
+ *   and pass it to the stream, if any.
+ */
+static void sieve_message_part_append
+(buffer_t *buf, struct sieve_message_part *body_part, bool extract_text,
+	struct sieve_message_body_stream *stream,
+	const void *data, size_t size)
+{
+	if ( stream == NULL ) {
+		buffer_append(buf, data, size);
+		return;
+	}
+
+	sieve_message_body_stream_more(stream, body_part, extract_text,
+		(const unsigned char *)data, size);
+
+	if ( stream->part_uncached )
+		return;
+	if ( buf->used + size > SIEVE_MESSAGE_BODY_STREAM_CACHE_LIMIT ) {
+		stream->part_uncached = TRUE;
+		buffer_set_used_size(buf, 0);
+		return;
+	}
+	buffer_append(buf, data, size);
+}
+
+/* sieve_message_part_finish():
+ *   Finish a body part; store it in the cache and complete it for the stream.
+ */
+static void sieve_message_part_finish
+(const struct sieve_runtime_env *renv, buffer_t *buf,
+	struct sieve_message_part *body_part, bool extract_text,
+	struct sieve_message_body_stream *stream)
+{
+	if ( stream == NULL ) {
+		sieve_message_part_save(renv, buf, body_part, extract_text);
+		return;
+	}
+
+	if ( !stream->stopped && !stream->part_uncached )
+		sieve_message_part_save(renv, buf, body_part, extract_text);
+	sieve_message_body_stream_part_end(stream);
+
+	stream->part_uncached = FALSE;
+	buffer_set_used_size(buf, 0);
+}
+
 /* sieve_message_parts_add_missing():
- *   Add requested message body parts to the cache that are missing.
+ *   Add requested message body parts to the cache that are missing. When a
+ *   stream is provided, the decoded parts are passed to it instead.
  */
 static int sieve_message_parts_add_missing
 (const struct sieve_runtime_env *renv,
 	const char *const *content_types,
-	bool extract_text, bool iter_all)
-	ATTR_NULL(2)
+	bool extract_text, bool iter_all,
+	struct sieve_message_body_stream *stream)
+	ATTR_NULL(2, 5)
 {
 	struct sieve_message_context *msgctx = renv->msgctx;
-	pool_t pool = msgctx->context_pool;
+	pool_t pool = sieve_message_context_pool(msgctx);
 	struct mail *mail = sieve_message_get_mail(renv->msgctx);
 	enum message_parser_flags mparser_flags =
 		MESSAGE_PARSER_FLAG_INCLUDE_MULTIPART_BLOCKS;
@@ -1168,13 +1539,25 @@ static int sieve_message_parts_add_missing
 	string_t *hdr_content = NULL;
 	int ret;
 
+	sieve_message_body_init(msgctx);
+
 	/* First check whether any are missing */
 	if ( !iter_all && sieve_message_body_get_return_parts
 		(renv, content_types, extract_text) ) {
 		/* Cache hit; all are present */
+		if ( stream != NULL ) {
+			(void)array_append_space(&msgctx->return_body_parts);
+			sieve_message_body_stream_parts
+				(stream, array_idx(&msgctx->return_body_parts, 0));
+		}
 		return SIEVE_EXEC_OK;
 	}
 
+	if ( iter_all )
+		msgctx->stats.part_trees++;
+	else
+		msgctx->stats.body_parses++;
+
 	/* Get the message stream */
 	if ( mail_get_stream(mail, NULL, NULL, &input) < 0 ) {
 		return sieve_runtime_mail_error(renv, mail,
@@ -1204,8 +1587,8 @@ static int sieve_message_parts_add_missing
 		// hparser_flags, mparser_flags);
 	parser = message_parser_init(pool_datastack_create(),
 		input, hparser_flags, mparser_flags);
-	while ( (ret=message_parser_parse_next_block
-		(parser, &block)) > 0 ) {
+	while ( (stream == NULL || !stream->stopped) &&
+		(ret=message_parser_parse_next_block(parser, &block)) > 0 ) {
 		struct sieve_message_part **body_part_idx;
 		struct message_header_line *hdr = block.hdr;
 		struct sieve_message_header *header;
@@ -1222,8 +1605,8 @@ static int sieve_message_parts_add_missing
 					message_rfc822 = TRUE;
 				} else {
 					if ( save_body ) {
-						sieve_message_part_save
-							(renv, buf, body_part, extract_text);
+						sieve_message_part_finish
+							(renv, buf, body_part, extract_text, stream);
 					}
 				}
 				if ( iter_all && !array_is_created(&body_part->headers) &&
@@ -1319,8 +1702,8 @@ static int sieve_message_parts_add_missing
 			if ( hdr == NULL ) {
 				/* Save headers for message/rfc822 part */
 				if ( header_part != NULL ) {
-					sieve_message_part_save
-						(renv, buf, header_part, FALSE);
+					sieve_message_part_finish
+						(renv, buf, header_part, FALSE, stream);
 					header_part = NULL;
 				}
 
@@ -1341,14 +1724,19 @@ static int sieve_message_parts_add_missing
 			} else if ( header_part != NULL ) {
 				/* Save message/rfc822 header as part content */
 				if ( hdr->continued ) {
-					buffer_append(buf, hdr->value, hdr->value_len);
+					sieve_message_part_append(buf, header_part, FALSE, stream,
+						hdr->value, hdr->value_len);
 				} else {
-					buffer_append(buf, hdr->name, hdr->name_len);
-					buffer_append(buf, hdr->middle, hdr->middle_len);
-					buffer_append(buf, hdr->value, hdr->value_len);
+					sieve_message_part_append(buf, header_part, FALSE, stream,
+						hdr->name, hdr->name_len);
+					sieve_message_part_append(buf, header_part, FALSE, stream,
+						hdr->middle, hdr->middle_len);
+					sieve_message_part_append(buf, header_part, FALSE, stream,
+						hdr->value, hdr->value_len);
 				}
 				if ( !hdr->no_newline ) {
-					buffer_append(buf, "\r\n", 2);
+					sieve_message_part_append(buf, header_part, FALSE, stream,
+						"\r\n", 2);
 				}
 			}
 
@@ -1447,17 +1835,20 @@ static int sieve_message_parts_add_missing
 		if ( save_body ) {
 			(void)message_decoder_decode_next_block
 					(decoder, &block, &decoded);
-			buffer_append(buf, decoded.data, decoded.size);
+			sieve_message_part_append(buf, body_part, extract_text, stream,
+				decoded.data, decoded.size);
 		}
 	}
 
 	/* Save last body part if necessary */
-	if ( header_part != NULL ) {
-		sieve_message_part_save
-			(renv, buf, header_part, FALSE);
+	if ( stream != NULL && stream->stopped ) {
+		/* Stream stopped early */
+	} else if ( header_part != NULL ) {
+		sieve_message_part_finish
+			(renv, buf, header_part, FALSE, stream);
 	} else if ( body_part != NULL && save_body ) {
-		sieve_message_part_save
-			(renv, buf, body_part, extract_text);
+		sieve_message_part_finish
+			(renv, buf, body_part, extract_text, stream);
 	}
 	if ( iter_all && !array_is_created(&body_part->headers) &&
 		array_count(&headers) > 0 ) {
@@ -1467,8 +1858,9 @@ static int sieve_message_parts_add_missing
 	}
 
 	/* Try to fill the return_body_parts array once more */
-	have_all = iter_all || sieve_message_body_get_return_parts
-		(renv, content_types, extract_text);
+	have_all = iter_all || stream != NULL ||
+		sieve_message_body_get_return_parts
+			(renv, content_types, extract_text);
 
 	/* This time, failure is a bug */
 	i_assert(have_all);
@@ -1500,7 +1892,7 @@ int sieve_message_body_get_content
 	T_BEGIN {
 		/* Fill the return_body_parts array */
 		status = sieve_message_parts_add_missing
-			(renv, content_types, FALSE, FALSE);
+			(renv, content_types, FALSE, FALSE, NULL);
 	} T_END;
 
 	/* Check status */
@@ -1534,7 +1926,7 @@ int sieve_message_body_get_text
 	T_BEGIN {
 		/* Fill the return_body_parts array */
 		status = sieve_message_parts_add_missing
-			(renv, _text_content_types, TRUE, FALSE);
+			(renv, _text_content_types, TRUE, FALSE, NULL);
 	} T_END;
 
 	/* Check status */
@@ -1556,6 +1948,8 @@ int sieve_message_body_get_raw
 	struct sieve_message_part_data *return_part;
 	buffer_t *buf;
 
+	sieve_message_body_init(msgctx);
+
 	if ( msgctx->raw_body == NULL ) {
 		struct mail *mail = sieve_message_get_mail(renv->msgctx);
 		struct istream *input;
@@ -1564,8 +1958,9 @@ int sieve_message_body_get_raw
 		size_t size;
 		int ret;
 
+		msgctx->stats.raw_body++;
 		msgctx->raw_body = buf = buffer_create_dynamic
-			(msgctx->context_pool, 1024*64);
+			(sieve_message_context_pool(msgctx), 1024*64);
 
 		/* Get stream for message */
  		if ( mail_get_stream(mail, &hdr_size, &body_size, &input) < 0 ) {
@@ -1620,6 +2015,119 @@ int sieve_message_body_get_raw
 	return SIEVE_EXEC_OK;
 }
 
+/*
+ * Message body streaming
+ */
+
+int sieve_message_body_stream_content
+(const struct sieve_runtime_env *renv,
+	const char * const *content_types,
+	const struct sieve_message_body_sink *sink, void *context)
+{
+	struct sieve_message_body_stream stream;
+	int status;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.sink = sink;
+	stream.context = context;
+
+	T_BEGIN {
+		status = sieve_message_parts_add_missing
+			(renv, content_types, FALSE, FALSE, &stream);
+	} T_END;
+
+	sieve_message_body_stream_deinit(&stream);
+	return status;
+}
+
+int sieve_message_body_stream_text
+(const struct sieve_runtime_env *renv,
+	const struct sieve_message_body_sink *sink, void *context)
+{
+	static const char * const _text_content_types[] =
+		{ "application/xhtml+xml", "text", NULL };
+	struct sieve_message_body_stream stream;
+	int status;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.sink = sink;
+	stream.context = context;
+
+	T_BEGIN {
+		status = sieve_message_parts_add_missing
+			(renv, _text_content_types, TRUE, FALSE, &stream);
+	} T_END;
+
+	sieve_message_body_stream_deinit(&stream);
+	return status;
+}
+
+int sieve_message_body_stream_raw
+(const struct sieve_runtime_env *renv,
+	const struct sieve_message_body_sink *sink, void *context)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	struct mail *mail = sieve_message_get_mail(renv->msgctx);
+	struct istream *input;
+	struct message_size hdr_size, body_size;
+	const unsigned char *data;
+	size_t size;
+	bool have_body = FALSE;
+	int ret;
+
+	if ( msgctx->raw_body == NULL ) {
+		/* Get stream for message */
+		if ( mail_get_stream(mail, &hdr_size, &body_size, &input) < 0 ) {
+			return sieve_runtime_mail_error(renv, mail,
+				"failed to open input message");
+		}
+
+		/* Small bodies are read into the cache as a whole */
+		if ( body_size.physical_size <= SIEVE_MESSAGE_BODY_STREAM_CACHE_LIMIT ) {
+			struct sieve_message_part_data *parts;
+
+			if ( (ret=sieve_message_body_get_raw(renv, &parts)) <= 0 )
+				return ret;
+		}
+	}
+
+	if ( msgctx->raw_body != NULL ) {
+		buffer_t *buf = msgctx->raw_body;
+
+		/* Already read; includes terminating NUL */
+		if ( buf->used > 1 &&
+			sink->more(context, buf->data, buf->used - 1) <= 0 )
+			sink->part_end(context);
+		return SIEVE_EXEC_OK;
+	}
+
+	msgctx->stats.raw_body++;
+
+	/* Skip stream to beginning of body */
+	i_stream_skip(input, hdr_size.physical_size);
+
+	/* Pass raw message body in chunks */
+	while ( (ret=i_stream_read_data(input, &data, &size, 0)) > 0 ) {
+		have_body = TRUE;
+		if ( sink->more(context, data, size) > 0 )
+			return SIEVE_EXEC_OK;
+
+		i_stream_skip(input, size);
+	}
+
+	if ( ret == -1 && input->stream_errno != 0 ) {
+		sieve_runtime_critical(renv, NULL,
+			"failed to read input message",
+			"failed to read raw message stream: %s",
+			i_stream_get_error(input));
+		return SIEVE_EXEC_TEMP_FAILURE;
+	}
+
+	if ( have_body )
+		sink->part_end(context);
+	return SIEVE_EXEC_OK;
+}
+
 /*
  * Message part iterator
  */
@@ -1636,7 +2144,7 @@ int sieve_message_part_iter_init
 	T_BEGIN {
 		/* Fill the return_body_parts array */
 		status = sieve_message_parts_add_missing
-			(renv, NULL, TRUE, TRUE);
+			(renv, NULL, TRUE, TRUE, NULL);
 	} T_END;
 
 	/* Check status */
@@ -29,10 +29,26 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx);
 void sieve_message_context_reset(struct sieve_message_context *msgctx);
 
 pool_t sieve_message_context_pool
-	(struct sieve_message_context *msgctx) ATTR_PURE;
+	(struct sieve_message_context *msgctx);
 void sieve_message_context_time(struct sieve_message_context *msgctx,
 	struct timeval *time);
 
+/* Statistics: all views of the message are only materialized upon first use;
+   these count how often each was materialized during this delivery */
+
+struct sieve_message_context_stats {
+	unsigned int envelope;       /* Envelope addresses parsed */
+	unsigned int header_fields;  /* Header fields added to the index */
+	unsigned int address_values; /* Header field values parsed as addresses */
+	unsigned int body_parses;    /* MIME parses for body parts */
+	unsigned int part_trees;     /* MIME parses for the full part tree */
+	unsigned int raw_body;       /* Raw body reads */
+	unsigned int versions;       /* Modified message versions */
+};
+
+void sieve_message_context_get_stats(struct sieve_message_context *msgctx,
+	struct sieve_message_context_stats *stats_r);
+
 /* Extension support */
 
 void sieve_message_context_extension_set
@@ -66,6 +82,7 @@ struct mail *sieve_message_get_mail
 
 int sieve_message_substitute
 	(struct sieve_message_context *msgctx, struct istream *input);
+void sieve_message_raw_user_deinit(struct sieve_instance *svinst);
 struct edit_mail *sieve_message_edit
 	(struct sieve_message_context *msgctx);
 void sieve_message_snapshot
@@ -197,12 +214,38 @@ int sieve_message_opr_optional_read
  * Message header
  */
 
+/* Returns the right-trimmed values of all header fields with the given name,
+   served from a per-message index; only the first request for each field
+   reads the message. Returns 1 if any were found, 0 if not and -1 on error. */
+int sieve_message_get_header_values
+	(struct sieve_message_context *msgctx, const char *field_name,
+		bool mime_decode, const char *const **values_r);
+
 int sieve_message_get_header_fields
 	(const struct sieve_runtime_env *renv,
 		struct sieve_stringlist *field_names,
 		ARRAY_TYPE(sieve_message_override) *svmos,
 		bool mime_decode, struct sieve_stringlist **fields_r);
 
+/*
+ * Parsed addresses
+ */
+
+struct sieve_message_addresses {
+	/* The usable addresses (those with a domain) */
+	const struct sieve_address *addresses;
+	unsigned int count;
+
+	/* The value is not a valid address list */
+	unsigned int invalid:1;
+};
+
+/* Parses a header field value as an address list. The result is kept with
+   the message context, so that each distinct value is parsed only once. */
+const struct sieve_message_addresses *sieve_message_get_addresses
+	(struct sieve_message_context *msgctx, const char *value,
+		size_t value_size);
+
 /*
  * Message part
  */
@@ -252,6 +295,34 @@ int sieve_message_body_get_raw
 	(const struct sieve_runtime_env *renv,
 		struct sieve_message_part_data **parts_r);
 
+/*
+ * Message body streaming
+ */
+
+/* The body streaming functions pass the same body parts as the corresponding
+   sieve_message_body_get_*() functions to a sink, one chunk at a time, without
+   keeping large decoded parts in memory. Parts that are already cached are
+   passed as a single chunk. Streaming stops early once the more() function
+   returns a value > 0. Parts that are small enough and that were streamed
+   completely are added to the cache, so that the message need not be parsed
+   again for later body tests. */
+
+struct sieve_message_body_sink {
+	int (*more)(void *context, const unsigned char *data, size_t size);
+	void (*part_end)(void *context);
+};
+
+int sieve_message_body_stream_content
+	(const struct sieve_runtime_env *renv,
+		const char * const *content_types,
+		const struct sieve_message_body_sink *sink, void *context);
+int sieve_message_body_stream_text
+	(const struct sieve_runtime_env *renv,
+		const struct sieve_message_body_sink *sink, void *context);
+int sieve_message_body_stream_raw
+	(const struct sieve_runtime_env *renv,
+		const struct sieve_message_body_sink *sink, void *context);
+
 /*
  * Message part iterator
  */
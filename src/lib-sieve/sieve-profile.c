@@ -0,0 +1,350 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "str.h"
+#include "time-util.h"
+#include "ostream.h"
+
+#include "sieve-common.h"
+#include "sieve-script.h"
+#include "sieve-binary.h"
+
+#include "sieve-profile.h"
+
+/*
+ * Profile object
+ */
+
+struct sieve_profile {
+	pool_t pool;
+
+	/* Interned binary identifiers */
+	HASH_TABLE(const char *, const char *) binaries;
+
+	/* Entries by parent and location */
+	HASH_TABLE(struct sieve_profile_entry *,
+		struct sieve_profile_entry *) entries;
+	/* Totals by location */
+	HASH_TABLE(struct sieve_profile_entry *,
+		struct sieve_profile_entry *) totals;
+};
+
+static unsigned int sieve_profile_entry_hash
+(const struct sieve_profile_entry *entry)
+{
+	return POINTER_CAST_TO(entry->parent, unsigned int) ^
+		POINTER_CAST_TO(entry->binary, unsigned int) ^
+		(entry->block_id << 24) ^ (unsigned int)entry->address;
+}
+
+static int sieve_profile_entry_cmp
+(const struct sieve_profile_entry *entry1,
+	const struct sieve_profile_entry *entry2)
+{
+	/* Binary identifiers are interned */
+	if ( entry1->parent != entry2->parent || entry1->binary != entry2->binary ||
+		entry1->block_id != entry2->block_id ||
+		entry1->address != entry2->address )
+		return 1;
+	return 0;
+}
+
+struct sieve_profile *sieve_profile_create(void)
+{
+	struct sieve_profile *profile;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sieve_profile", 8192);
+	profile = p_new(pool, struct sieve_profile, 1);
+	profile->pool = pool;
+
+	hash_table_create(&profile->binaries, pool, 0, str_hash, strcmp);
+	hash_table_create(&profile->entries, pool, 0,
+		sieve_profile_entry_hash, sieve_profile_entry_cmp);
+	hash_table_create(&profile->totals, pool, 0,
+		sieve_profile_entry_hash, sieve_profile_entry_cmp);
+
+	return profile;
+}
+
+void sieve_profile_free(struct sieve_profile **_profile)
+{
+	struct sieve_profile *profile = *_profile;
+
+	*_profile = NULL;
+
+	hash_table_destroy(&profile->binaries);
+	hash_table_destroy(&profile->entries);
+	hash_table_destroy(&profile->totals);
+	pool_unref(&profile->pool);
+}
+
+static const char *sieve_profile_binary_name(struct sieve_binary *sbin)
+{
+	struct sieve_script *script;
+	const char *name;
+
+	if ( (name=sieve_binary_path(sbin)) != NULL )
+		return name;
+	if ( (script=sieve_binary_script(sbin)) != NULL )
+		return sieve_script_location(script);
+	return "";
+}
+
+const char *sieve_profile_get_binary
+(struct sieve_profile *profile, struct sieve_binary *sbin)
+{
+	const char *name = sieve_profile_binary_name(sbin);
+	const char *binary;
+
+	binary = hash_table_lookup(profile->binaries, name);
+	if ( binary == NULL ) {
+		binary = p_strdup(profile->pool, name);
+		hash_table_insert(profile->binaries, binary, binary);
+	}
+	return binary;
+}
+
+/*
+ * Recording
+ */
+
+struct sieve_profile_entry *sieve_profile_lookup
+(struct sieve_profile *profile, struct sieve_profile_entry *parent,
+	const char *binary, unsigned int block_id, sieve_size_t address)
+{
+	struct sieve_profile_entry key;
+
+	memset(&key, 0, sizeof(key));
+	key.parent = parent;
+	key.binary = binary;
+	key.block_id = block_id;
+	key.address = address;
+
+	return hash_table_lookup(profile->entries, &key);
+}
+
+static struct sieve_profile_entry *sieve_profile_lookup_total
+(struct sieve_profile *profile, const char *binary, unsigned int block_id,
+	sieve_size_t address)
+{
+	struct sieve_profile_entry key;
+
+	memset(&key, 0, sizeof(key));
+	key.binary = binary;
+	key.block_id = block_id;
+	key.address = address;
+
+	return hash_table_lookup(profile->totals, &key);
+}
+
+struct sieve_profile_entry *sieve_profile_add
+(struct sieve_profile *profile, struct sieve_profile_entry *parent,
+	const char *binary, unsigned int block_id, sieve_size_t address,
+	const char *script_name, unsigned int line, const char *mnemonic)
+{
+	struct sieve_profile_entry *entry, *total;
+
+	entry = p_new(profile->pool, struct sieve_profile_entry, 1);
+	entry->parent = parent;
+	entry->binary = binary;
+	entry->block_id = block_id;
+	entry->address = address;
+	entry->script_name = p_strdup(profile->pool, script_name);
+	entry->line = line;
+	entry->mnemonic = p_strdup(profile->pool, mnemonic);
+	hash_table_insert(profile->entries, entry, entry);
+
+	/* Totals are recorded without parent */
+	total = sieve_profile_lookup_total(profile, binary, block_id, address);
+	if ( total == NULL ) {
+		total = p_new(profile->pool, struct sieve_profile_entry, 1);
+		*total = *entry;
+		total->parent = NULL;
+		hash_table_insert(profile->totals, total, total);
+	}
+	entry->total = total;
+
+	return entry;
+}
+
+static void sieve_profile_get_cpu_time(struct timespec *ts_r)
+{
+	if ( clock_gettime(CLOCK_PROCESS_CPUTIME_ID, ts_r) < 0 )
+		i_fatal("clock_gettime() failed: %m");
+}
+
+void sieve_profile_timer_start(struct sieve_profile_timer *timer)
+{
+	if ( gettimeofday(&timer->wall_start, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+	sieve_profile_get_cpu_time(&timer->cpu_start);
+}
+
+static void sieve_profile_timer_record
+(struct sieve_profile_timer *timer, struct sieve_profile_entry *entry,
+	unsigned int count)
+{
+	struct timeval wall_end;
+	struct timespec cpu_end;
+	long long wall_usecs, cpu_usecs;
+
+	if ( gettimeofday(&wall_end, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+	sieve_profile_get_cpu_time(&cpu_end);
+
+	wall_usecs = timeval_diff_usecs(&wall_end, &timer->wall_start);
+	cpu_usecs = (cpu_end.tv_sec - timer->cpu_start.tv_sec) * 1000000LL +
+		(cpu_end.tv_nsec - timer->cpu_start.tv_nsec) / 1000;
+	if ( wall_usecs < 0 )
+		wall_usecs = 0;
+	if ( cpu_usecs < 0 )
+		cpu_usecs = 0;
+
+	entry->stats.count += count;
+	entry->stats.wall_usecs += wall_usecs;
+	entry->stats.cpu_usecs += cpu_usecs;
+
+	entry->total->stats.count += count;
+	entry->total->stats.wall_usecs += wall_usecs;
+	entry->total->stats.cpu_usecs += cpu_usecs;
+}
+
+void sieve_profile_timer_stop
+(struct sieve_profile_timer *timer, struct sieve_profile_entry *entry)
+{
+	sieve_profile_timer_record(timer, entry, 1);
+}
+
+void sieve_profile_timer_add
+(struct sieve_profile_timer *timer, struct sieve_profile_entry *entry)
+{
+	sieve_profile_timer_record(timer, entry, 0);
+}
+
+/*
+ * Reporting
+ */
+
+bool sieve_profile_get_stats
+(struct sieve_profile *profile, struct sieve_binary *sbin,
+	unsigned int block_id, sieve_size_t address,
+	struct sieve_profile_stats *stats_r)
+{
+	struct sieve_profile_entry *total;
+	const char *binary;
+
+	memset(stats_r, 0, sizeof(*stats_r));
+
+	binary = hash_table_lookup
+		(profile->binaries, sieve_profile_binary_name(sbin));
+	if ( binary == NULL )
+		return FALSE;
+
+	total = sieve_profile_lookup_total(profile, binary, block_id, address);
+	if ( total == NULL )
+		return FALSE;
+
+	*stats_r = total->stats;
+	return TRUE;
+}
+
+static void sieve_profile_append_frame
+(string_t *str, const struct sieve_profile_entry *entry)
+{
+	const char *p;
+
+	if ( entry->parent != NULL ) {
+		sieve_profile_append_frame(str, entry->parent);
+		str_append_c(str, ';');
+	}
+
+	/* Semicolons separate the frames and a space precedes the value */
+	for ( p = entry->script_name; *p != '\0'; p++ )
+		str_append_c(str, ( *p == ';' || *p == ' ' ? '_' : *p ));
+	str_printfa(str, ":%u:%s", entry->line, entry->mnemonic);
+}
+
+void sieve_profile_write_folded
+(struct sieve_profile *profile, struct ostream *output)
+{
+	struct hash_iterate_context *hctx;
+	struct sieve_profile_entry *entry, *value;
+	ARRAY_TYPE(const_string) lines;
+	const char *const *linep;
+
+	/* Determine the time spent in the operations executed by each entry
+	   (i.e. in included scripts) */
+	hctx = hash_table_iterate_init(profile->entries);
+	while ( hash_table_iterate(hctx, profile->entries, &entry, &value) )
+		entry->child_wall_usecs = 0;
+	hash_table_iterate_deinit(&hctx);
+
+	hctx = hash_table_iterate_init(profile->entries);
+	while ( hash_table_iterate(hctx, profile->entries, &entry, &value) ) {
+		if ( entry->parent != NULL )
+			entry->parent->child_wall_usecs += entry->stats.wall_usecs;
+	}
+	hash_table_iterate_deinit(&hctx);
+
+	T_BEGIN {
+		t_array_init(&lines, hash_table_count(profile->entries));
+
+		hctx = hash_table_iterate_init(profile->entries);
+		while ( hash_table_iterate(hctx, profile->entries, &entry, &value) ) {
+			unsigned long long self_usecs;
+			const char *line;
+			string_t *str;
+
+			/* Only the time spent in the operation itself */
+			if ( entry->stats.wall_usecs <= entry->child_wall_usecs )
+				continue;
+			self_usecs = entry->stats.wall_usecs - entry->child_wall_usecs;
+
+			str = t_str_new(256);
+			sieve_profile_append_frame(str, entry);
+			str_printfa(str, " %llu\n", self_usecs);
+
+			line = str_c(str);
+			array_append(&lines, &line, 1);
+		}
+		hash_table_iterate_deinit(&hctx);
+
+		array_sort(&lines, i_strcmp_p);
+		array_foreach(&lines, linep)
+			o_stream_send_str(output, *linep);
+	} T_END;
+}
+
+void sieve_profile_write_stacks
+(struct sieve_profile *profile, string_t *out)
+{
+	struct hash_iterate_context *hctx;
+	struct sieve_profile_entry *entry, *value;
+	ARRAY_TYPE(const_string) lines;
+	const char *const *linep;
+
+	/* No data stack frame here; the output string may be allocated from the
+	   data stack by the caller */
+	t_array_init(&lines, hash_table_count(profile->entries));
+
+	hctx = hash_table_iterate_init(profile->entries);
+	while ( hash_table_iterate(hctx, profile->entries, &entry, &value) ) {
+		string_t *str = t_str_new(256);
+		const char *line;
+
+		sieve_profile_append_frame(str, entry);
+		str_append_c(str, '\n');
+
+		line = str_c(str);
+		array_append(&lines, &line, 1);
+	}
+	hash_table_iterate_deinit(&hctx);
+
+	array_sort(&lines, i_strcmp_p);
+	array_foreach(&lines, linep)
+		str_append(out, *linep);
+}
@@ -0,0 +1,123 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_PROFILE_H
+#define __SIEVE_PROFILE_H
+
+#include "sieve-common.h"
+#include "sieve-runtime.h"
+
+#include <sys/time.h>
+#include <time.h>
+
+/*
+ * Execution profile
+ */
+
+/* A profile records, for each executed operation, how often it was executed,
+ * the (inclusive) wall-clock and CPU time it took and the number of bytes it
+ * matched. Operations executed from an included script are recorded
+ * separately for each including operation, so that the profile can be
+ * exported as folded stacks. The profile is enabled by assigning it to the
+ * profile field of the script environment.
+ */
+
+struct sieve_profile;
+
+struct sieve_profile_stats {
+	unsigned int count;
+	unsigned long long wall_usecs;
+	unsigned long long cpu_usecs;
+	uoff_t bytes_matched;
+};
+
+struct sieve_profile_entry {
+	struct sieve_profile_entry *parent;
+
+	/* Location */
+	const char *binary;
+	unsigned int block_id;
+	sieve_size_t address;
+
+	const char *script_name;
+	unsigned int line;
+	const char *mnemonic;
+
+	struct sieve_profile_stats stats;
+
+	/* Entry with the totals for this location over all parents */
+	struct sieve_profile_entry *total;
+
+	/* Wall-clock time spent in the operations executed by this one;
+	   determined when reporting */
+	unsigned long long child_wall_usecs;
+};
+
+struct sieve_profile_timer {
+	struct timeval wall_start;
+	struct timespec cpu_start;
+};
+
+struct sieve_profile *sieve_profile_create(void);
+void sieve_profile_free(struct sieve_profile **_profile);
+
+/* Returns an identifier for the binary, which is used to tell the locations
+   in different binaries apart */
+const char *sieve_profile_get_binary
+	(struct sieve_profile *profile, struct sieve_binary *sbin);
+
+/*
+ * Recording
+ */
+
+struct sieve_profile_entry *sieve_profile_lookup
+	(struct sieve_profile *profile, struct sieve_profile_entry *parent,
+		const char *binary, unsigned int block_id, sieve_size_t address)
+		ATTR_NULL(2);
+struct sieve_profile_entry *sieve_profile_add
+	(struct sieve_profile *profile, struct sieve_profile_entry *parent,
+		const char *binary, unsigned int block_id, sieve_size_t address,
+		const char *script_name, unsigned int line, const char *mnemonic)
+		ATTR_NULL(2);
+
+void sieve_profile_timer_start(struct sieve_profile_timer *timer);
+void sieve_profile_timer_stop
+	(struct sieve_profile_timer *timer, struct sieve_profile_entry *entry);
+/* Adds the time elapsed since the timer was started to an entry that was
+   already stopped, without counting another execution. This is used for
+   operations that hand their work over to another interpreter, like
+   includes that are deferred to the top-level interpreter. */
+void sieve_profile_timer_add
+	(struct sieve_profile_timer *timer, struct sieve_profile_entry *entry);
+
+static inline void sieve_runtime_profile_matched
+(const struct sieve_runtime_env *renv, size_t size)
+{
+	if ( renv->profile_entry != NULL ) {
+		renv->profile_entry->stats.bytes_matched += size;
+		renv->profile_entry->total->stats.bytes_matched += size;
+	}
+}
+
+/*
+ * Reporting
+ */
+
+/* Returns the totals for a location over all parents; FALSE if the location
+   was never executed */
+bool sieve_profile_get_stats
+	(struct sieve_profile *profile, struct sieve_binary *sbin,
+		unsigned int block_id, sieve_size_t address,
+		struct sieve_profile_stats *stats_r);
+
+/* Writes the profile in folded stack format (as used by flame graph tools):
+   one line per stack of operations with the wall-clock time (microseconds)
+   spent in the innermost operation itself */
+void sieve_profile_write_folded
+	(struct sieve_profile *profile, struct ostream *output);
+/* Appends all recorded stacks of operations, one per line and without
+   values */
+void sieve_profile_write_stacks
+	(struct sieve_profile *profile, string_t *out);
+
+#endif /* __SIEVE_PROFILE_H */
@@ -0,0 +1,207 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "hash.h"
+#include "llist.h"
+
+#include "sieve-common.h"
+#include "sieve-error.h"
+
+#include "sieve.h"
+#include "sieve-regex-cache.h"
+
+/*
+ * Regex cache
+ */
+
+/* The regex cache keeps recently compiled regular expressions for the lifetime
+ * of the process, so that constant patterns (e.g. in a global script or in the
+ * configuration) are not compiled anew for each message. Entries are keyed by
+ * the compilation flags and the pattern.
+ */
+
+struct sieve_regex_cache {
+	HASH_TABLE(const char *, struct sieve_regex *) regexes;
+
+	/* LRU list; most recently used regex first */
+	struct sieve_regex *lru_head, *lru_tail;
+
+	unsigned int max_entries;
+	struct sieve_regex_cache_stats stats;
+};
+
+static struct sieve_regex_cache *sieve_regex_cache = NULL;
+
+static inline bool sieve_regex_cache_enabled
+(struct sieve_instance *svinst)
+{
+	return ( (svinst->flags & SIEVE_FLAG_REGEX_CACHE) != 0 &&
+		svinst->regex_cache_size > 0 );
+}
+
+static struct sieve_regex_cache *sieve_regex_cache_init(void)
+{
+	struct sieve_regex_cache *cache;
+
+	cache = i_new(struct sieve_regex_cache, 1);
+	hash_table_create(&cache->regexes, default_pool, 0, str_hash, strcmp);
+
+	return cache;
+}
+
+static void sieve_regex_cache_drop
+(struct sieve_regex_cache *cache, struct sieve_regex *regex)
+{
+	i_assert(regex->cached);
+
+	hash_table_remove(cache->regexes, regex->key);
+	DLLIST2_REMOVE(&cache->lru_head, &cache->lru_tail, regex);
+	regex->cached = FALSE;
+
+	sieve_regex_unref(&regex);
+}
+
+/*
+ * Compiled regular expression
+ */
+
+static const char *sieve_regex_error(regex_t *regexp, int errorcode)
+{
+	size_t errsize;
+	char *errbuf;
+
+	errsize = regerror(errorcode, regexp, NULL, 0);
+	if ( errsize == 0 )
+		return "";
+
+	errbuf = t_malloc(errsize);
+	(void)regerror(errorcode, regexp, errbuf, errsize);
+
+	/* We don't want the error to start with a capital letter */
+	errbuf[0] = i_tolower(errbuf[0]);
+
+	return errbuf;
+}
+
+static struct sieve_regex *sieve_regex_create
+(const char *key, const char *pattern, int cflags, const char **error_r)
+{
+	struct sieve_regex *regex;
+	int ret;
+
+	regex = i_new(struct sieve_regex, 1);
+	if ( (ret=regcomp(&regex->regexp, pattern, cflags)) != 0 ) {
+		*error_r = sieve_regex_error(&regex->regexp, ret);
+		regfree(&regex->regexp);
+		i_free(regex);
+		return NULL;
+	}
+
+	regex->refcount = 1;
+	regex->key = i_strdup(key);
+	return regex;
+}
+
+struct sieve_regex *sieve_regex_compile
+(struct sieve_instance *svinst, const char *pattern, int cflags,
+	const char **error_r)
+{
+	struct sieve_regex_cache *cache;
+	struct sieve_regex *regex;
+	const char *key;
+
+	*error_r = NULL;
+
+	key = t_strdup_printf("%x:%s", cflags, pattern);
+
+	if ( !sieve_regex_cache_enabled(svinst) )
+		return sieve_regex_create(key, pattern, cflags, error_r);
+
+	if ( sieve_regex_cache == NULL )
+		sieve_regex_cache = sieve_regex_cache_init();
+	cache = sieve_regex_cache;
+	cache->max_entries = svinst->regex_cache_size;
+
+	regex = hash_table_lookup(cache->regexes, key);
+	if ( regex != NULL ) {
+		/* Cache hit */
+		cache->stats.hits++;
+		DLLIST2_REMOVE(&cache->lru_head, &cache->lru_tail, regex);
+		DLLIST2_PREPEND(&cache->lru_head, &cache->lru_tail, regex);
+
+		sieve_regex_ref(regex);
+		return regex;
+	}
+
+	/* Cache miss */
+	cache->stats.misses++;
+	if ( (regex=sieve_regex_create(key, pattern, cflags, error_r)) == NULL )
+		return NULL;
+
+	sieve_regex_ref(regex);
+	regex->cached = TRUE;
+	hash_table_insert(cache->regexes, regex->key, regex);
+	DLLIST2_PREPEND(&cache->lru_head, &cache->lru_tail, regex);
+
+	/* Evict least recently used regular expressions */
+	while ( hash_table_count(cache->regexes) > cache->max_entries ) {
+		i_assert( cache->lru_tail != NULL );
+		cache->stats.evictions++;
+		sieve_regex_cache_drop(cache, cache->lru_tail);
+	}
+
+	return regex;
+}
+
+void sieve_regex_ref(struct sieve_regex *regex)
+{
+	i_assert(regex->refcount > 0);
+	regex->refcount++;
+}
+
+void sieve_regex_unref(struct sieve_regex **_regex)
+{
+	struct sieve_regex *regex = *_regex;
+
+	*_regex = NULL;
+
+	i_assert(regex->refcount > 0);
+	if ( --regex->refcount > 0 )
+		return;
+
+	i_assert(!regex->cached);
+	regfree(&regex->regexp);
+	i_free(regex->key);
+	i_free(regex);
+}
+
+/*
+ * Public API
+ */
+
+void sieve_regex_cache_get_stats(struct sieve_regex_cache_stats *stats_r)
+{
+	memset(stats_r, 0, sizeof(*stats_r));
+
+	if ( sieve_regex_cache == NULL )
+		return;
+
+	*stats_r = sieve_regex_cache->stats;
+	stats_r->entries = hash_table_count(sieve_regex_cache->regexes);
+}
+
+void sieve_regex_cache_deinit(void)
+{
+	struct sieve_regex_cache *cache = sieve_regex_cache;
+
+	if ( cache == NULL )
+		return;
+
+	while ( cache->lru_head != NULL )
+		sieve_regex_cache_drop(cache, cache->lru_head);
+
+	hash_table_destroy(&cache->regexes);
+	i_free(cache);
+	sieve_regex_cache = NULL;
+}
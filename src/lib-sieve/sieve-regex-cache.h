@@ -0,0 +1,40 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_REGEX_CACHE_H
+#define __SIEVE_REGEX_CACHE_H
+
+#include "sieve-common.h"
+
+#include <sys/types.h>
+#include <regex.h>
+
+/*
+ * Compiled regular expression
+ */
+
+struct sieve_regex {
+	int refcount;
+
+	/* Cache key: cflags and pattern */
+	char *key;
+
+	regex_t regexp;
+
+	/* Regex cache LRU list */
+	struct sieve_regex *prev, *next;
+	unsigned int cached:1;
+};
+
+/* Compiles the pattern with the provided cflags. When the Sieve instance was
+   created with the SIEVE_FLAG_REGEX_CACHE flag, the compiled regular
+   expression is obtained from (or added to) the process-wide regex cache.
+   Returns NULL and a (data stack) error string if the pattern is invalid. */
+struct sieve_regex *sieve_regex_compile
+	(struct sieve_instance *svinst, const char *pattern, int cflags,
+		const char **error_r);
+
+void sieve_regex_ref(struct sieve_regex *regex);
+void sieve_regex_unref(struct sieve_regex **regex);
+
+#endif /* __SIEVE_REGEX_CACHE_H */
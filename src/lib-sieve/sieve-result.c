@@ -3,11 +3,13 @@
 
 #include "lib.h"
 #include "mempool.h"
+#include "array.h"
 #include "ostream.h"
 #include "hash.h"
 #include "str.h"
 #include "strfuncs.h"
 #include "str-sanitize.h"
+#include "time-util.h"
 #include "var-expand.h"
 #include "message-address.h"
 #include "mail-storage.h"
@@ -39,9 +41,35 @@ struct sieve_result_action {
 
 	struct sieve_side_effects_list *seffects;
 
+	/* Time spent in each stage of execution (microseconds) */
+	long long start_usecs, execute_usecs, commit_usecs;
+
+	/* Identifies the current entry in the action index; 0 if not indexed */
+	unsigned int index_id;
+
 	struct sieve_result_action *prev, *next;
 };
 
+struct sieve_result_action_ref {
+	struct sieve_result_action *raction;
+	unsigned int index_id;
+};
+ARRAY_DEFINE_TYPE(sieve_result_action_ref, struct sieve_result_action_ref);
+
+struct sieve_result_action_class {
+	/* Number of actions with this definition in the result */
+	unsigned int count;
+
+	/* Actions with this definition; only used when the definition provides
+	   no duplicate key */
+	ARRAY_TYPE(sieve_result_action_ref) actions;
+};
+
+struct sieve_result_action_bucket {
+	/* Actions with the same definition name and duplicate key */
+	ARRAY_TYPE(sieve_result_action_ref) actions;
+};
+
 struct sieve_side_effects_list {
 	struct sieve_result *result;
 
@@ -87,6 +115,15 @@ struct sieve_result {
 	HASH_TABLE(const struct sieve_action_def *,
 			   struct sieve_result_action_context *) action_contexts;
 
+	/* Action index, used to check new actions for duplicates and conflicts
+	   without scanning the whole list of actions */
+	unsigned int action_index_id;
+	HASH_TABLE(const struct sieve_action_def *,
+			   struct sieve_result_action_class *) action_classes;
+	HASH_TABLE(const char *,
+			   struct sieve_result_action_bucket *) action_buckets;
+	ARRAY_TYPE(sieve_result_action_ref) conflict_actions;
+
 	unsigned int executed:1;
 };
 
@@ -141,6 +178,10 @@ void sieve_result_unref(struct sieve_result **result)
 
 	if ( hash_table_is_created((*result)->action_contexts) )
         hash_table_destroy(&(*result)->action_contexts);
+	if ( hash_table_is_created((*result)->action_classes) )
+		hash_table_destroy(&(*result)->action_classes);
+	if ( hash_table_is_created((*result)->action_buckets) )
+		hash_table_destroy(&(*result)->action_buckets);
 
 	if ( (*result)->action_env.ehandler != NULL )
 		sieve_error_handler_unref(&(*result)->action_env.ehandler);
@@ -320,6 +361,146 @@ int sieve_result_mail_error
 	return 	SIEVE_EXEC_TEMP_FAILURE;
 }
 
+/*
+ * Action index
+ */
+
+static struct sieve_result_action_class *sieve_result_action_class_get
+(struct sieve_result *result, const struct sieve_action_def *act_def,
+	bool create)
+{
+	struct sieve_result_action_class *aclass;
+
+	if ( !hash_table_is_created(result->action_classes) ) {
+		if ( !create )
+			return NULL;
+		hash_table_create_direct(&result->action_classes, result->pool, 0);
+	}
+
+	aclass = hash_table_lookup(result->action_classes, act_def);
+	if ( aclass == NULL && create ) {
+		aclass = p_new(result->pool, struct sieve_result_action_class, 1);
+		hash_table_insert(result->action_classes, act_def, aclass);
+	}
+	return aclass;
+}
+
+static unsigned int sieve_result_action_class_count
+(struct sieve_result *result, const struct sieve_action_def *act_def)
+{
+	struct sieve_result_action_class *aclass;
+
+	aclass = sieve_result_action_class_get(result, act_def, FALSE);
+	return ( aclass == NULL ? 0 : aclass->count );
+}
+
+static const char *sieve_result_action_bucket_key
+(struct sieve_result *result, const struct sieve_action *action)
+{
+	const char *key;
+
+	key = action->def->get_duplicate_key
+		(result->action_env.scriptenv, action);
+	i_assert( key != NULL );
+
+	/* Definitions are not necessarily unique by name */
+	return t_strconcat(action->def->name, ":", key, NULL);
+}
+
+static ARRAY_TYPE(sieve_result_action_ref) *sieve_result_action_candidates
+(struct sieve_result *result, const struct sieve_action *action)
+{
+	struct sieve_result_action_class *aclass;
+	struct sieve_result_action_bucket *bucket;
+
+	if ( action->def->get_duplicate_key == NULL ) {
+		aclass = sieve_result_action_class_get(result, action->def, FALSE);
+		return ( aclass == NULL ? NULL : &aclass->actions );
+	}
+
+	if ( !hash_table_is_created(result->action_buckets) )
+		return NULL;
+	bucket = hash_table_lookup(result->action_buckets,
+		sieve_result_action_bucket_key(result, action));
+	return ( bucket == NULL ? NULL : &bucket->actions );
+}
+
+static void sieve_result_action_ref_add
+(struct sieve_result *result, ARRAY_TYPE(sieve_result_action_ref) *refs,
+	struct sieve_result_action *raction)
+{
+	struct sieve_result_action_ref *ref;
+
+	if ( !array_is_created(refs) )
+		p_array_init(refs, result->pool, 4);
+
+	ref = array_append_space(refs);
+	ref->raction = raction;
+	ref->index_id = raction->index_id;
+}
+
+static inline bool sieve_result_action_ref_is_valid
+(const struct sieve_result_action_ref *ref)
+{
+	/* Entries become stale when the action is removed or changed */
+	return ( ref->index_id == ref->raction->index_id );
+}
+
+static void sieve_result_action_index
+(struct sieve_result *result, struct sieve_result_action *raction)
+{
+	const struct sieve_action_def *act_def = raction->action.def;
+	struct sieve_result_action_class *aclass;
+	struct sieve_result_action_bucket *bucket;
+	const char *key;
+
+	/* Invalidate any previous index entries for this action */
+	raction->index_id = ++result->action_index_id;
+
+	if ( act_def == NULL )
+		return;
+
+	if ( act_def->check_conflict != NULL ) {
+		sieve_result_action_ref_add
+			(result, &result->conflict_actions, raction);
+	}
+
+	if ( act_def->get_duplicate_key == NULL ) {
+		aclass = sieve_result_action_class_get(result, act_def, TRUE);
+		sieve_result_action_ref_add(result, &aclass->actions, raction);
+		return;
+	}
+
+	if ( !hash_table_is_created(result->action_buckets) ) {
+		hash_table_create(&result->action_buckets, result->pool, 0,
+			str_hash, strcmp);
+	}
+
+	key = sieve_result_action_bucket_key(result, &raction->action);
+	bucket = hash_table_lookup(result->action_buckets, key);
+	if ( bucket == NULL ) {
+		bucket = p_new(result->pool, struct sieve_result_action_bucket, 1);
+		hash_table_insert(result->action_buckets,
+			p_strdup(result->pool, key), bucket);
+	}
+	sieve_result_action_ref_add(result, &bucket->actions, raction);
+}
+
+static void sieve_result_action_unindex
+(struct sieve_result *result, struct sieve_result_action *raction)
+{
+	struct sieve_result_action_class *aclass;
+
+	raction->index_id = 0;
+
+	if ( raction->action.def == NULL )
+		return;
+
+	aclass = sieve_result_action_class_get(result, raction->action.def, FALSE);
+	if ( aclass != NULL && aclass->count > 0 )
+		aclass->count--;
+}
+
 /*
  * Result composition
  */
@@ -450,6 +631,8 @@ static int sieve_result_side_effects_merge
 static void sieve_result_action_detach
 (struct sieve_result *result, struct sieve_result_action *raction)
 {
+	sieve_result_action_unindex(result, raction);
+
 	if ( result->first_action == raction )
 		result->first_action = raction->next;
 
@@ -469,6 +652,62 @@ static void sieve_result_action_detach
 		result->action_count--;
 }
 
+static bool sieve_result_action_check_indexed
+(const struct sieve_runtime_env *renv, const struct sieve_action *action,
+	struct sieve_side_effects_list *seffects, int *ret_r)
+{
+	struct sieve_result *result = renv->result;
+	const struct sieve_action_def *act_def = action->def;
+	ARRAY_TYPE(sieve_result_action_ref) *refs;
+	const struct sieve_result_action_ref *ref;
+	int ret;
+
+	/* Check for duplicates */
+	if ( act_def->check_duplicate != NULL &&
+		(refs=sieve_result_action_candidates(result, action)) != NULL ) {
+		array_foreach(refs, ref) {
+			struct sieve_result_action *raction = ref->raction;
+
+			if ( !sieve_result_action_ref_is_valid(ref) ||
+				raction->action.def != act_def )
+				continue;
+
+			if ( (ret=act_def->check_duplicate(renv, action, &raction->action))
+				< 0 ) {
+				*ret_r = ret;
+				return TRUE;
+			}
+
+			if ( ret == 1 ) {
+				/* Merge side-effects, but don't add new action */
+				*ret_r = sieve_result_side_effects_merge
+					(renv, action, raction, seffects);
+				return TRUE;
+			}
+		}
+	}
+
+	/* Check for conflicts */
+	if ( array_is_created(&result->conflict_actions) ) {
+		array_foreach(&result->conflict_actions, ref) {
+			struct sieve_result_action *raction = ref->raction;
+			const struct sieve_action *oact = &raction->action;
+
+			if ( !sieve_result_action_ref_is_valid(ref) ||
+				oact->def == act_def || oact->executed )
+				continue;
+
+			if ( (ret=oact->def->check_conflict(renv, oact, action)) != 0 ) {
+				*ret_r = ret;
+				return TRUE;
+			}
+		}
+	}
+
+	*ret_r = 0;
+	return FALSE;
+}
+
 static int _sieve_result_add_action
 (const struct sieve_runtime_env *renv, const struct sieve_extension *ext,
 	const struct sieve_action_def *act_def,
@@ -489,7 +728,16 @@ static int _sieve_result_add_action
 	action.executed = FALSE;
 
 	/* First, check for duplicates or conflicts */
-	raction = result->first_action;
+	if ( !keep && act_def != NULL && act_def->check_conflict == NULL ) {
+		/* Only actions with the same target can be duplicates and only those
+		   that perform a conflict check themselves can conflict */
+		if ( sieve_result_action_check_indexed(renv, &action, seffects, &ret) )
+			return ret;
+		instance_count = sieve_result_action_class_count(result, act_def);
+		raction = NULL;
+	} else {
+		raction = result->first_action;
+	}
 	while ( raction != NULL ) {
 		const struct sieve_action *oact = &raction->action;
 
@@ -612,6 +860,8 @@ static int _sieve_result_add_action
 	raction->action.location = p_strdup(result->pool, action.location);
 	raction->keep = keep;
 
+	sieve_result_action_index(result, raction);
+
 	if ( raction->prev == NULL && raction != result->first_action ) {
 		/* Add */
 		if ( result->first_action == NULL ) {
@@ -626,6 +876,8 @@ static int _sieve_result_add_action
 			raction->next = NULL;
 		}
 		result->action_count++;
+		if ( act_def != NULL )
+			sieve_result_action_class_get(result, act_def, TRUE)->count++;
 
 		/* Apply any implicit side effects */
 		if ( hash_table_is_created(result->action_contexts) ) {
@@ -1083,6 +1335,22 @@ bool sieve_result_executed(struct sieve_result *result)
 	return result->executed;
 }
 
+static inline void sieve_result_timing_start(struct timeval *start_r)
+{
+	if ( gettimeofday(start_r, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+}
+
+static inline void sieve_result_timing_end
+(const struct timeval *start, long long *usecs)
+{
+	struct timeval now;
+
+	if ( gettimeofday(&now, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+	*usecs += timeval_diff_usecs(&now, start);
+}
+
 static int sieve_result_transaction_start
 (struct sieve_result *result, struct sieve_result_action *first,
 	struct sieve_result_action **last_r)
@@ -1108,9 +1376,13 @@ static int sieve_result_transaction_start
 		}
 
 		if ( act->def->start != NULL ) {
+			struct timeval start;
+
+			sieve_result_timing_start(&start);
 			status = act->def->start
 				(act, &result->action_env, &rac->tr_context);
 			rac->success = ( status == SIEVE_EXEC_OK );
+			sieve_result_timing_end(&start, &rac->start_usecs);
 		}
 
 		rac = rac->next;
@@ -1130,6 +1402,7 @@ static int sieve_result_transaction_execute
 		struct sieve_action *act = &rac->action;
 		struct sieve_result_side_effect *rsef;
 		struct sieve_side_effect *sef;
+		struct timeval start;
 
 		/* Skip non-actions (inactive keep) and executed ones */
 		if ( act->def == NULL || act->executed ) {
@@ -1137,6 +1410,8 @@ static int sieve_result_transaction_execute
 			continue;
 		}
 
+		sieve_result_timing_start(&start);
+
 		/* Execute pre-execute event of side effects */
 		rsef = rac->seffects != NULL ? rac->seffects->first_effect : NULL;
 		while ( status == SIEVE_EXEC_OK && rsef != NULL ) {
@@ -1165,6 +1440,7 @@ static int sieve_result_transaction_execute
 		}
 
 		rac->success = ( status == SIEVE_EXEC_OK );
+		sieve_result_timing_end(&start, &rac->execute_usecs);
 		rac = rac->next;
 	}
 
@@ -1177,8 +1453,11 @@ static int sieve_result_action_commit
 {
 	struct sieve_action *act = &rac->action;
 	struct sieve_result_side_effect *rsef;
+	struct timeval start;
 	int cstatus = SIEVE_EXEC_OK;
 
+	sieve_result_timing_start(&start);
+
 	if ( act->def->commit != NULL ) {
 		cstatus = act->def->commit
 			(act, &result->action_env, rac->tr_context, impl_keep);
@@ -1200,6 +1479,7 @@ static int sieve_result_action_commit
 		}
 	}
 
+	sieve_result_timing_end(&start, &rac->commit_usecs);
 	return cstatus;
 }
 
@@ -1208,6 +1488,9 @@ static void sieve_result_action_rollback
 {
 	struct sieve_action *act = &rac->action;
 	struct sieve_result_side_effect *rsef;
+	struct timeval start;
+
+	sieve_result_timing_start(&start);
 
 	if ( act->def->rollback != NULL ) {
 		act->def->rollback
@@ -1223,6 +1506,8 @@ static void sieve_result_action_rollback
 				(sef, act, &result->action_env, rac->tr_context, rac->success);
 		rsef = rsef->next;
 	}
+
+	sieve_result_timing_end(&start, &rac->commit_usecs);
 }
 
 static int sieve_result_action_commit_or_rollback
@@ -1337,6 +1622,30 @@ static void sieve_result_transaction_finish
 	}
 }
 
+static void sieve_result_transaction_log_timing
+(struct sieve_result *result, struct sieve_result_action *first,
+	long long keep_usecs)
+{
+	struct sieve_result_action *rac;
+
+	for ( rac = first; rac != NULL; rac = rac->next ) {
+		struct sieve_action *act = &rac->action;
+
+		if ( act->def == NULL )
+			continue;
+
+		sieve_sys_debug(result->svinst, "result: action `%s' (%s): "
+			"start=%lld us, execute=%lld us, commit=%lld us",
+			act->def->name, ( act->location == NULL ? "" : act->location ),
+			rac->start_usecs, rac->execute_usecs, rac->commit_usecs);
+	}
+
+	if ( keep_usecs > 0 ) {
+		sieve_sys_debug(result->svinst, "result: "
+			"implicit keep: %lld us", keep_usecs);
+	}
+}
+
 int sieve_result_execute
 (struct sieve_result *result, bool *keep,
 	struct sieve_error_handler *ehandler,
@@ -1345,6 +1654,7 @@ int sieve_result_execute
 	int status = SIEVE_EXEC_OK, result_status;
 	struct sieve_result_action *first_action, *last_action;
 	bool implicit_keep = TRUE;
+	long long keep_usecs = 0;
 	int ret;
 
 	if ( keep != NULL ) *keep = FALSE;
@@ -1385,8 +1695,14 @@ int sieve_result_execute
 		 * keep was not canceled during transaction.
 		 */
 		if ( status != SIEVE_EXEC_OK || implicit_keep ) {
-			switch ((ret=_sieve_result_implicit_keep
-				(result, ( status != SIEVE_EXEC_OK ))) ) {
+			struct timeval start;
+
+			sieve_result_timing_start(&start);
+			ret = _sieve_result_implicit_keep
+				(result, ( status != SIEVE_EXEC_OK ));
+			sieve_result_timing_end(&start, &keep_usecs);
+
+			switch ( ret ) {
 			case SIEVE_EXEC_OK:
 				if ( result_status == SIEVE_EXEC_TEMP_FAILURE )
 					result_status = SIEVE_EXEC_FAILURE;
@@ -1409,6 +1725,11 @@ int sieve_result_execute
 	sieve_result_transaction_finish
 		(result, first_action, status);
 
+	if ( result->svinst->debug ) {
+		sieve_result_transaction_log_timing
+			(result, first_action, keep_usecs);
+	}
+
 	result->action_env.ehandler = NULL;
 	return result_status;
 }
@@ -1471,6 +1792,8 @@ void sieve_result_iterate_delete
 
 	/* Delete action */
 
+	sieve_result_action_unindex(result, rac);
+
 	if ( rac->prev == NULL )
 		result->first_action = rac->next;
 	else
@@ -19,16 +19,33 @@ struct sieve_runtime_trace {
 
 /* Trace configuration */
 
+/* The trace macros below evaluate their arguments only when the trace is
+ * active, so that the disabled case costs a single branch. When configured
+ * with --disable-runtime-trace, the whole trace is compiled out.
+ */
+
+static inline bool sieve_runtime_trace_enabled
+(const struct sieve_runtime_env *renv ATTR_UNUSED)
+{
+#ifdef SIEVE_RUNTIME_TRACE_DISABLED
+	return FALSE;
+#else
+	return ( renv->trace != NULL );
+#endif
+}
+
 static inline bool sieve_runtime_trace_active
 (const struct sieve_runtime_env *renv, sieve_trace_level_t trace_level)
 {
-	return ( renv->trace != NULL && trace_level <= renv->trace->config.level );
+	return ( sieve_runtime_trace_enabled(renv) &&
+		trace_level <= renv->trace->config.level );
 }
 
 static inline bool sieve_runtime_trace_hasflag
 (const struct sieve_runtime_env *renv, unsigned int flag)
 {
-	return ( renv->trace != NULL && (renv->trace->config.flags & flag) != 0 );
+	return ( sieve_runtime_trace_enabled(renv) &&
+		(renv->trace->config.flags & flag) != 0 );
 }
 
 /* Trace indent */
@@ -36,124 +53,70 @@ static inline bool sieve_runtime_trace_hasflag
 static inline void sieve_runtime_trace_descend
 (const struct sieve_runtime_env *renv)
 {
-	if ( renv->trace != NULL ) renv->trace->indent++;
+	if ( sieve_runtime_trace_enabled(renv) ) renv->trace->indent++;
 }
 
 static inline void sieve_runtime_trace_ascend
 (const struct sieve_runtime_env *renv)
 {
-	if ( renv->trace != NULL ) renv->trace->indent--;
+	if ( sieve_runtime_trace_enabled(renv) ) renv->trace->indent--;
 }
 
 static inline void sieve_runtime_trace_toplevel
 (const struct sieve_runtime_env *renv)
 {
-	if ( renv->trace != NULL ) renv->trace->indent = 0;
+	if ( sieve_runtime_trace_enabled(renv) ) renv->trace->indent = 0;
 }
 
 /* Trace errors */
 
 void _sieve_runtime_trace_error
-	(const struct sieve_runtime_env *renv, const char *fmt, va_list args)
-		ATTR_FORMAT(2, 0);
-
-void _sieve_runtime_trace_operand_error
-	(const struct sieve_runtime_env *renv, const struct sieve_operand *oprnd,
-		const char *fmt, va_list args) ATTR_FORMAT(3, 0);
-
-static inline void sieve_runtime_trace_error
 	(const struct sieve_runtime_env *renv, const char *fmt, ...)
 		ATTR_FORMAT(2, 3);
 
-static inline void sieve_runtime_trace_operand_error
+void _sieve_runtime_trace_operand_error
 	(const struct sieve_runtime_env *renv, const struct sieve_operand *oprnd,
 		const char *fmt, ...) ATTR_FORMAT(3, 4);
 
-static inline void ATTR_FORMAT(2, 3) sieve_runtime_trace_error
-	(const struct sieve_runtime_env *renv, const char *fmt, ...)
-{
-	va_list args;
-
-	va_start(args, fmt);
-	if ( renv->trace != NULL )
-		_sieve_runtime_trace_error(renv, fmt, args);
-	va_end(args);
-}
-
-static inline void ATTR_FORMAT(3, 4) sieve_runtime_trace_operand_error
-	(const struct sieve_runtime_env *renv, const struct sieve_operand *oprnd,
-		const char *fmt, ...)
-{
-	va_list args;
+#define sieve_runtime_trace_error(renv, ...) \
+	STMT_START { \
+		if ( sieve_runtime_trace_enabled(renv) ) \
+			_sieve_runtime_trace_error(renv, __VA_ARGS__); \
+	} STMT_END
 
-	va_start(args, fmt);
-	if ( renv->trace != NULL )
-		_sieve_runtime_trace_operand_error(renv, oprnd, fmt, args);
-	va_end(args);
-}
+#define sieve_runtime_trace_operand_error(renv, oprnd, ...) \
+	STMT_START { \
+		if ( sieve_runtime_trace_enabled(renv) ) \
+			_sieve_runtime_trace_operand_error(renv, oprnd, __VA_ARGS__); \
+	} STMT_END
 
 /* Trace info */
 
 void _sieve_runtime_trace
-	(const struct sieve_runtime_env *renv, const char *fmt, va_list args)
-		ATTR_FORMAT(2, 0);
-
-static inline void sieve_runtime_trace
-	(const struct sieve_runtime_env *renv, sieve_trace_level_t trace_level,
-		const char *fmt, ...) ATTR_FORMAT(3, 4);
-
-static inline void ATTR_FORMAT(3, 4) sieve_runtime_trace
-(const struct sieve_runtime_env *renv, sieve_trace_level_t trace_level,
-	const char *fmt, ...)
-{
-	va_list args;
-
-	va_start(args, fmt);
-
-	if ( renv->trace != NULL && trace_level <= renv->trace->config.level ) {
-		_sieve_runtime_trace(renv, fmt, args);
-	}
-
-	va_end(args);
-}
+	(const struct sieve_runtime_env *renv, const char *fmt, ...)
+		ATTR_FORMAT(2, 3);
 
 void _sieve_runtime_trace_address
 	(const struct sieve_runtime_env *renv, sieve_size_t address,
-		const char *fmt, va_list args) ATTR_FORMAT(3, 0);
-
-static inline void sieve_runtime_trace_address
-	(const struct sieve_runtime_env *renv, sieve_trace_level_t trace_level,
-		sieve_size_t address, const char *fmt, ...) ATTR_FORMAT(4, 5);
-
-static inline void ATTR_FORMAT(4, 5) sieve_runtime_trace_address
-(const struct sieve_runtime_env *renv, sieve_trace_level_t trace_level,
-	sieve_size_t address, const char *fmt, ...)
-{
-	va_list args;
-
-	va_start(args, fmt);
-
-	if ( renv->trace != NULL && trace_level <= renv->trace->config.level ) {
-		_sieve_runtime_trace_address(renv, address, fmt, args);
-	}
-
-	va_end(args);
-}
-
-static inline void ATTR_FORMAT(3, 4) sieve_runtime_trace_here
-(const struct sieve_runtime_env *renv, sieve_trace_level_t trace_level,
-	const char *fmt, ...)
-{
-	va_list args;
+		const char *fmt, ...) ATTR_FORMAT(3, 4);
 
-	va_start(args, fmt);
+#define sieve_runtime_trace(renv, trace_level, ...) \
+	STMT_START { \
+		if ( sieve_runtime_trace_active(renv, trace_level) ) \
+			_sieve_runtime_trace(renv, __VA_ARGS__); \
+	} STMT_END
 
-	if ( renv->trace != NULL && trace_level <= renv->trace->config.level ) {
-		_sieve_runtime_trace_address(renv, renv->pc, fmt, args);
-	}
+#define sieve_runtime_trace_address(renv, trace_level, address, ...) \
+	STMT_START { \
+		if ( sieve_runtime_trace_active(renv, trace_level) ) \
+			_sieve_runtime_trace_address(renv, address, __VA_ARGS__); \
+	} STMT_END
 
-	va_end(args);
-}
+#define sieve_runtime_trace_here(renv, trace_level, ...) \
+	STMT_START { \
+		if ( sieve_runtime_trace_active(renv, trace_level) ) \
+			_sieve_runtime_trace_address(renv, (renv)->pc, __VA_ARGS__); \
+	} STMT_END
 
 /* Trace boundaries */
 
@@ -164,21 +127,21 @@ void _sieve_runtime_trace_sep(const struct sieve_runtime_env *renv);
 static inline void sieve_runtime_trace_begin
 (const struct sieve_runtime_env *renv)
 {
-	if ( renv->trace != NULL )
+	if ( sieve_runtime_trace_enabled(renv) )
 		_sieve_runtime_trace_begin(renv);
 }
 
 static inline void sieve_runtime_trace_end
 (const struct sieve_runtime_env *renv)
 {
-	if ( renv->trace != NULL )
+	if ( sieve_runtime_trace_enabled(renv) )
 		_sieve_runtime_trace_end(renv);
 }
 
 static inline void sieve_runtime_trace_sep
 (const struct sieve_runtime_env *renv)
 {
-	if ( renv->trace != NULL )
+	if ( sieve_runtime_trace_enabled(renv) )
 		_sieve_runtime_trace_sep(renv);
 }
 
@@ -39,6 +39,9 @@ struct sieve_runtime_env {
 
 	/* Runtime tracing */
 	struct sieve_runtime_trace *trace;
+
+	/* Profile entry of the executing operation (if profiling) */
+	struct sieve_profile_entry *profile_entry;
 };
 
 #endif /* __SIEVE_RUNTIME_H */
@@ -266,6 +266,22 @@ void sieve_settings_load
 		svinst->max_redirects = (unsigned int) uint_setting;
 	}
 
+	svinst->binary_cache_size = SIEVE_DEFAULT_BINARY_CACHE_SIZE;
+	if ( sieve_setting_get_uint_value
+		(svinst, "sieve_binary_cache_size", &uint_setting) ) {
+		svinst->binary_cache_size = (unsigned int) uint_setting;
+	}
+
+	svinst->binary_mmap = FALSE;
+	(void)sieve_setting_get_bool_value
+		(svinst, "sieve_binary_mmap", &svinst->binary_mmap);
+
+	svinst->regex_cache_size = SIEVE_DEFAULT_REGEX_CACHE_SIZE;
+	if ( sieve_setting_get_uint_value
+		(svinst, "sieve_regex_cache_size", &uint_setting) ) {
+		svinst->regex_cache_size = (unsigned int) uint_setting;
+	}
+
 	if (!sieve_setting_get_mail_sender_value
 		(svinst, svinst->pool, "sieve_redirect_envelope_from",
 			&svinst->redirect_from)) {
@@ -0,0 +1,173 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "hash.h"
+#include "ioloop.h"
+
+#include "sieve-common.h"
+#include "sieve-limits.h"
+
+#include "sieve.h"
+#include "sieve-storage-private.h"
+
+/*
+ * Storage lookup cache
+ */
+
+/* The storage lookup cache keeps the results of lookups storage drivers make
+ * for opening a script (e.g. the search for the LDAP entry of a script) for a
+ * configured number of seconds. It belongs to the Sieve library rather than to
+ * the storage, so that it lasts for the lifetime of the process: Sieve
+ * instances are created anew for every delivery and storage plugins are
+ * unloaded along with them.
+ */
+
+struct sieve_storage_cache_entry {
+	char *key;
+	time_t expires;
+
+	/* Values may be NULL; no values at all is a valid (negative) result */
+	unsigned int count;
+	char **values;
+};
+
+struct sieve_storage_cache {
+	HASH_TABLE(char *, struct sieve_storage_cache_entry *) entries;
+
+	struct sieve_storage_cache_stats stats;
+};
+
+static struct sieve_storage_cache *sieve_storage_cache = NULL;
+
+static void sieve_storage_cache_entry_free
+(struct sieve_storage_cache_entry *entry)
+{
+	unsigned int i;
+
+	for ( i = 0; i < entry->count; i++ )
+		i_free(entry->values[i]);
+	i_free(entry->values);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static void sieve_storage_cache_drop
+(struct sieve_storage_cache *cache, struct sieve_storage_cache_entry *entry)
+{
+	hash_table_remove(cache->entries, entry->key);
+	sieve_storage_cache_entry_free(entry);
+}
+
+static void sieve_storage_cache_purge
+(struct sieve_storage_cache *cache, bool all)
+{
+	struct hash_iterate_context *iter;
+	struct sieve_storage_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(cache->entries);
+	while ( hash_table_iterate(iter, cache->entries, &key, &entry) ) {
+		if ( all || entry->expires <= ioloop_time ) {
+			if ( !all )
+				cache->stats.evictions++;
+			sieve_storage_cache_drop(cache, entry);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+bool sieve_storage_cache_lookup
+(const char *key, const char *const **values_r, unsigned int *count_r)
+{
+	struct sieve_storage_cache *cache = sieve_storage_cache;
+	struct sieve_storage_cache_entry *entry;
+
+	*values_r = NULL;
+	*count_r = 0;
+
+	if ( cache == NULL )
+		return FALSE;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if ( entry == NULL || entry->expires <= ioloop_time ) {
+		if ( entry != NULL )
+			sieve_storage_cache_drop(cache, entry);
+		cache->stats.misses++;
+		return FALSE;
+	}
+
+	cache->stats.hits++;
+	*values_r = (const char *const *)entry->values;
+	*count_r = entry->count;
+	return TRUE;
+}
+
+void sieve_storage_cache_update
+(const char *key, const char *const *values, unsigned int count,
+	unsigned int ttl)
+{
+	struct sieve_storage_cache *cache;
+	struct sieve_storage_cache_entry *entry;
+	unsigned int i;
+
+	if ( ttl == 0 )
+		return;
+
+	if ( sieve_storage_cache == NULL ) {
+		sieve_storage_cache = i_new(struct sieve_storage_cache, 1);
+		hash_table_create(&sieve_storage_cache->entries, default_pool, 0,
+			str_hash, strcmp);
+	}
+	cache = sieve_storage_cache;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if ( entry != NULL ) {
+		sieve_storage_cache_drop(cache, entry);
+	} else if ( hash_table_count(cache->entries) >=
+		SIEVE_STORAGE_CACHE_MAX_ENTRIES ) {
+		sieve_storage_cache_purge(cache, FALSE);
+		/* Nothing expired yet; start over */
+		if ( hash_table_count(cache->entries) >=
+			SIEVE_STORAGE_CACHE_MAX_ENTRIES ) {
+			cache->stats.evictions += hash_table_count(cache->entries);
+			sieve_storage_cache_purge(cache, TRUE);
+		}
+	}
+
+	entry = i_new(struct sieve_storage_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->expires = ioloop_time + ttl;
+	entry->count = count;
+	entry->values = i_new(char *, count + 1);
+	for ( i = 0; i < count; i++ )
+		entry->values[i] = i_strdup(values[i]);
+	hash_table_insert(cache->entries, entry->key, entry);
+}
+
+void sieve_storage_cache_get_stats(struct sieve_storage_cache_stats *stats_r)
+{
+	memset(stats_r, 0, sizeof(*stats_r));
+
+	if ( sieve_storage_cache == NULL )
+		return;
+
+	*stats_r = sieve_storage_cache->stats;
+	stats_r->entries = hash_table_count(sieve_storage_cache->entries);
+}
+
+void sieve_storage_cache_deinit(void)
+{
+	struct sieve_storage_cache *cache = sieve_storage_cache;
+
+	/* Connections kept for reuse by later storages */
+	sieve_ldap_storage_deinit();
+
+	if ( cache == NULL )
+		return;
+
+	sieve_storage_cache_purge(cache, TRUE);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+	sieve_storage_cache = NULL;
+}
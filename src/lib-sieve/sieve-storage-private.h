@@ -224,6 +224,22 @@ extern const struct sieve_storage sieve_dict_storage;
 
 extern const struct sieve_storage sieve_ldap_storage;
 
+/* Closes the connections kept for reuse by the built-in LDAP storage */
+void sieve_ldap_storage_deinit(void);
+
+/*
+ * Lookup cache
+ */
+
+/* Returns the values cached for the key, which remain valid until the cache is
+   next updated. A cached result may have no values at all. */
+bool sieve_storage_cache_lookup
+	(const char *key, const char *const **values_r, unsigned int *count_r);
+/* Caches the values (which may be NULL) for the key for ttl seconds */
+void sieve_storage_cache_update
+	(const char *key, const char *const *values, unsigned int count,
+		unsigned int ttl);
+
 /*
  * Error handling
  */
@@ -273,3 +273,92 @@ static void sieve_index_stringlist_set_trace
 
 	sieve_stringlist_set_trace(strlist->source, trace);
 }
+
+/*
+ * Cached Stringlist
+ */
+
+/* Object */
+
+static int sieve_cached_stringlist_next_item
+	(struct sieve_stringlist *_strlist, string_t **str_r);
+static void sieve_cached_stringlist_reset
+	(struct sieve_stringlist *_strlist);
+static int sieve_cached_stringlist_get_length
+	(struct sieve_stringlist *_strlist);
+
+struct sieve_cached_stringlist {
+	struct sieve_stringlist strlist;
+
+	ARRAY(string_t *) items;
+	unsigned int index;
+};
+
+struct sieve_stringlist *sieve_cached_stringlist_create
+(const struct sieve_runtime_env *renv, struct sieve_stringlist *source)
+{
+	struct sieve_cached_stringlist *strlist;
+	string_t *item;
+	int ret;
+
+	strlist = t_new(struct sieve_cached_stringlist, 1);
+	strlist->strlist.runenv = renv;
+	strlist->strlist.exec_status = SIEVE_EXEC_OK;
+	strlist->strlist.next_item = sieve_cached_stringlist_next_item;
+	strlist->strlist.reset = sieve_cached_stringlist_reset;
+	strlist->strlist.get_length = sieve_cached_stringlist_get_length;
+	t_array_init(&strlist->items, 8);
+
+	/* Items may be reused by the source list, so copy them */
+	sieve_stringlist_reset(source);
+	item = NULL;
+	while ( (ret=sieve_stringlist_next_item(source, &item)) > 0 ) {
+		string_t *copy = t_str_new(str_len(item));
+
+		str_append_str(copy, item);
+		array_append(&strlist->items, &copy, 1);
+	}
+
+	if ( ret < 0 )
+		return NULL;
+
+	return &strlist->strlist;
+}
+
+/* Implementation */
+
+static int sieve_cached_stringlist_next_item
+(struct sieve_stringlist *_strlist, string_t **str_r)
+{
+	struct sieve_cached_stringlist *strlist =
+		(struct sieve_cached_stringlist *)_strlist;
+	string_t *const *items;
+	unsigned int count;
+
+	items = array_get(&strlist->items, &count);
+	if ( strlist->index >= count ) {
+		*str_r = NULL;
+		return 0;
+	}
+
+	*str_r = items[strlist->index++];
+	return 1;
+}
+
+static void sieve_cached_stringlist_reset
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_cached_stringlist *strlist =
+		(struct sieve_cached_stringlist *)_strlist;
+
+	strlist->index = 0;
+}
+
+static int sieve_cached_stringlist_get_length
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_cached_stringlist *strlist =
+		(struct sieve_cached_stringlist *)_strlist;
+
+	return (int)array_count(&strlist->items);
+}
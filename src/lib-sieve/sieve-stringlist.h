@@ -74,4 +74,14 @@ struct sieve_stringlist *sieve_index_stringlist_create
 	(const struct sieve_runtime_env *renv, struct sieve_stringlist *source,
 		int index);
 
+/*
+ * Cached Stringlist
+ */
+
+/* Reads all items of the source list once, so that the returned list can be
+   iterated repeatedly without evaluating the source again. Returns NULL when
+   reading the source fails; the source's exec_status has the error then. */
+struct sieve_stringlist *sieve_cached_stringlist_create
+	(const struct sieve_runtime_env *renv, struct sieve_stringlist *source);
+
 #endif /* __SIEVE_STRINGLIST_H */
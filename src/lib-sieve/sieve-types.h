@@ -29,6 +29,13 @@ struct sieve_exec_status;
 enum sieve_flag {
 	/* Relative paths are resolved to HOME */
 	SIEVE_FLAG_HOME_RELATIVE = (1 << 0),
+	/* Loaded binaries may be kept in the process-wide binary cache. The
+	   application must call sieve_binary_cache_deinit() before it exits. */
+	SIEVE_FLAG_BINARY_CACHE = (1 << 1),
+	/* Compiled regular expressions may be kept in the process-wide regex
+	   cache. The application must call sieve_regex_cache_deinit() before it
+	   exits. */
+	SIEVE_FLAG_REGEX_CACHE = (1 << 2),
 };
 
 /* Sieve evaluation can be performed at various different points as messages
@@ -143,7 +150,9 @@ enum sieve_execute_flags {
 	 */
 	SIEVE_EXECUTE_FLAG_NOGLOBAL = (1<<0),
 	/* Do not execute (implicit keep) at the end */
-	SIEVE_EXECUTE_FLAG_DEFER_KEEP = (1<<1)
+	SIEVE_EXECUTE_FLAG_DEFER_KEEP = (1<<1),
+	/* Do not write a runtime trace (delivery is not sampled) */
+	SIEVE_EXECUTE_FLAG_NO_TRACE = (1<<2)
 };
 
 /*
@@ -166,6 +175,9 @@ enum {
 struct sieve_trace_config {
 	sieve_trace_level_t level;
 	unsigned int flags;
+
+	/* Trace only one in this many deliveries (0 or 1 traces all) */
+	unsigned int sample_interval;
 };
 
 /*
@@ -223,6 +235,9 @@ struct sieve_script_env {
 	/* Runtime trace*/
 	struct ostream *trace_stream;
 	struct sieve_trace_config trace_config;
+
+	/* Execution profile (optional) */
+	struct sieve_profile *profile;
 };
 
 #define SIEVE_SCRIPT_DEFAULT_MAILBOX(senv) \
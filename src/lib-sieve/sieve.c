@@ -7,6 +7,7 @@
 #include "buffer.h"
 #include "eacces-error.h"
 #include "home-expand.h"
+#include "program-client.h"
 
 #include "sieve-settings.h"
 #include "sieve-extensions.h"
@@ -18,6 +19,7 @@
 #include "sieve-binary.h"
 #include "sieve-actions.h"
 #include "sieve-result.h"
+#include "sieve-message.h"
 
 #include "sieve-parser.h"
 #include "sieve-validator.h"
@@ -120,6 +122,7 @@ void sieve_deinit(struct sieve_instance **_svinst)
 {
 	struct sieve_instance *svinst = *_svinst;
 
+	sieve_message_raw_user_deinit(svinst);
 	sieve_plugins_unload(svinst);
 	sieve_storages_deinit(svinst);
 	sieve_extensions_deinit(svinst);
@@ -129,6 +132,11 @@ void sieve_deinit(struct sieve_instance **_svinst)
 	*_svinst = NULL;
 }
 
+void sieve_program_workers_deinit(void)
+{
+	program_client_workers_deinit();
+}
+
 void sieve_set_extensions
 (struct sieve_instance *svinst, const char *extensions)
 {
@@ -316,6 +324,20 @@ struct sieve_binary *sieve_compile
  * Sieve runtime
  */
 
+static enum sieve_execute_flags sieve_trace_sample
+(const struct sieve_script_env *senv)
+{
+	static unsigned int delivery_count = 0;
+	unsigned int interval = senv->trace_config.sample_interval;
+
+	/* Trace only one in every `interval' deliveries */
+	if ( senv->trace_stream == NULL || interval <= 1 )
+		return 0;
+	if ( (delivery_count++ % interval) == 0 )
+		return 0;
+	return SIEVE_EXECUTE_FLAG_NO_TRACE;
+}
+
 static int sieve_run
 (struct sieve_binary *sbin, struct sieve_result **result,
 	const struct sieve_message_data *msgdata, const struct sieve_script_env *senv,
@@ -495,6 +517,18 @@ void sieve_dump
 	sieve_binary_dumper_free(&dumpr);
 }
 
+void sieve_dump_profile
+(struct sieve_binary *sbin, struct sieve_profile *profile,
+	struct ostream *stream)
+{
+	struct sieve_binary_dumper *dumpr = sieve_binary_dumper_create(sbin);
+
+	sieve_binary_dumper_set_profile(dumpr, profile);
+	sieve_binary_dumper_run(dumpr, stream, FALSE);
+
+	sieve_binary_dumper_free(&dumpr);
+}
+
 void sieve_hexdump
 (struct sieve_binary *sbin, struct ostream *stream)
 {
@@ -516,6 +550,7 @@ int sieve_test
 	if ( keep != NULL ) *keep = FALSE;
 
 	/* Run the script */
+	flags |= sieve_trace_sample(senv);
 	ret = sieve_run(sbin, &result, msgdata, senv, ehandler, flags);
 
 	/* Print result if successful */
@@ -549,6 +584,7 @@ int sieve_execute
 	if ( keep != NULL ) *keep = FALSE;
 
 	/* Run the script */
+	flags |= sieve_trace_sample(senv);
 	ret = sieve_run(sbin, &result, msgdata, senv, exec_ehandler, flags);
 
 	/* Evaluate status and execute the result:
@@ -595,6 +631,9 @@ struct sieve_multiscript {
 	bool active;
 	bool keep;
 
+	/* Runtime trace sampling decision for this delivery */
+	enum sieve_execute_flags trace_flags;
+
 	struct ostream *teststream;
 };
 
@@ -619,6 +658,7 @@ struct sieve_multiscript *sieve_multiscript_start_execute
 	mscript->status = SIEVE_EXEC_OK;
 	mscript->active = TRUE;
 	mscript->keep = TRUE;
+	mscript->trace_flags = sieve_trace_sample(senv);
 
 	return mscript;
 }
@@ -675,7 +715,7 @@ bool sieve_multiscript_run
 
 	/* Run the script */
 	mscript->status = sieve_run(sbin, &mscript->result, mscript->msgdata,
-		mscript->scriptenv, exec_ehandler, flags);
+		mscript->scriptenv, exec_ehandler, flags | mscript->trace_flags);
 
 	if ( mscript->status >= 0 ) {
 		mscript->keep = FALSE;
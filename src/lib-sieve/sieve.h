@@ -132,6 +132,105 @@ const char *sieve_get_source(struct sieve_binary *sbin);
  */
 bool sieve_is_loaded(struct sieve_binary *sbin);
 
+/*
+ * Binary cache
+ */
+
+struct sieve_binary_cache_stats {
+	unsigned int entries;
+
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+};
+
+/* sieve_binary_cache_get_stats:
+ *
+ *   Obtains the counters of the process-wide binary cache. The cache is only
+ *   used by Sieve instances created with the SIEVE_FLAG_BINARY_CACHE flag.
+ */
+void sieve_binary_cache_get_stats(struct sieve_binary_cache_stats *stats_r);
+
+/* sieve_binary_cache_deinit:
+ *
+ *   Frees all binary images held by the process-wide binary cache.
+ */
+void sieve_binary_cache_deinit(void);
+
+/*
+ * Regex cache
+ */
+
+struct sieve_regex_cache_stats {
+	unsigned int entries;
+
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+};
+
+/* sieve_regex_cache_get_stats:
+ *
+ *   Obtains the counters of the process-wide cache of compiled regular
+ *   expressions. The cache is only used by Sieve instances created with the
+ *   SIEVE_FLAG_REGEX_CACHE flag.
+ */
+void sieve_regex_cache_get_stats(struct sieve_regex_cache_stats *stats_r);
+
+/* sieve_regex_cache_deinit:
+ *
+ *   Frees all regular expressions held by the process-wide regex cache.
+ */
+void sieve_regex_cache_deinit(void);
+
+/*
+ * Storage lookup cache
+ */
+
+struct sieve_storage_cache_stats {
+	unsigned int entries;
+
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+};
+
+/* sieve_storage_cache_get_stats:
+ *
+ *   Obtains the counters of the process-wide cache of storage lookups (e.g.
+ *   the LDAP search for a script, when sieve_ldap_cache_ttl is set).
+ */
+void sieve_storage_cache_get_stats(struct sieve_storage_cache_stats *stats_r);
+
+/* sieve_storage_cache_deinit:
+ *
+ *   Frees all results held by the process-wide storage lookup cache and
+ *   closes the storage connections kept open for reuse.
+ */
+void sieve_storage_cache_deinit(void);
+
+/*
+ * Include validation cache
+ */
+
+/* sieve_include_validation_cache_deinit:
+ *
+ *   Frees the process-wide cache of validated include dependencies (see the
+ *   sieve_include_validation_cache setting) and closes its inotify instance.
+ */
+void sieve_include_validation_cache_deinit(void);
+
+/*
+ * Program workers
+ */
+
+/* sieve_program_workers_deinit:
+ *
+ *   Stops the long-running program instances kept for reuse by the extprograms
+ *   plugin (see the sieve_<extension>_workers settings).
+ */
+void sieve_program_workers_deinit(void);
+
 /*
  * Debugging
  */
@@ -151,6 +250,15 @@ void sieve_dump
 void sieve_hexdump
 	(struct sieve_binary *sbin, struct ostream *stream);
 
+/* sieve_dump_profile:
+ *
+ *   Dumps the byte code in human-readable form to the specified ostream,
+ *   annotated with the execution statistics recorded in the profile.
+ */
+void sieve_dump_profile
+	(struct sieve_binary *sbin, struct sieve_profile *profile,
+		struct ostream *stream);
+
 /* sieve_test:
  *
  *   Executes the bytecode, but only prints the result to the given stream.
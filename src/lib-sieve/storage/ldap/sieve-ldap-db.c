@@ -996,17 +996,90 @@ const char *ldap_escape(const char *str)
 	return str_c(ret);
 }
 
+static void db_ldap_conn_destroy(struct ldap_connection *conn)
+{
+	struct ldap_connection **p;
+
+	for (p = &ldap_connections; *p != NULL; p = &(*p)->next) {
+		if (*p == conn) {
+			*p = conn->next;
+			break;
+		}
+	}
+
+	/* idle connections have no requests (nor storage to log to) */
+	if (aqueue_count(conn->request_queue) > 0) {
+		db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE,
+				       "Shutting down");
+	}
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+
+	pool_unref(&conn->pool);
+}
+
+static struct ldap_connection *
+db_ldap_conn_find_idle(struct sieve_ldap_storage *lstorage)
+{
+	struct ldap_connection *conn, *next;
+
+	for (conn = ldap_connections; conn != NULL; conn = next) {
+		next = conn->next;
+
+		if (conn->refcount > 0)
+			continue;
+		if (ioloop_time - conn->idle_stamp >= DB_LDAP_IDLE_RECONNECT_SECS) {
+			/* server has probably disconnected it by now */
+			db_ldap_conn_destroy(conn);
+			continue;
+		}
+		if (conn->config_mtime == lstorage->set_mtime &&
+		    strcmp(conn->config_file, lstorage->config_file) == 0)
+			return conn;
+	}
+	return NULL;
+}
+
+static unsigned int db_ldap_conn_count_idle(void)
+{
+	struct ldap_connection *conn;
+	unsigned int count = 0;
+
+	for (conn = ldap_connections; conn != NULL; conn = conn->next) {
+		if (conn->refcount == 0)
+			count++;
+	}
+	return count;
+}
+
 struct ldap_connection *
 sieve_ldap_db_init(struct sieve_ldap_storage *lstorage)
 {
 	struct ldap_connection *conn;
 	pool_t pool;
 
+	/* reuse a bound connection left behind by an earlier storage */
+	conn = db_ldap_conn_find_idle(lstorage);
+	if (conn != NULL) {
+		conn->lstorage = lstorage;
+		conn->refcount = 1;
+		sieve_storage_sys_debug(&lstorage->storage, "db: "
+			"Reusing idle connection");
+		db_ldap_enable_input(conn, TRUE);
+		return conn;
+	}
+
 	pool = pool_alloconly_create("ldap_connection", 1024);
 	conn = p_new(pool, struct ldap_connection, 1);
 	conn->pool = pool;
 	conn->refcount = 1;
 	conn->lstorage = lstorage;
+	conn->config_file = p_strdup(pool, lstorage->config_file);
+	conn->config_mtime = lstorage->set_mtime;
 
 	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
 	conn->default_bind_msgid = -1;
@@ -1023,29 +1096,25 @@ sieve_ldap_db_init(struct sieve_ldap_storage *lstorage)
 void sieve_ldap_db_unref(struct ldap_connection **_conn)
 {
 	struct ldap_connection *conn = *_conn;
-	struct ldap_connection **p;
 
 	*_conn = NULL;
 	i_assert(conn->refcount >= 0);
 	if (--conn->refcount > 0)
 		return;
 
-	for (p = &ldap_connections; *p != NULL; p = &(*p)->next) {
-		if (*p == conn) {
-			*p = conn->next;
-			break;
-		}
+	if (conn->conn_state == LDAP_CONN_STATE_BOUND &&
+	    aqueue_count(conn->request_queue) == 0 && conn->to == NULL &&
+	    db_ldap_conn_count_idle() < DB_LDAP_MAX_IDLE_CONNECTIONS) {
+		/* keep it for the next storage with the same configuration;
+		   no I/O is handled until then, since there is no storage to
+		   report to */
+		db_ldap_enable_input(conn, FALSE);
+		conn->lstorage = NULL;
+		conn->idle_stamp = ioloop_time;
+		return;
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
-
-	pool_unref(&conn->pool);
+	db_ldap_conn_destroy(conn);
 }
 
 static void db_ldap_switch_ioloop(struct ldap_connection *conn)
@@ -1218,12 +1287,108 @@ db_ldap_get_var_expand_table(struct ldap_connection *conn,
 	return tab;
 }
 
+/*
+ * Script lookup cache
+ */
+
+/* Lookup results are kept in the storage lookup cache of the Sieve library for
+   sieve_ldap_cache_ttl seconds, keyed by the configuration and the expanded
+   search. Negative results (no script entry for the user) are cached as
+   well. */
+
+static const char *
+sieve_ldap_db_cache_key(struct ldap_connection *conn,
+	const char *base, const char *filter)
+{
+	return t_strdup_printf("ldap\n%s\n%ld\n%s\n%s", conn->config_file,
+		(long)conn->config_mtime, base, filter);
+}
+
+static void
+sieve_ldap_db_cache_update(struct ldap_connection *conn,
+	const char *base, const char *filter,
+	const char *dn, const char *modattr)
+{
+	const char *values[2];
+
+	values[0] = dn;
+	values[1] = modattr;
+	sieve_storage_cache_update(sieve_ldap_db_cache_key(conn, base, filter),
+		values, (dn == NULL ? 0 : 2),
+		conn->lstorage->set.sieve_ldap_cache_ttl);
+}
+
+void sieve_ldap_db_deinit(void)
+{
+	struct ldap_connection *conn, *next;
+
+	for (conn = ldap_connections; conn != NULL; conn = next) {
+		next = conn->next;
+		if (conn->refcount == 0)
+			db_ldap_conn_destroy(conn);
+	}
+}
+
+/*
+ * Script lookup
+ */
+
+static void
+db_ldap_get_script_search(struct ldap_connection *conn, const char *name,
+	const char **base_r, const char **filter_r)
+{
+	const struct sieve_ldap_storage_settings *set = &conn->lstorage->set;
+	const struct var_expand_table *vars;
+	string_t *str;
+
+	vars = db_ldap_get_var_expand_table(conn, name);
+
+	str = t_str_new(512);
+	var_expand(str, set->base, vars);
+	*base_r = str_c(str);
+
+	str = t_str_new(512);
+	var_expand(str, set->sieve_ldap_filter, vars);
+	*filter_r = str_c(str);
+}
+
+bool sieve_ldap_db_cache_lookup_script(struct ldap_connection *conn,
+	const char *name, const char **dn_r, const char **modattr_r)
+{
+	struct sieve_storage *storage = &conn->lstorage->storage;
+	const char *base, *filter;
+	const char *const *values;
+	unsigned int count;
+
+	*dn_r = *modattr_r = NULL;
+
+	if (conn->lstorage->set.sieve_ldap_cache_ttl == 0)
+		return FALSE;
+
+	db_ldap_get_script_search(conn, name, &base, &filter);
+	if (!sieve_storage_cache_lookup(
+		sieve_ldap_db_cache_key(conn, base, filter), &values, &count))
+		return FALSE;
+
+	if (count > 0) {
+		*dn_r = t_strdup(values[0]);
+		*modattr_r = t_strdup(values[1]);
+	}
+
+	sieve_storage_sys_debug(storage, "db: "
+		"Using cached result for base=%s filter=%s (%s)",
+		base, filter, *dn_r == NULL ? "no entry" : *dn_r);
+	return TRUE;
+}
+
 struct sieve_ldap_script_lookup_request {
 	struct ldap_request request;
 
 	unsigned int entries;
 	const char *result_dn;
 	const char *result_modattr;
+
+	bool failed;
 };
 
 static void
@@ -1235,6 +1400,7 @@ sieve_ldap_lookup_script_callback(struct ldap_connection *conn,
 		(struct sieve_ldap_script_lookup_request *)request;
 
 	if (res == NULL) {
+		srequest->failed = TRUE;
 		io_loop_stop(conn->ioloop);
 		return;
 	}
@@ -1263,28 +1429,22 @@ int sieve_ldap_db_lookup_script(struct ldap_connection *conn,
 	struct sieve_storage *storage = &lstorage->storage;
 	const struct sieve_ldap_storage_settings *set = &lstorage->set;
 	struct sieve_ldap_script_lookup_request *request;
-	const struct var_expand_table *vars;
+	const char *base, *filter;
 	char **attr_names;
-	string_t *str;
 
 	pool_t pool = pool_alloconly_create
 		("sieve_ldap_script_lookup_request", 512);
 	request = p_new(pool, struct sieve_ldap_script_lookup_request, 1);
 	request->request.pool = pool;
 
-	vars = db_ldap_get_var_expand_table(conn, name);
-
-	str = t_str_new(512);
-	var_expand(str, set->base, vars);
-	request->request.base = p_strdup(pool, str_c(str));
+	db_ldap_get_script_search(conn, name, &base, &filter);
+	request->request.base = p_strdup(pool, base);
 
 	attr_names = p_new(pool, char *, 3);
 	attr_names[0] = p_strdup(pool, set->sieve_ldap_mod_attr);
 
-	str_truncate(str, 0);
-	var_expand(str, set->sieve_ldap_filter, vars);
 	request->request.scope = lstorage->set.ldap_scope;
-	request->request.filter = p_strdup(pool, str_c(str));
+	request->request.filter = p_strdup(pool, filter);
 	request->request.attributes = attr_names;
 
 	sieve_storage_sys_debug(storage,
@@ -1299,6 +1459,10 @@ int sieve_ldap_db_lookup_script(struct ldap_connection *conn,
 
 	*dn_r = t_strdup(request->result_dn);
 	*modattr_r = t_strdup(request->result_modattr);
+	if (!request->failed) {
+		sieve_ldap_db_cache_update(conn, base, filter,
+					   *dn_r, *modattr_r);
+	}
 	pool_unref(&request->request.pool);
 	return (*dn_r == NULL ? 0 : 1);
 }
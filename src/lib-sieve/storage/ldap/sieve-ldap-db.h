@@ -15,6 +15,10 @@
 /* If server disconnects us, don't reconnect if no requests have been sent
    for this many seconds. */
 #define DB_LDAP_IDLE_RECONNECT_SECS 60
+/* Maximum number of unused connections kept open for reuse by later storages
+   with the same configuration. Connections idle for longer than
+   DB_LDAP_IDLE_RECONNECT_SECS are closed rather than reused. */
+#define DB_LDAP_MAX_IDLE_CONNECTIONS 4
 
 #include <ldap.h>
 
@@ -85,11 +89,18 @@ enum ldap_connection_state {
 struct ldap_connection {
 	struct ldap_connection *next;
 
+	/* NULL while the connection is idle (refcount == 0) */
 	struct sieve_ldap_storage *lstorage;
 
 	pool_t pool;
 	int refcount;
 
+	/* Configuration the connection was created for */
+	const char *config_file;
+	time_t config_mtime;
+	/* Timestamp when the connection became idle */
+	time_t idle_stamp;
+
 	LDAP *ld;
 	enum ldap_connection_state conn_state;
 	int default_bind_msgid;
@@ -132,6 +143,10 @@ struct ldap_connection *
 sieve_ldap_db_init(struct sieve_ldap_storage *lstorage);
 void sieve_ldap_db_unref(struct ldap_connection **conn);
 
+void sieve_ldap_db_deinit(void);
+
+bool sieve_ldap_db_cache_lookup_script(struct ldap_connection *conn,
+	const char *name, const char **dn_r, const char **modattr_r);
 int sieve_ldap_db_lookup_script(struct ldap_connection *conn,
 	const char *name, const char **dn_r, const char **modattr_r);
 int sieve_ldap_db_read_script(struct ldap_connection *conn,
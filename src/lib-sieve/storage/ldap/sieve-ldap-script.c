@@ -64,15 +64,22 @@ static int sieve_ldap_script_open
 		(struct sieve_ldap_storage *)storage;
 	int ret;
 
-	if ( sieve_ldap_db_connect(lstorage->conn) < 0 ) {
-		sieve_storage_set_critical(storage,
-			"Failed to connect to LDAP database");
-		*error_r = storage->error_code;
-		return -1;
+	if ( sieve_ldap_db_cache_lookup_script(lstorage->conn,
+		script->name, &lscript->dn, &lscript->modattr) ) {
+		ret = ( lscript->dn == NULL ? 0 : 1 );
+	} else {
+		if ( sieve_ldap_db_connect(lstorage->conn) < 0 ) {
+			sieve_storage_set_critical(storage,
+				"Failed to connect to LDAP database");
+			*error_r = storage->error_code;
+			return -1;
+		}
+
+		ret = sieve_ldap_db_lookup_script(lstorage->conn,
+			script->name, &lscript->dn, &lscript->modattr);
 	}
 
-	if ( (ret=sieve_ldap_db_lookup_script(lstorage->conn,
-		script->name, &lscript->dn, &lscript->modattr)) <= 0 ) {
+	if ( ret <= 0 ) {
 		if ( ret == 0 ) {
 			sieve_script_sys_debug(script,
 				"Script entry not found");
@@ -221,7 +221,14 @@ void sieve_storage_ldap_plugin_init(void)
 
 void sieve_storage_ldap_plugin_deinit(void)
 {
-	/* Nothing */
+	/* Idle connections cannot outlive the plugin; the lookup cache is kept by
+	   the Sieve library */
+	sieve_ldap_db_deinit();
+}
+#else
+void sieve_ldap_storage_deinit(void)
+{
+	sieve_ldap_db_deinit();
 }
 #endif
 
@@ -229,4 +236,9 @@ void sieve_storage_ldap_plugin_deinit(void)
 const struct sieve_storage sieve_ldap_storage = {
 	.driver_name = SIEVE_LDAP_STORAGE_DRIVER_NAME
 };
+
+void sieve_ldap_storage_deinit(void)
+{
+	/* Nothing */
+}
 #endif
@@ -50,6 +50,7 @@ struct sieve_ldap_storage_settings {
 	const char *sieve_ldap_script_attr;
 	const char *sieve_ldap_mod_attr;
 	const char *sieve_ldap_filter;
+	unsigned int sieve_ldap_cache_ttl;
 
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert;
@@ -5,8 +5,10 @@
 #include "str-sanitize.h"
 
 #include "sieve-common.h"
+#include "sieve-stringlist.h"
 #include "sieve-commands.h"
 #include "sieve-code.h"
+#include "sieve-binary.h"
 #include "sieve-message.h"
 #include "sieve-comparators.h"
 #include "sieve-match-types.h"
@@ -60,6 +62,22 @@ const struct sieve_operation_def tst_header_operation = {
 	.execute = tst_header_operation_execute
 };
 
+/*
+ * Header dispatch operation
+ */
+
+static bool tst_header_dispatch_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int tst_header_dispatch_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def tst_header_dispatch_operation = {
+	.mnemonic = "HEADER-DISPATCH",
+	.code = SIEVE_OPERATION_HEADER_DISPATCH,
+	.dump = tst_header_dispatch_operation_dump,
+	.execute = tst_header_dispatch_operation_execute
+};
+
 /*
  * Test registration
  */
@@ -127,6 +145,149 @@ static bool tst_header_generate
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
 
+/*
+ * Dispatch generation
+ */
+
+/* A chain of if/elsif commands that each test the same header fields using
+ * the same comparator and match type is compiled into a single dispatch
+ * operation. It retrieves the header values once, matches them against the
+ * key list of each branch in turn and jumps to the block of the first branch
+ * that matches.
+ */
+
+static bool tst_header_dispatch_get_match
+(struct sieve_command *tst, const struct sieve_comparator_def **cmp_r,
+	const struct sieve_match_type_def **mcht_r)
+{
+	struct sieve_ast_argument *arg = sieve_command_first_argument(tst);
+
+	*cmp_r = &i_ascii_casemap_comparator;
+	*mcht_r = &is_match_type;
+
+	while ( arg != NULL && arg != tst->first_positional ) {
+		if ( sieve_argument_is_comparator(arg) ) {
+			const struct sieve_comparator *cmp = sieve_comparator_tag_get(arg);
+
+			if ( cmp == NULL )
+				return FALSE;
+			*cmp_r = cmp->def;
+		} else if ( sieve_argument_is_match_type(arg) ) {
+			struct sieve_match_type_context *mtctx =
+				(struct sieve_match_type_context *) arg->argument->data;
+
+			if ( mtctx == NULL || mtctx->match_type == NULL )
+				return FALSE;
+			*mcht_r = mtctx->match_type->def;
+		} else {
+			/* Any other tag (e.g. :mime or :index) changes the values */
+			return FALSE;
+		}
+		arg = sieve_ast_argument_next(arg);
+	}
+	return TRUE;
+}
+
+static bool tst_header_dispatch_names_equal
+(struct sieve_ast_argument *names1, struct sieve_ast_argument *names2)
+{
+	struct sieve_ast_argument *item1, *item2;
+
+	if ( sieve_ast_argument_type(names1) != sieve_ast_argument_type(names2) )
+		return FALSE;
+
+	if ( sieve_ast_argument_type(names1) == SAAT_STRING ) {
+		item1 = names1;
+		item2 = names2;
+	} else {
+		item1 = sieve_ast_strlist_first(names1);
+		item2 = sieve_ast_strlist_first(names2);
+	}
+
+	while ( item1 != NULL && item2 != NULL ) {
+		if ( item1->argument == NULL || !sieve_argument_is_string_literal(item1) ||
+			item2->argument == NULL || !sieve_argument_is_string_literal(item2) )
+			return FALSE;
+		if ( !str_equals(sieve_ast_argument_str(item1),
+			sieve_ast_argument_str(item2)) )
+			return FALSE;
+
+		if ( sieve_ast_argument_type(names1) == SAAT_STRING )
+			return TRUE;
+		item1 = sieve_ast_strlist_next(item1);
+		item2 = sieve_ast_strlist_next(item2);
+	}
+	return ( item1 == NULL && item2 == NULL );
+}
+
+bool tst_header_dispatch_compatible
+(struct sieve_command *tst1, struct sieve_command *tst2)
+{
+	const struct sieve_comparator_def *cmp1, *cmp2;
+	const struct sieve_match_type_def *mcht1, *mcht2;
+
+	if ( !sieve_command_is(tst1, tst_header) ||
+		!sieve_command_is(tst2, tst_header) )
+		return FALSE;
+
+	if ( !tst_header_dispatch_get_match(tst1, &cmp1, &mcht1) ||
+		!tst_header_dispatch_get_match(tst2, &cmp2, &mcht2) )
+		return FALSE;
+	if ( cmp1 != cmp2 || mcht1 != mcht2 )
+		return FALSE;
+
+	return tst_header_dispatch_names_equal
+		(tst1->first_positional, tst2->first_positional);
+}
+
+bool tst_header_dispatch_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *const *tsts,
+	unsigned int count, sieve_size_t *branch_jumps_r,
+	sieve_size_t *default_jump_r)
+{
+	struct sieve_binary_block *sblock = cgenv->sblock;
+	struct sieve_command *tst = tsts[0];
+	struct sieve_ast_argument *arg;
+	bool optional = FALSE;
+	unsigned int i;
+
+	i_assert( count > 0 );
+
+	sieve_operation_emit(sblock, NULL, &tst_header_dispatch_operation);
+
+	/* Comparator and match type of the first test apply to all */
+	arg = sieve_command_first_argument(tst);
+	while ( arg != NULL && arg != tst->first_positional ) {
+		if ( !optional ) {
+			sieve_binary_emit_byte(sblock, SIEVE_OPERAND_OPTIONAL);
+			optional = TRUE;
+		}
+		sieve_binary_emit_byte(sblock, (unsigned char) arg->argument->id_code);
+		if ( !sieve_generate_argument(cgenv, arg, tst) )
+			return FALSE;
+		arg = sieve_ast_argument_next(arg);
+	}
+	if ( optional )
+		sieve_binary_emit_byte(sblock, 0);
+
+	/* Header names */
+	if ( !sieve_generate_argument(cgenv, tst->first_positional, tst) )
+		return FALSE;
+
+	/* Key list and jump offset for each branch */
+	(void)sieve_binary_emit_unsigned(sblock, count);
+	for ( i = 0; i < count; i++ ) {
+		arg = sieve_ast_argument_next(tsts[i]->first_positional);
+		if ( !sieve_generate_argument(cgenv, arg, tsts[i]) )
+			return FALSE;
+		branch_jumps_r[i] = sieve_binary_emit_offset(sblock, 0);
+	}
+
+	/* Jump offset for when none of the branches match */
+	*default_jump_r = sieve_binary_emit_offset(sblock, 0);
+	return TRUE;
+}
+
 /*
  * Code dump
  */
@@ -202,3 +363,137 @@ static int tst_header_operation_execute
 	sieve_interpreter_set_test_result(renv->interp, match > 0);
 	return SIEVE_EXEC_OK;
 }
+
+/*
+ * Dispatch code dump
+ */
+
+static bool tst_header_dispatch_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address)
+{
+	unsigned int count, i;
+	sieve_offset_t offset;
+	sieve_size_t pc;
+
+	sieve_code_dumpf(denv, "HEADER-DISPATCH");
+	sieve_code_descend(denv);
+
+	/* Optional operands */
+	if ( sieve_message_opr_optional_dump(denv, address, NULL) != 0 )
+		return FALSE;
+
+	if ( !sieve_opr_stringlist_dump(denv, address, "header names") )
+		return FALSE;
+
+	sieve_code_mark(denv);
+	if ( !sieve_binary_read_unsigned(denv->sblock, address, &count) )
+		return FALSE;
+	sieve_code_dumpf(denv, "branches: %u", count);
+
+	for ( i = 0; i < count; i++ ) {
+		if ( !sieve_opr_stringlist_dump(denv, address, "key list") )
+			return FALSE;
+
+		sieve_code_mark(denv);
+		pc = *address;
+		if ( !sieve_binary_read_offset(denv->sblock, address, &offset) )
+			return FALSE;
+		sieve_code_dumpf(denv, "jump: %d [%08llx]", offset,
+			(unsigned long long) (pc + offset));
+	}
+
+	sieve_code_mark(denv);
+	pc = *address;
+	if ( !sieve_binary_read_offset(denv->sblock, address, &offset) )
+		return FALSE;
+	sieve_code_dumpf(denv, "default jump: %d [%08llx]", offset,
+		(unsigned long long) (pc + offset));
+	return TRUE;
+}
+
+/*
+ * Dispatch code execution
+ */
+
+static int tst_header_dispatch_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address)
+{
+	struct sieve_comparator cmp =
+		SIEVE_COMPARATOR_DEFAULT(i_ascii_casemap_comparator);
+	struct sieve_match_type mcht =
+		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
+	struct sieve_stringlist *hdr_list, *key_list, *value_list, *cached_list;
+	ARRAY_TYPE(sieve_message_override) svmos;
+	unsigned int count, i;
+	sieve_size_t jmp_address;
+	int match, ret;
+
+	/*
+	 * Read operands
+	 */
+
+	/* Optional operands */
+	memset(&svmos, 0, sizeof(svmos));
+	if ( sieve_message_opr_optional_read
+		(renv, address, NULL, &ret, NULL, &mcht, &cmp, &svmos) < 0 )
+		return ret;
+
+	/* Read header-list */
+	if ( (ret=sieve_opr_stringlist_read(renv, address, "header-list", &hdr_list))
+		<= 0 )
+		return ret;
+
+	/* Read branch count */
+	if ( !sieve_binary_read_unsigned(renv->sblock, address, &count) ) {
+		sieve_runtime_trace_error(renv, "invalid branch count");
+		return SIEVE_EXEC_BIN_CORRUPT;
+	}
+
+	/*
+	 * Perform test
+	 */
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+		"header test dispatch (%u branches)", count);
+
+	/* Get header values only once */
+	sieve_runtime_trace_descend(renv);
+	if ( (ret=sieve_message_get_header_fields
+		(renv, hdr_list, &svmos, TRUE, &value_list)) <= 0 )
+		return ret;
+	if ( (cached_list=sieve_cached_stringlist_create(renv, value_list)) == NULL )
+		return value_list->exec_status;
+	sieve_runtime_trace_ascend(renv);
+
+	/* Match the key list of each branch until one matches */
+	for ( i = 0; i < count; i++ ) {
+		sieve_offset_t offset;
+
+		/* Read key-list */
+		if ( (ret=sieve_opr_stringlist_read(renv, address, "key-list", &key_list))
+			<= 0 )
+			return ret;
+
+		jmp_address = *address;
+		if ( !sieve_binary_read_offset(renv->sblock, address, &offset) ) {
+			sieve_runtime_trace_error(renv, "invalid jump offset");
+			return SIEVE_EXEC_BIN_CORRUPT;
+		}
+
+		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+			"header test (branch %u)", i+1);
+
+		if ( (match=sieve_match
+			(renv, &mcht, &cmp, cached_list, key_list, &ret)) < 0 )
+			return ret;
+
+		if ( match > 0 ) {
+			/* Jump to the block of this branch */
+			*address = jmp_address;
+			return sieve_interpreter_program_jump(renv->interp, TRUE, FALSE);
+		}
+	}
+
+	/* No branch matched */
+	return sieve_interpreter_program_jump(renv->interp, TRUE, FALSE);
+}
@@ -5,9 +5,15 @@
 #include "lib-signals.h"
 #include "env-util.h"
 #include "execv-const.h"
+#include "fd-close-on-exec.h"
 #include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "ioloop.h"
 #include "net.h"
-#include "istream.h"
+#include "istream-private.h"
 #include "ostream.h"
 
 #include "program-client-private.h"
@@ -20,10 +26,23 @@
 #include <fcntl.h>
 #include <grp.h>
 
+#define PROGRAM_CLIENT_WORKER_ENV "PROGRAM_CLIENT_WORKER=1"
+#define PROGRAM_CLIENT_WORKER_BUFFER_SIZE 8192
+#define PROGRAM_CLIENT_WORKER_IDLE_TIMEOUT_SECS 60
+
 struct program_client_local {
 	struct program_client client;
 
 	pid_t pid;
+	struct timeval start_time;
+
+	struct program_client_worker *worker;
+	unsigned int worker_request;
+	int worker_status;
+
+	unsigned int worker_done:1;
+	unsigned int worker_unclean:1;
+	unsigned int worker_reuse:1;
 };
 
 static void exec_child
@@ -119,6 +138,717 @@ static void exec_child
 	execvp_const(args[0], args);
 }
 
+static void drop_privileges(const struct program_client_settings *set)
+{
+	/* drop privileges if we have any */
+	if ( getuid() == 0 ) {
+		uid_t uid;
+		gid_t gid;
+
+		/* switch back to root */
+		if (seteuid(0) < 0)
+			i_fatal("seteuid(0) failed: %m");
+
+		/* drop gids first */
+		gid = getgid();
+		if ( gid == 0 || gid != set->gid ) {
+			if ( set->gid != 0 )
+				gid = set->gid;
+			else
+				gid = getegid();
+		}
+		if ( setgroups(1, &gid) < 0 )
+			i_fatal("setgroups(%d) failed: %m", gid);
+		if ( gid != 0 && setgid(gid) < 0 )
+			i_fatal("setgid(%d) failed: %m", gid);
+
+		/* drop uid */
+		if ( set->uid != 0 )
+			uid = set->uid;
+		else
+			uid = geteuid();
+		if ( uid != 0 && setuid(uid) < 0 )
+			i_fatal("setuid(%d) failed: %m", uid);
+	}
+
+	i_assert(set->uid == 0 || getuid() != 0);
+	i_assert(set->gid == 0 || getgid() != 0);
+}
+
+/*
+ * Worker instances
+ */
+
+/* A worker is a long-running instance of a program that handles one request
+   after another. It is started with PROGRAM_CLIENT_WORKER_ENV in its
+   environment and without arguments. Each request and response consists of
+   items that are prefixed with their decimal length and a LF:
+
+     request:  <argc> LF, argc * (<len> LF <argument>),
+               <envc> LF, envc * (<len> LF <NAME=value>),
+               input chunks (<len> LF <data>), ended by "0" LF
+     response: output chunks (<len> LF <data>), ended by "0" LF,
+               <exit code> LF
+ */
+
+struct program_client_worker {
+	char *path;
+	uid_t uid;
+	gid_t gid;
+
+	pid_t pid;
+	int fd_in, fd_out;
+
+	unsigned int requests;
+	time_t idle_stamp;
+};
+
+/* Idle workers, least recently used first */
+static ARRAY(struct program_client_worker *) program_client_workers;
+/* Stopped workers that have not exited yet */
+static ARRAY(pid_t) program_client_worker_pids;
+
+static void program_client_worker_reap(void)
+{
+	pid_t *pids;
+	unsigned int count, i;
+	int status;
+
+	if ( !array_is_created(&program_client_worker_pids) )
+		return;
+
+	pids = array_get_modifiable(&program_client_worker_pids, &count);
+	for ( i = count; i > 0; i-- ) {
+		if ( waitpid(pids[i-1], &status, WNOHANG) != 0 )
+			array_delete(&program_client_worker_pids, i-1, 1);
+	}
+}
+
+static void program_client_worker_destroy
+(struct program_client_worker **_worker, bool kill_now)
+{
+	struct program_client_worker *worker = *_worker;
+	int status;
+
+	*_worker = NULL;
+
+	/* Close our ends of the pipes and signal the worker right away; it is not
+	   given the chance to finish by itself */
+	if ( worker->fd_out >= 0 && close(worker->fd_out) < 0 )
+		i_error("close(%s) failed: %m", worker->path);
+	if ( worker->fd_in >= 0 && close(worker->fd_in) < 0 )
+		i_error("close(%s) failed: %m", worker->path);
+
+	/* Don't wait for it to exit; it is reaped later */
+	if ( worker->pid > 0 ) {
+		(void)kill(worker->pid, ( kill_now ? SIGKILL : SIGTERM ));
+
+		if ( waitpid(worker->pid, &status, WNOHANG) == 0 ) {
+			if ( !array_is_created(&program_client_worker_pids) )
+				i_array_init(&program_client_worker_pids, 8);
+			array_append(&program_client_worker_pids, &worker->pid, 1);
+		}
+	}
+
+	i_free(worker->path);
+	i_free(worker);
+}
+
+static void program_client_worker_expire(void)
+{
+	struct program_client_worker *const *workers, *worker;
+	unsigned int count, i;
+	int status;
+
+	program_client_worker_reap();
+
+	if ( !array_is_created(&program_client_workers) )
+		return;
+
+	/* Stop workers that have been idle for too long and forget the ones that
+	   exited by themselves */
+	workers = array_get(&program_client_workers, &count);
+	for ( i = count; i > 0; i-- ) {
+		worker = workers[i-1];
+
+		if ( waitpid(worker->pid, &status, WNOHANG) != 0 ) {
+			worker->pid = -1;
+		} else if ( ioloop_time - worker->idle_stamp <
+			PROGRAM_CLIENT_WORKER_IDLE_TIMEOUT_SECS ) {
+			continue;
+		}
+
+		array_delete(&program_client_workers, i-1, 1);
+		program_client_worker_destroy(&worker, FALSE);
+		workers = array_get(&program_client_workers, &count);
+	}
+}
+
+static struct program_client_worker *
+program_client_worker_spawn(struct program_client *pclient)
+{
+	struct program_client_worker *worker;
+	int fd_in[2], fd_out[2];
+	pid_t pid;
+
+	if ( pipe(fd_in) < 0 ) {
+		i_error("pipe(in) failed: %m");
+		return NULL;
+	}
+	if ( pipe(fd_out) < 0 ) {
+		i_error("pipe(out) failed: %m");
+		i_close_fd(&fd_in[0]);
+		i_close_fd(&fd_in[1]);
+		return NULL;
+	}
+
+	if ( (pid = fork()) == (pid_t)-1 ) {
+		i_error("fork() failed: %m");
+		i_close_fd(&fd_in[0]);
+		i_close_fd(&fd_in[1]);
+		i_close_fd(&fd_out[0]);
+		i_close_fd(&fd_out[1]);
+		return NULL;
+	}
+
+	if ( pid == 0 ) {
+		const char *envs[] = { PROGRAM_CLIENT_WORKER_ENV, NULL };
+
+		/* child */
+		if ( close(fd_in[1]) < 0 )
+			i_error("close(pipe:in:wr) failed: %m");
+		if ( close(fd_out[0]) < 0 )
+			i_error("close(pipe:out:rd) failed: %m");
+
+		drop_privileges(&pclient->set);
+
+		exec_child(pclient->path, NULL, envs, fd_in[0], fd_out[1], NULL,
+			pclient->set.drop_stderr);
+		i_unreached();
+	}
+
+	/* parent */
+	if ( close(fd_in[0]) < 0 )
+		i_error("close(pipe:in:rd) failed: %m");
+	if ( close(fd_out[1]) < 0 )
+		i_error("close(pipe:out:wr) failed: %m");
+
+	/* Other programs must not keep the worker's input open */
+	fd_close_on_exec(fd_in[1], TRUE);
+	fd_close_on_exec(fd_out[0], TRUE);
+	net_set_nonblock(fd_in[1], TRUE);
+	net_set_nonblock(fd_out[0], TRUE);
+
+	worker = i_new(struct program_client_worker, 1);
+	worker->path = i_strdup(pclient->path);
+	worker->uid = pclient->set.uid;
+	worker->gid = pclient->set.gid;
+	worker->pid = pid;
+	worker->fd_in = fd_out[0];
+	worker->fd_out = fd_in[1];
+
+	if ( pclient->debug ) {
+		i_debug("started worker for program `%s' (pid=%s)",
+			pclient->path, dec2str(pid));
+	}
+	return worker;
+}
+
+static struct program_client_worker *
+program_client_worker_get(struct program_client *pclient)
+{
+	struct program_client_worker *const *workers, *worker;
+	unsigned int count, i;
+
+	program_client_worker_expire();
+
+	if ( !array_is_created(&program_client_workers) )
+		return program_client_worker_spawn(pclient);
+
+	workers = array_get(&program_client_workers, &count);
+	for ( i = count; i > 0; i-- ) {
+		worker = workers[i-1];
+
+		if ( strcmp(worker->path, pclient->path) != 0 ||
+			worker->uid != pclient->set.uid || worker->gid != pclient->set.gid )
+			continue;
+
+		array_delete(&program_client_workers, i-1, 1);
+		return worker;
+	}
+
+	return program_client_worker_spawn(pclient);
+}
+
+static void program_client_worker_put
+(struct program_client *pclient, struct program_client_worker *worker)
+{
+	struct program_client_worker *oldest;
+
+	program_client_worker_expire();
+
+	if ( pclient->set.worker_max_requests > 0 &&
+		worker->requests >= pclient->set.worker_max_requests ) {
+		if ( pclient->debug ) {
+			i_debug("replacing worker for program `%s' after %u requests",
+				worker->path, worker->requests);
+		}
+		program_client_worker_destroy(&worker, FALSE);
+		return;
+	}
+
+	if ( !array_is_created(&program_client_workers) )
+		i_array_init(&program_client_workers, 8);
+
+	worker->idle_stamp = ioloop_time;
+	while ( array_count(&program_client_workers) > 0 &&
+		array_count(&program_client_workers) >= pclient->set.workers ) {
+		oldest = *array_idx(&program_client_workers, 0);
+		array_delete(&program_client_workers, 0, 1);
+		program_client_worker_destroy(&oldest, FALSE);
+	}
+
+	array_append(&program_client_workers, &worker, 1);
+}
+
+/*
+ * Worker streams
+ */
+
+/* Request input */
+
+struct program_client_worker_request_istream {
+	struct istream_private istream;
+
+	buffer_t *buf;
+	unsigned int request;
+	bool finished;
+};
+
+static void program_client_worker_request_destroy
+(struct iostream_private *stream)
+{
+	struct program_client_worker_request_istream *wstream =
+		(struct program_client_worker_request_istream *)stream;
+
+	buffer_free(&wstream->buf);
+	if ( wstream->istream.parent != NULL )
+		i_stream_unref(&wstream->istream.parent);
+}
+
+static ssize_t program_client_worker_request_read
+(struct istream_private *stream)
+{
+	struct program_client_worker_request_istream *wstream =
+		(struct program_client_worker_request_istream *)stream;
+	const unsigned char *data;
+	const char *header;
+	size_t size, old_size;
+	int ret;
+
+	if ( stream->skip > 0 ) {
+		buffer_delete(wstream->buf, 0, stream->skip);
+		stream->pos -= stream->skip;
+		stream->skip = 0;
+	}
+	stream->buffer = wstream->buf->data;
+	old_size = stream->pos;
+
+	if ( wstream->finished ) {
+		stream->istream.eof = TRUE;
+		return -1;
+	}
+	if ( old_size >= stream->max_buffer_size )
+		return -2;
+
+	if ( stream->parent == NULL )
+		ret = -1;
+	else
+		ret = i_stream_read_data(stream->parent, &data, &size, 0);
+
+	if ( ret == 0 )
+		return 0;
+	if ( ret > 0 ) {
+		/* Pass on the available data as one chunk */
+		header = t_strdup_printf("%llu\n", (unsigned long long)size);
+		buffer_append(wstream->buf, header, strlen(header));
+		buffer_append(wstream->buf, data, size);
+		i_stream_skip(stream->parent, size);
+	} else if ( stream->parent != NULL &&
+		stream->parent->stream_errno != 0 ) {
+		stream->istream.stream_errno = stream->parent->stream_errno;
+		return -1;
+	} else {
+		/* End of input, followed by the request number the worker
+		   acknowledges once it has read the whole request */
+		header = t_strdup_printf("0\n%u\n", wstream->request);
+		buffer_append(wstream->buf, header, strlen(header));
+		wstream->finished = TRUE;
+	}
+
+	stream->buffer = wstream->buf->data;
+	stream->pos = wstream->buf->used;
+	return (ssize_t)(stream->pos - old_size);
+}
+
+static struct istream *
+program_client_worker_request_create(struct istream *input,
+	unsigned int request)
+{
+	struct program_client_worker_request_istream *wstream;
+
+	wstream = i_new(struct program_client_worker_request_istream, 1);
+	wstream->request = request;
+	wstream->buf = buffer_create_dynamic
+		(default_pool, PROGRAM_CLIENT_WORKER_BUFFER_SIZE);
+
+	wstream->istream.max_buffer_size = ( input == NULL ?
+		PROGRAM_CLIENT_WORKER_BUFFER_SIZE : input->real_stream->max_buffer_size );
+	wstream->istream.iostream.destroy = program_client_worker_request_destroy;
+	wstream->istream.read = program_client_worker_request_read;
+
+	wstream->istream.istream.readable_fd = FALSE;
+	wstream->istream.istream.blocking =
+		( input == NULL ? TRUE : input->blocking );
+	wstream->istream.istream.seekable = FALSE;
+
+	return i_stream_create(&wstream->istream, input, -1);
+}
+
+/* Response output */
+
+enum program_client_worker_response_state {
+	WORKER_RESPONSE_CHUNK_SIZE = 0,
+	WORKER_RESPONSE_CHUNK_DATA,
+	WORKER_RESPONSE_EXIT_CODE,
+	WORKER_RESPONSE_REQUEST,
+	WORKER_RESPONSE_DONE
+};
+
+struct program_client_worker_response_istream {
+	struct istream_private istream;
+
+	struct program_client_local *client;
+	buffer_t *buf;
+
+	enum program_client_worker_response_state state;
+	uoff_t chunk_left;
+};
+
+static void program_client_worker_response_destroy
+(struct iostream_private *stream)
+{
+	struct program_client_worker_response_istream *wstream =
+		(struct program_client_worker_response_istream *)stream;
+
+	buffer_free(&wstream->buf);
+	i_stream_unref(&wstream->istream.parent);
+}
+
+static int program_client_worker_response_read_line
+(struct istream_private *stream, const char **line_r)
+{
+	const unsigned char *data, *p;
+	size_t size;
+	ssize_t ret;
+
+	for (;;) {
+		data = i_stream_get_data(stream->parent, &size);
+		if ( (p=memchr(data, '\n', size)) != NULL )
+			break;
+		if ( (ret=i_stream_read(stream->parent)) <= 0 )
+			return ( ret == -2 ? -1 : (int)ret );
+	}
+
+	*line_r = t_strdup_until(data, p);
+	i_stream_skip(stream->parent, p - data + 1);
+	return 1;
+}
+
+static ssize_t program_client_worker_response_read
+(struct istream_private *stream)
+{
+	struct program_client_worker_response_istream *wstream =
+		(struct program_client_worker_response_istream *)stream;
+	struct program_client_local *slclient = wstream->client;
+	const unsigned char *data;
+	const char *line;
+	size_t size, old_size;
+	ssize_t ret;
+	unsigned int request;
+	int status;
+
+	if ( stream->skip > 0 ) {
+		buffer_delete(wstream->buf, 0, stream->skip);
+		stream->pos -= stream->skip;
+		stream->skip = 0;
+	}
+	stream->buffer = wstream->buf->data;
+	old_size = stream->pos;
+
+	for (;;) {
+		switch ( wstream->state ) {
+		case WORKER_RESPONSE_CHUNK_SIZE:
+		case WORKER_RESPONSE_EXIT_CODE:
+		case WORKER_RESPONSE_REQUEST:
+			if ( (ret=program_client_worker_response_read_line
+				(stream, &line)) == 0 )
+				return 0;
+			if ( ret < 0 )
+				break;
+
+			if ( wstream->state == WORKER_RESPONSE_REQUEST ) {
+				/* The worker acknowledges that it read the whole request; an
+				   early response would leave part of it in the pipe */
+				if ( str_to_uint(line, &request) < 0 ||
+					request != slclient->worker_request )
+					break;
+				slclient->worker_done = TRUE;
+
+				/* The request must have been sent completely and nothing may
+				   follow the response */
+				(void)i_stream_get_data(stream->parent, &size);
+				if ( size > 0 || slclient->client.input != NULL ||
+					(slclient->client.program_output != NULL &&
+						o_stream_get_buffer_used_size
+							(slclient->client.program_output) > 0) )
+					slclient->worker_unclean = TRUE;
+				wstream->state = WORKER_RESPONSE_DONE;
+			} else if ( wstream->state == WORKER_RESPONSE_EXIT_CODE ) {
+				if ( str_to_int(line, &status) < 0 )
+					break;
+				slclient->worker_status = status;
+				wstream->state = WORKER_RESPONSE_REQUEST;
+			} else {
+				if ( str_to_uoff(line, &wstream->chunk_left) < 0 )
+					break;
+				wstream->state = ( wstream->chunk_left == 0 ?
+					WORKER_RESPONSE_EXIT_CODE : WORKER_RESPONSE_CHUNK_DATA );
+			}
+			continue;
+		case WORKER_RESPONSE_CHUNK_DATA:
+			if ( old_size >= stream->max_buffer_size )
+				return -2;
+
+			data = i_stream_get_data(stream->parent, &size);
+			if ( size == 0 ) {
+				if ( (ret=i_stream_read(stream->parent)) == 0 )
+					return 0;
+				if ( ret < 0 )
+					break;
+				continue;
+			}
+
+			if ( size > wstream->chunk_left )
+				size = (size_t)wstream->chunk_left;
+			if ( size > stream->max_buffer_size - old_size )
+				size = stream->max_buffer_size - old_size;
+			buffer_append(wstream->buf, data, size);
+			i_stream_skip(stream->parent, size);
+
+			wstream->chunk_left -= size;
+			if ( wstream->chunk_left == 0 )
+				wstream->state = WORKER_RESPONSE_CHUNK_SIZE;
+
+			stream->buffer = wstream->buf->data;
+			stream->pos = wstream->buf->used;
+			return (ssize_t)size;
+		case WORKER_RESPONSE_DONE:
+			stream->istream.eof = TRUE;
+			return -1;
+		}
+		break;
+	}
+
+	/* Read error, premature end of output or invalid response */
+	if ( stream->parent->stream_errno != 0 ) {
+		stream->istream.stream_errno = stream->parent->stream_errno;
+	} else {
+		i_error("program `%s' worker returned an invalid response",
+			slclient->client.path);
+		stream->istream.stream_errno = EINVAL;
+	}
+	return -1;
+}
+
+static struct istream *program_client_worker_response_create
+(struct program_client_local *slclient, struct istream *input)
+{
+	struct program_client_worker_response_istream *wstream;
+
+	wstream = i_new(struct program_client_worker_response_istream, 1);
+	wstream->client = slclient;
+	wstream->buf = buffer_create_dynamic
+		(default_pool, PROGRAM_CLIENT_WORKER_BUFFER_SIZE);
+
+	wstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	wstream->istream.iostream.destroy = program_client_worker_response_destroy;
+	wstream->istream.read = program_client_worker_response_read;
+
+	wstream->istream.istream.readable_fd = FALSE;
+	wstream->istream.istream.blocking = input->blocking;
+	wstream->istream.istream.seekable = FALSE;
+
+	return i_stream_create(&wstream->istream, input, -1);
+}
+
+/*
+ * Latency statistics
+ */
+
+#define PROGRAM_CLIENT_LOCAL_STATS_SAMPLES 100
+
+struct program_client_local_stats {
+	char *path;
+
+	ARRAY(unsigned int) msecs;
+	unsigned int worker_requests;
+};
+
+static ARRAY(struct program_client_local_stats *) program_client_local_stats;
+
+static int program_client_local_stats_cmp
+(const unsigned int *msecs1, const unsigned int *msecs2)
+{
+	if ( *msecs1 < *msecs2 )
+		return -1;
+	if ( *msecs1 > *msecs2 )
+		return 1;
+	return 0;
+}
+
+static unsigned int program_client_local_stats_percentile
+(const unsigned int *msecs, unsigned int count, unsigned int percent)
+{
+	unsigned int idx = (count * percent) / 100;
+
+	return msecs[( idx < count ? idx : count - 1 )];
+}
+
+static void program_client_local_stats_add
+(struct program_client *pclient, bool worker)
+{
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
+	struct program_client_local_stats *const *statsp, *stats = NULL;
+	const unsigned int *msecs;
+	struct timeval end_time;
+	unsigned int count, value;
+	int diff;
+
+	if ( !array_is_created(&program_client_local_stats) )
+		i_array_init(&program_client_local_stats, 8);
+
+	array_foreach(&program_client_local_stats, statsp) {
+		if ( strcmp((*statsp)->path, pclient->path) == 0 ) {
+			stats = *statsp;
+			break;
+		}
+	}
+	if ( stats == NULL ) {
+		stats = i_new(struct program_client_local_stats, 1);
+		stats->path = i_strdup(pclient->path);
+		i_array_init(&stats->msecs, PROGRAM_CLIENT_LOCAL_STATS_SAMPLES);
+		array_append(&program_client_local_stats, &stats, 1);
+	}
+
+	if ( gettimeofday(&end_time, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+	diff = timeval_diff_msecs(&end_time, &slclient->start_time);
+	value = ( diff < 0 ? 0 : (unsigned int)diff );
+	array_append(&stats->msecs, &value, 1);
+	if ( worker )
+		stats->worker_requests++;
+
+	if ( array_count(&stats->msecs) < PROGRAM_CLIENT_LOCAL_STATS_SAMPLES )
+		return;
+
+	/* Report and start over */
+	if ( pclient->debug ) {
+		array_sort(&stats->msecs, program_client_local_stats_cmp);
+		msecs = array_get(&stats->msecs, &count);
+		i_debug("program `%s': latency of last %u runs (%u by workers): "
+			"50%%=%u ms, 90%%=%u ms, 99%%=%u ms, max=%u ms",
+			pclient->path, count, stats->worker_requests,
+			program_client_local_stats_percentile(msecs, count, 50),
+			program_client_local_stats_percentile(msecs, count, 90),
+			program_client_local_stats_percentile(msecs, count, 99),
+			msecs[count-1]);
+	}
+	array_clear(&stats->msecs);
+	stats->worker_requests = 0;
+}
+
+/*
+ * Program client
+ */
+
+static struct istream *program_client_local_wrap_program_input
+(struct program_client *pclient, struct istream *input)
+{
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
+
+	if ( slclient->worker == NULL ) {
+		i_stream_ref(input);
+		return input;
+	}
+	return program_client_worker_response_create(slclient, input);
+}
+
+static void program_client_worker_append_items
+(string_t *str, const char *const *items, unsigned int count)
+{
+	unsigned int i;
+
+	str_printfa(str, "%u\n", count);
+	for ( i = 0; i < count; i++ ) {
+		str_printfa(str, "%llu\n", (unsigned long long)strlen(items[i]));
+		str_append(str, items[i]);
+	}
+}
+
+static int program_client_local_worker_connect
+(struct program_client *pclient)
+{
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
+	struct program_client_worker *worker = slclient->worker;
+	const char *const *envs = NULL;
+	struct istream *input;
+	unsigned int count = 0;
+	string_t *str;
+
+	slclient->worker_request = worker->requests + 1;
+	slclient->worker_done = FALSE;
+	slclient->worker_unclean = FALSE;
+	slclient->worker_reuse = FALSE;
+
+	pclient->fd_in = worker->fd_in;
+	pclient->fd_out = worker->fd_out;
+
+	/* The input is sent in chunks after the arguments and environment */
+	input = program_client_worker_request_create
+		(pclient->input, slclient->worker_request);
+	program_client_set_input(pclient, input);
+	i_stream_unref(&input);
+
+	program_client_init_streams(pclient);
+
+	str = t_str_new(1024);
+	program_client_worker_append_items(str, pclient->args,
+		( pclient->args == NULL ? 0 : str_array_length(pclient->args) ));
+	if ( array_is_created(&pclient->envs) )
+		envs = array_get(&pclient->envs, &count);
+	program_client_worker_append_items(str, envs, count);
+
+	if ( o_stream_send
+		(pclient->program_output, str_data(str), str_len(str)) < 0 )
+		return -1;
+
+	return program_client_connected(pclient);
+}
+
 static int program_client_local_connect
 (struct program_client *pclient)
 {
@@ -129,6 +859,17 @@ static int program_client_local_connect
 	int *parent_extra_fds = NULL, *child_extra_fds = NULL;
 	unsigned int xfd_count = 0, i;
 
+	if ( gettimeofday(&slclient->start_time, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+
+	/* Use a running instance of the program if possible; fork and execute it
+	   otherwise */
+	if ( pclient->set.workers > 0 &&
+		(!array_is_created(&pclient->extra_fds) ||
+			array_count(&pclient->extra_fds) == 0) &&
+		(slclient->worker=program_client_worker_get(pclient)) != NULL )
+		return program_client_local_worker_connect(pclient);
+
 	/* create normal I/O fds */
 	if ( pclient->input != NULL ) {
 		if ( pipe(fd_in) < 0 ) {
@@ -210,39 +951,7 @@ static int program_client_local_connect
 			}
 		}
 
-		/* drop privileges if we have any */
-		if ( getuid() == 0 ) {
-			uid_t uid;
-			gid_t gid;
-
-			/* switch back to root */
-			if (seteuid(0) < 0)
-				i_fatal("seteuid(0) failed: %m");
-
-			/* drop gids first */
-			gid = getgid();
-			if ( gid == 0 || gid != pclient->set.gid ) {
-				if ( pclient->set.gid != 0 )
-					gid = pclient->set.gid;
-				else
-					gid = getegid();
-			}
-	    if ( setgroups(1, &gid) < 0 )
-				i_fatal("setgroups(%d) failed: %m", gid);
-			if ( gid != 0 && setgid(gid) < 0 )
-				i_fatal("setgid(%d) failed: %m", gid);
-		
-			/* drop uid */
-			if ( pclient->set.uid != 0 )
-				uid = pclient->set.uid;
-			else
-				uid = geteuid();
-			if ( uid != 0 && setuid(uid) < 0 )
-				i_fatal("setuid(%d) failed: %m", uid);
-		}
-
-		i_assert(pclient->set.uid == 0 || getuid() != 0);
-		i_assert(pclient->set.gid == 0 || getgid() != 0);
+		drop_privileges(&pclient->set);
 
 		if ( array_is_created(&pclient->envs) )
 			envs = array_get(&pclient->envs, &count);
@@ -281,10 +990,16 @@ static int program_client_local_connect
 
 static int program_client_local_close_output(struct program_client *pclient)
 {
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
 	int fd_out = pclient->fd_out;
 
 	pclient->fd_out = -1;
 
+	/* The worker reads the end of the request from the input itself */
+	if ( slclient->worker != NULL )
+		return 1;
+
 	/* Shutdown output; program stdin will get EOF */
 	if ( fd_out >= 0 && close(fd_out) < 0 ) {
 		i_error("close(%s) failed: %m", pclient->path);
@@ -293,7 +1008,63 @@ static int program_client_local_close_output(struct program_client *pclient)
 	return 1;
 }
 
-static int program_client_local_disconnect
+static int program_client_local_worker_disconnect
+(struct program_client *pclient, bool force)
+{
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
+	struct program_client_worker *worker = slclient->worker;
+
+	worker->requests++;
+
+	/* The file descriptors belong to the worker. It is only released in
+	   program_client_local_post_disconnect(), once the streams and the io on
+	   these descriptors are gone. */
+	pclient->fd_in = pclient->fd_out = -1;
+
+	if ( force || pclient->error != PROGRAM_CLIENT_ERROR_NONE ||
+		!slclient->worker_done || slclient->worker_unclean ) {
+		if ( !force && pclient->error == PROGRAM_CLIENT_ERROR_NONE &&
+			slclient->worker_done ) {
+			i_error("program `%s' worker did not follow the protocol",
+				pclient->path);
+		}
+
+		/* Its state is unknown; don't use it again */
+		return -1;
+	}
+
+	slclient->worker_reuse = TRUE;
+
+	if ( slclient->worker_status != 0 ) {
+		i_info("program `%s' terminated with non-zero exit code %d",
+			pclient->path, slclient->worker_status);
+		pclient->exit_code = 0;
+		return 0;
+	}
+
+	pclient->exit_code = 1;
+	return 1;
+}
+
+static void program_client_local_post_disconnect
+(struct program_client *pclient)
+{
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
+	struct program_client_worker *worker = slclient->worker;
+
+	if ( worker == NULL )
+		return;
+	slclient->worker = NULL;
+
+	if ( slclient->worker_reuse )
+		program_client_worker_put(pclient, worker);
+	else
+		program_client_worker_destroy(&worker, TRUE);
+}
+
+static int program_client_local_wait
 (struct program_client *pclient, bool force)
 {
 	struct program_client_local *slclient = 
@@ -301,12 +1072,6 @@ static int program_client_local_disconnect
 	pid_t pid = slclient->pid, ret;
 	time_t runtime, timeout = 0;
 	int status;
-	
-	if ( pid < 0 ) {
-		/* program never started */
-		pclient->exit_code = 0;
-		return 0;
-	}
 
 	slclient->pid = -1;
 
@@ -426,6 +1191,27 @@ static int program_client_local_disconnect
 	return -1;
 }
 
+static int program_client_local_disconnect
+(struct program_client *pclient, bool force)
+{
+	struct program_client_local *slclient =
+		(struct program_client_local *) pclient;
+	int ret;
+
+	if ( slclient->worker != NULL ) {
+		ret = program_client_local_worker_disconnect(pclient, force);
+		program_client_local_stats_add(pclient, TRUE);
+	} else if ( slclient->pid >= 0 ) {
+		ret = program_client_local_wait(pclient, force);
+		program_client_local_stats_add(pclient, FALSE);
+	} else {
+		/* program never started */
+		pclient->exit_code = 0;
+		ret = 0;
+	}
+	return ret;
+}
+
 static void program_client_local_failure
 (struct program_client *pclient, enum program_client_error error)
 {
@@ -452,9 +1238,55 @@ struct program_client *program_client_local_create
 	pclient->client.connect = program_client_local_connect;
 	pclient->client.close_output = program_client_local_close_output;
 	pclient->client.disconnect = program_client_local_disconnect;
+	pclient->client.post_disconnect = program_client_local_post_disconnect;
+	pclient->client.wrap_program_input =
+		program_client_local_wrap_program_input;
 	pclient->client.failure = program_client_local_failure;
 	pclient->pid = -1;
 
 	return &pclient->client;
 }
 
+
+void program_client_workers_deinit(void)
+{
+	struct program_client_worker *const *workerp, *worker;
+	struct program_client_local_stats *const *statsp, *stats;
+	const pid_t *pidp;
+	int status;
+
+	if ( array_is_created(&program_client_workers) ) {
+		array_foreach(&program_client_workers, workerp) {
+			worker = *workerp;
+			program_client_worker_destroy(&worker, FALSE);
+		}
+		array_free(&program_client_workers);
+	}
+
+	/* Give stopped workers a moment to finish before killing them */
+	if ( array_is_created(&program_client_worker_pids) ) {
+		alarm(5);
+		array_foreach(&program_client_worker_pids, pidp) {
+			if ( waitpid(*pidp, &status, 0) < 0 && errno == EINTR )
+				break;
+		}
+		alarm(0);
+		array_foreach(&program_client_worker_pids, pidp) {
+			if ( waitpid(*pidp, &status, WNOHANG) == 0 ) {
+				(void)kill(*pidp, SIGKILL);
+				(void)waitpid(*pidp, &status, 0);
+			}
+		}
+		array_free(&program_client_worker_pids);
+	}
+
+	if ( array_is_created(&program_client_local_stats) ) {
+		array_foreach(&program_client_local_stats, statsp) {
+			stats = *statsp;
+			array_free(&stats->msecs);
+			i_free(stats->path);
+			i_free(stats);
+		}
+		array_free(&program_client_local_stats);
+	}
+}
@@ -51,6 +51,10 @@ struct program_client {
 	int (*connect)(struct program_client *pclient);
 	int (*close_output)(struct program_client *pclient);
 	int (*disconnect)(struct program_client *pclient, bool force);
+	/* Called once the streams and the io are gone (optional) */
+	void (*post_disconnect)(struct program_client *pclient);
+	struct istream *(*wrap_program_input)
+		(struct program_client *pclient, struct istream *input);
 	void (*failure)
 		(struct program_client *pclient, enum program_client_error error);
 	
@@ -16,6 +16,9 @@
 #include <sys/wait.h>
 #include <sysexits.h>
 
+/* Delay before connecting again when the service's listen queue is full */
+#define PROGRAM_CLIENT_REMOTE_RETRY_MSECS 1
+
 /*
  * Script client input stream
  */
@@ -171,17 +174,20 @@ static struct istream *program_client_istream_create
 struct program_client_remote {
 	struct program_client client;
 
+	struct timeout *to_retry;
+
 	unsigned int noreply:1;
 };
 
-static void program_client_remote_connected(struct program_client *pclient)
+static int program_client_remote_connect(struct program_client *pclient);
+
+static int program_client_remote_handshake(struct program_client *pclient)
 {
 	struct program_client_remote *slclient =
 		(struct program_client_remote *)pclient;
 	const char **args = pclient->args;
 	string_t *str;
 
-	io_remove(&pclient->io);
 	program_client_init_streams(pclient);
 
 	if ( !slclient->noreply ) {
@@ -204,12 +210,20 @@ static void program_client_remote_connected(struct program_client *pclient)
 	str_append_c(str, '\n');
 
 	if ( o_stream_send
-		(pclient->program_output, str_data(str), str_len(str)) < 0 ) {
-		program_client_fail(pclient, PROGRAM_CLIENT_ERROR_IO);
-		return;
-	}
+		(pclient->program_output, str_data(str), str_len(str)) < 0 )
+		return -1;
+
+	return program_client_connected(pclient);
+}
+
+static void program_client_remote_retry(struct program_client *pclient)
+{
+	struct program_client_remote *slclient =
+		(struct program_client_remote *)pclient;
 
-	(void)program_client_connected(pclient);
+	timeout_remove(&slclient->to_retry);
+	if ( program_client_remote_connect(pclient) < 0 )
+		program_client_fail(pclient, PROGRAM_CLIENT_ERROR_IO);
 }
 
 static int program_client_remote_connect(struct program_client *pclient)
@@ -221,8 +235,16 @@ static int program_client_remote_connect(struct program_client *pclient)
 	if ((fd = net_connect_unix(pclient->path)) < 0) {
 		switch (errno) {
 		case EAGAIN:
+			/* Listen queue is full; try again until the connect timeout
+			   expires */
+			if ( pclient->to != NULL ) {
+				slclient->to_retry = timeout_add_short
+					(PROGRAM_CLIENT_REMOTE_RETRY_MSECS,
+						program_client_remote_retry, pclient);
+				return 0;
+			}
+			return -1;
 		case ECONNREFUSED:
-			// FIXME: retry;
 			return -1;
 		case EACCES:
 			i_error("%s", eacces_error_get("net_connect_unix", pclient->path));
@@ -238,8 +260,11 @@ static int program_client_remote_connect(struct program_client *pclient)
 	pclient->fd_in = ( slclient->noreply && pclient->output == NULL &&
 		!pclient->output_seekable ? -1 : fd );
 	pclient->fd_out = fd;
-	pclient->io = io_add(fd, IO_WRITE, program_client_remote_connected, pclient);
-	return 0;
+
+	/* Connecting to a unix socket completes immediately, so the request can
+	   be sent right away rather than after waiting for the socket to become
+	   writable */
+	return program_client_remote_handshake(pclient);
 }
 
 static int program_client_remote_close_output(struct program_client *pclient)
@@ -270,6 +295,9 @@ static int program_client_remote_disconnect
 	struct program_client_remote *slclient =
 		(struct program_client_remote *)pclient;
 	int ret = 0;
+
+	if ( slclient->to_retry != NULL )
+		timeout_remove(&slclient->to_retry);
 	
 	if ( pclient->error == PROGRAM_CLIENT_ERROR_NONE && !slclient->noreply &&
 		pclient->program_input != NULL && !force) {
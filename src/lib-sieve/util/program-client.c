@@ -115,6 +115,9 @@ static void program_client_disconnect
 		&& close(pclient->fd_out) < 0)
 		i_error("close(%s/out) failed: %m", pclient->path);
 	pclient->fd_in = pclient->fd_out = -1;
+
+	if ( pclient->post_disconnect != NULL )
+		pclient->post_disconnect(pclient);
 	
 	pclient->disconnected = TRUE;
 	if (error && pclient->error == PROGRAM_CLIENT_ERROR_NONE ) {
@@ -430,6 +433,13 @@ void program_client_init_streams(struct program_client *pclient)
 		
 		input = i_stream_create_fd(pclient->fd_in, (size_t)-1, FALSE);
 
+		if (pclient->wrap_program_input != NULL) {
+			struct istream *input2 = input;
+
+			input = pclient->wrap_program_input(pclient, input2);
+			i_stream_unref(&input2);
+		}
+
 		if (pclient->output_seekable) {
 			struct istream *input2 = input, *input_list[2];
 	
@@ -13,6 +13,12 @@ struct program_client_settings {
 	uid_t uid;
 	gid_t gid;
 
+	/* Local programs only: maximum number of long-running program instances
+	   kept for subsequent requests (0 disables this) and the number of
+	   requests after which an instance is replaced */
+	unsigned int workers;
+	unsigned int worker_max_requests;
+
 	unsigned int debug:1;
 	unsigned int drop_stderr:1;
 };
@@ -54,5 +60,9 @@ void program_client_set_env
 
 int program_client_run(struct program_client *pclient);
 
+/* Stops the workers kept idle by local program clients and frees their
+   latency statistics */
+void program_client_workers_deinit(void);
+
 #endif
 
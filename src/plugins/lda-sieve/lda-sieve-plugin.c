@@ -901,7 +901,8 @@ static int lda_sieve_deliver_mail
 	svenv.hostname = mdctx->set->hostname;
 	svenv.base_dir = mdctx->dest_user->set->base_dir;
 	svenv.temp_dir = mdctx->dest_user->set->mail_temp_dir;
-	svenv.flags = SIEVE_FLAG_HOME_RELATIVE;
+	svenv.flags = SIEVE_FLAG_HOME_RELATIVE | SIEVE_FLAG_BINARY_CACHE |
+		SIEVE_FLAG_REGEX_CACHE;
 	svenv.location = SIEVE_ENV_LOCATION_MDA;
 	svenv.delivery_phase = SIEVE_DELIVERY_PHASE_DURING;
 
@@ -933,6 +934,27 @@ static int lda_sieve_deliver_mail
 		}
 	} T_END;
 
+	if ( debug ) {
+		struct sieve_binary_cache_stats cstats;
+		struct sieve_regex_cache_stats rstats;
+		struct sieve_storage_cache_stats sstats;
+
+		sieve_binary_cache_get_stats(&cstats);
+		sieve_sys_debug(srctx.svinst, "Binary cache: %u entries, "
+			"%u hits, %u misses, %u evictions", cstats.entries,
+			cstats.hits, cstats.misses, cstats.evictions);
+
+		sieve_regex_cache_get_stats(&rstats);
+		sieve_sys_debug(srctx.svinst, "Regex cache: %u entries, "
+			"%u hits, %u misses, %u evictions", rstats.entries,
+			rstats.hits, rstats.misses, rstats.evictions);
+
+		sieve_storage_cache_get_stats(&sstats);
+		sieve_sys_debug(srctx.svinst, "Storage lookup cache: %u entries, "
+			"%u hits, %u misses, %u evictions", sstats.entries,
+			sstats.hits, sstats.misses, sstats.evictions);
+	}
+
 	/* Clean up */
 
 	if ( srctx.user_ehandler != NULL )
@@ -960,4 +982,11 @@ void sieve_plugin_deinit(void)
 {
 	/* Remove hook */
 	mail_deliver_hook_set(next_deliver_mail);
+
+	/* Free the process-wide caches and stop the program workers */
+	sieve_binary_cache_deinit();
+	sieve_regex_cache_deinit();
+	sieve_storage_cache_deinit();
+	sieve_include_validation_cache_deinit();
+	sieve_program_workers_deinit();
 }
@@ -49,6 +49,7 @@
 #define SIEVE_EXTPROGRAMS_MAX_PROGRAM_ARG_LEN  1024
 
 #define SIEVE_EXTPROGRAMS_DEFAULT_EXEC_TIMEOUT_SECS 10
+#define SIEVE_EXTPROGRAMS_DEFAULT_WORKER_MAX_REQUESTS 100
 #define SIEVE_EXTPROGRAMS_CONNECT_TIMEOUT_MSECS 5
 
 /*
@@ -63,6 +64,7 @@ struct sieve_extprograms_config *sieve_extprograms_config_init
 	const char *extname = sieve_extension_name(ext);
 	const char *bin_dir, *socket_dir, *input_eol;
 	sieve_number_t execute_timeout;
+	unsigned long long int uint_setting;
 
 	extname = strrchr(extname, '.');
 	i_assert(extname != NULL);
@@ -78,6 +80,8 @@ struct sieve_extprograms_config *sieve_extprograms_config_init
 	ext_config = i_new(struct sieve_extprograms_config, 1);
 	ext_config->execute_timeout = 
 		SIEVE_EXTPROGRAMS_DEFAULT_EXEC_TIMEOUT_SECS;
+	ext_config->bin_worker_max_requests =
+		SIEVE_EXTPROGRAMS_DEFAULT_WORKER_MAX_REQUESTS;
 
 	if ( bin_dir == NULL && socket_dir == NULL ) {
 		if ( svinst->debug ) {
@@ -99,6 +103,17 @@ struct sieve_extprograms_config *sieve_extprograms_config_init
 		ext_config->default_input_eol = SIEVE_EXTPROGRAMS_EOL_CRLF;
 		if (input_eol != NULL && strcasecmp(input_eol, "lf") == 0)
 			ext_config->default_input_eol = SIEVE_EXTPROGRAMS_EOL_LF;
+
+		if (sieve_setting_get_uint_value
+			(svinst, t_strdup_printf("sieve_%s_bin_workers", extname),
+				&uint_setting)) {
+			ext_config->bin_workers = (unsigned int)uint_setting;
+		}
+		if (sieve_setting_get_uint_value
+			(svinst, t_strdup_printf("sieve_%s_bin_worker_max_requests", extname),
+				&uint_setting)) {
+			ext_config->bin_worker_max_requests = (unsigned int)uint_setting;
+		}
 	}
 
 	if ( sieve_extension_is(ext, vnd_pipe_extension) ) 
@@ -533,6 +548,8 @@ struct sieve_extprogram *sieve_extprogram_create
 	sprog->set.debug = svinst->debug;
 
 	if ( fork ) {
+		sprog->set.workers = ext_config->bin_workers;
+		sprog->set.worker_max_requests = ext_config->bin_worker_max_requests;
 		sprog->program_client =
 			program_client_local_create(path, args, &sprog->set);
 	} else {
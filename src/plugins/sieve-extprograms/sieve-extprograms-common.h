@@ -25,6 +25,9 @@ struct sieve_extprograms_config {
 	enum sieve_extprograms_eol default_input_eol;
 
 	unsigned int execute_timeout;
+
+	unsigned int bin_workers;
+	unsigned int bin_worker_max_requests;
 };
 
 struct sieve_extprograms_config *sieve_extprograms_config_init
@@ -6,12 +6,15 @@
 #include "ioloop.h"
 #include "env-util.h"
 #include "str.h"
+#include "strnum.h"
 #include "str-sanitize.h"
 #include "ostream.h"
 #include "array.h"
 #include "mail-namespace.h"
 #include "mail-storage.h"
 #include "mail-search-build.h"
+#include "seq-range-array.h"
+#include "time-util.h"
 #include "imap-utf7.h"
 
 #include "sieve.h"
@@ -25,6 +28,7 @@
 #include <fcntl.h>
 #include <pwd.h>
 #include <sysexits.h>
+#include <sys/time.h>
 
 /*
  * Print help
@@ -33,9 +37,11 @@
 static void print_help(void)
 {
 	printf(
-"Usage: sieve-filter [-c <config-file>] [-C] [-D] [-e] [-m <default-mailbox>]\n"
-"                    [-P <plugin>] [-q <output-mailbox>] [-Q <mail-command>]\n"
-"                    [-s <script-file>] [-u <user>] [-v] [-W] [-x <extensions>]\n"
+"Usage: sieve-filter [-b <batch-size>] [-c <config-file>] [-C] [-D] [-e]\n"
+"                    [-m <default-mailbox>] [-P <plugin>] [-q <output-mailbox>]\n"
+"                    [-Q <mail-command>] [-s <script-file>] [-t <trace-file>]\n"
+"                    [-T <trace-option>] [-u <user>] [-v] [-W]\n"
+"                    [-x <extensions>]\n"
 "                    <script-file> <source-mailbox> [<discard-action>]\n"
 	);
 }
@@ -55,6 +61,9 @@ struct sieve_filter_data {
 	struct sieve_binary *main_sbin;
 	struct sieve_error_handler *ehandler;
 
+	/* Number of messages filtered per transaction (0 = all at once) */
+	unsigned int batch_size;
+
 	unsigned int execute:1;
 	unsigned int source_write:1;
 	unsigned int default_move:1;
@@ -66,6 +75,17 @@ struct sieve_filter_context {
 	struct mailbox_transaction_context *move_trans;
 
 	struct ostream *teststream;
+
+	/* Progress */
+	uint32_t last_uid;
+	unsigned int messages;
+	struct timeval start_time;
+};
+
+/* Header fields read for each message; prefetched during the search */
+static const char *const filter_wanted_headers[] = {
+	"Date", "Envelope-To", "From", "Message-ID", "Return-Path", "Sender",
+	"Subject", "To", NULL
 };
 
 static int filter_message
@@ -263,54 +283,87 @@ static void mail_search_build_add_flags
 	args->args = arg;
 }
 
-static int filter_mailbox
-(const struct sieve_filter_data *sfdata, struct mailbox *src_box)
+static void mail_search_build_add_uid_range
+(struct mail_search_args *args, uint32_t uid1, uint32_t uid2)
 {
-	struct sieve_filter_context sfctx;
+	struct mail_search_arg *arg;
+
+	arg = p_new(args->pool, struct mail_search_arg, 1);
+	arg->type = SEARCH_UIDSET;
+	p_array_init(&arg->value.seqset, args->pool, 1);
+	seq_range_array_add_range(&arg->value.seqset, uid1, uid2);
+
+	arg->next = args->args;
+	args->args = arg;
+}
+
+static void filter_mailbox_progress
+(struct sieve_filter_context *sfctx, const char *what)
+{
+	struct timeval now;
+	long long msecs;
+
+	if ( gettimeofday(&now, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+
+	msecs = timeval_diff_msecs(&now, &sfctx->start_time);
+	if ( msecs <= 0 )
+		msecs = 1;
+
+	sieve_info(sfctx->data->ehandler, NULL,
+		"%s %u messages in %lld.%03lld seconds (%lld messages/s)",
+		what, sfctx->messages, msecs / 1000, msecs % 1000,
+		(long long)sfctx->messages * 1000 / msecs);
+}
+
+static int filter_mailbox_batch
+(struct sieve_filter_context *sfctx, struct mailbox *src_box,
+	struct mailbox_header_lookup_ctx *wanted_headers, bool *finished_r)
+{
+	const struct sieve_filter_data *sfdata = sfctx->data;
 	struct mailbox *move_box = sfdata->move_mailbox;
-	struct sieve_error_handler *ehandler = sfdata->ehandler;
 	struct mail_search_args *search_args;
 	struct mailbox_transaction_context *t;
 	struct mail_search_context *search_ctx;
 	struct mail *mail;
+	unsigned int count = 0;
 	int ret = 1;
 
-	/* Sync source mailbox */
-
-	if ( mailbox_sync(src_box, MAILBOX_SYNC_FLAG_FULL_READ) < 0 ) {
-		sieve_error(ehandler, NULL, "failed to sync source mailbox");
-		return -1;
-	}
-
-	/* Initialize */
-
-	memset(&sfctx, 0, sizeof(sfctx));
-	sfctx.data = sfdata;
-
-	/* Create test stream */
-	if ( !sfdata->execute )
-		sfctx.teststream = o_stream_create_fd(1, 0, FALSE);
+	*finished_r = TRUE;
 
 	/* Start move mailbox transaction */
 
 	if ( move_box != NULL ) {
-		sfctx.move_trans = mailbox_transaction_begin
+		sfctx->move_trans = mailbox_transaction_begin
 			(move_box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
 	}
 
-	/* Search non-deleted messages in the source folder */
+	/* Search non-deleted messages in the source folder that were not
+	   filtered in a previous batch */
 
 	search_args = mail_search_build_init();
 	mail_search_build_add_flags(search_args, MAIL_DELETED, TRUE);
+	if ( sfctx->last_uid > 0 ) {
+		mail_search_build_add_uid_range
+			(search_args, sfctx->last_uid + 1, (uint32_t)-1);
+	}
 
 	t = mailbox_transaction_begin(src_box, 0);
-	search_ctx = mailbox_search_init(t, search_args, NULL, 0, NULL);
+	search_ctx = mailbox_search_init(t, search_args, NULL,
+		MAIL_FETCH_VIRTUAL_SIZE, wanted_headers);
 	mail_search_args_unref(&search_args);
 
-	/* Iterate through all requested messages */
+	/* Iterate through the messages of this batch */
 
 	while ( ret >= 0 && mailbox_search_next(search_ctx, &mail) > 0 ) {
-		ret = filter_message(&sfctx, mail);
+		ret = filter_message(sfctx, mail);
+
+		sfctx->last_uid = mail->uid;
+		sfctx->messages++;
+		if ( sfdata->batch_size > 0 && ++count >= sfdata->batch_size ) {
+			*finished_r = FALSE;
+			break;
+		}
 	}
 
 	/* Cleanup */
@@ -319,8 +372,8 @@ static int filter_mailbox
 		ret = -1;
 	}
 
-	if ( sfctx.move_trans != NULL ) {
-		if ( mailbox_transaction_commit(&sfctx.move_trans) < 0 ) {
+	if ( sfctx->move_trans != NULL ) {
+		if ( mailbox_transaction_commit(&sfctx->move_trans) < 0 ) {
 			ret = -1;
 		}
 	}
@@ -329,11 +382,60 @@ static int filter_mailbox
 		ret = -1;
 	}
 
+	return ret;
+}
+
+static int filter_mailbox
+(const struct sieve_filter_data *sfdata, struct mailbox *src_box)
+{
+	struct sieve_filter_context sfctx;
+	struct sieve_error_handler *ehandler = sfdata->ehandler;
+	struct mailbox_header_lookup_ctx *wanted_headers;
+	bool finished = FALSE;
+	int ret = 1;
+
+	/* Sync source mailbox */
+
+	if ( mailbox_sync(src_box, MAILBOX_SYNC_FLAG_FULL_READ) < 0 ) {
+		sieve_error(ehandler, NULL, "failed to sync source mailbox");
+		return -1;
+	}
+
+	/* Initialize */
+
+	memset(&sfctx, 0, sizeof(sfctx));
+	sfctx.data = sfdata;
+	if ( gettimeofday(&sfctx.start_time, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+
+	/* Create test stream */
+	if ( !sfdata->execute )
+		sfctx.teststream = o_stream_create_fd(1, 0, FALSE);
+
+	wanted_headers = mailbox_header_lookup_init
+		(src_box, filter_wanted_headers);
+
+	/* Filter all messages; each batch is committed separately */
+
+	while ( ret >= 0 && !finished ) {
+		ret = filter_mailbox_batch
+			(&sfctx, src_box, wanted_headers, &finished);
+
+		if ( ret >= 0 && !finished )
+			filter_mailbox_progress(&sfctx, "progress: filtered");
+	}
+
+	/* Cleanup */
+
+	mailbox_header_lookup_unref(&wanted_headers);
+
 	if ( sfctx.teststream != NULL )
 		o_stream_destroy(&sfctx.teststream);
 
 	if ( ret < 0 ) return ret;
 
+	filter_mailbox_progress(&sfctx, "finished: filtered");
+
 	/* Sync mailbox */
 
 	if ( sfdata->execute ) {
@@ -364,7 +466,10 @@ int main(int argc, char **argv)
 {
 	struct sieve_instance *svinst;
 	ARRAY_TYPE (const_string) scriptfiles;
-	const char *scriptfile,	*src_mailbox, *dst_mailbox, *move_mailbox;
+	const char *scriptfile,	*src_mailbox, *dst_mailbox, *move_mailbox,
+		*tracefile;
+	struct sieve_trace_config tr_config;
+	struct ostream *tracestream = NULL;
 	struct sieve_filter_data sfdata;
 	enum sieve_filter_discard_action discard_action = SIEVE_FILTER_DACT_KEEP;
 	struct mail_user *mail_user;
@@ -376,19 +481,30 @@ int main(int argc, char **argv)
 	struct mailbox *src_box = NULL, *move_box = NULL;
 	enum mailbox_flags open_flags = MAILBOX_FLAG_IGNORE_ACLS;
 	enum mail_error error;
+	unsigned int batch_size = 0;
 	int c;
 
 	sieve_tool = sieve_tool_init("sieve-filter", &argc, &argv,
-		"m:s:x:P:u:q:Q:DCevW", FALSE);
+		"b:m:s:t:T:x:P:u:q:Q:DCevW", FALSE);
 
 	t_array_init(&scriptfiles, 16);
 
 	/* Parse arguments */
-	dst_mailbox = move_mailbox = NULL;
+	dst_mailbox = move_mailbox = tracefile = NULL;
 	force_compile = execute = source_write = default_move = FALSE;
 	verbose = FALSE;	
+	memset(&tr_config, 0, sizeof(tr_config));
+	tr_config.level = SIEVE_TRLVL_ACTIONS;
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
 		switch (c) {
+		case 'b':
+			/* batch size */
+			if ( str_to_uint(optarg, &batch_size) < 0 ) {
+				print_help();
+				i_fatal_status(EX_USAGE,
+					"Invalid <batch-size> argument: %s", optarg);
+			}
+			break;
 		case 'm':
 			/* default mailbox (keep box) */
 			dst_mailbox = optarg;
@@ -406,6 +522,14 @@ int main(int argc, char **argv)
 					"The -s argument is currently NOT IMPLEMENTED");
 			}
 			break;
+		case 't':
+			/* trace file */
+			tracefile = optarg;
+			break;
+		case 'T':
+			/* trace options */
+			sieve_tool_parse_trace_option(&tr_config, optarg);
+			break;
 		case 'q':
 			i_fatal_status(EX_USAGE,
 				"The -q argument is currently NOT IMPLEMENTED");
@@ -551,12 +675,18 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Create trace output stream */
+	if ( tracefile != NULL )
+		tracestream = sieve_tool_open_output_stream(tracefile);
+
 	/* Compose script environment */
 	memset(&scriptenv, 0, sizeof(scriptenv));
 	scriptenv.mailbox_autocreate = FALSE;
 	scriptenv.default_mailbox = dst_mailbox;
 	scriptenv.user = mail_user;
 	scriptenv.postmaster_address = "postmaster@example.com";
+	scriptenv.trace_stream = tracestream;
+	scriptenv.trace_config = tr_config;
 
 	/* Compose filter context */
 	memset(&sfdata, 0, sizeof(sfdata));
@@ -565,6 +695,7 @@ int main(int argc, char **argv)
 	sfdata.move_mailbox = move_box;
 	sfdata.main_sbin = main_sbin;
 	sfdata.ehandler = ehandler;
+	sfdata.batch_size = batch_size;
 	sfdata.execute = execute;
 	sfdata.source_write = source_write;
 	sfdata.default_move = default_move;
@@ -580,6 +711,10 @@ int main(int argc, char **argv)
 	if ( move_box != NULL )
 		mailbox_free(&move_box);
 
+	/* Close the trace stream */
+	if ( tracestream != NULL )
+		o_stream_destroy(&tracestream);
+
 	/* Cleanup error handler */
 	sieve_error_handler_unref(&ehandler);
 
@@ -17,6 +17,7 @@
 #include "sieve.h"
 #include "sieve-binary.h"
 #include "sieve-extensions.h"
+#include "sieve-profile.h"
 
 #include "sieve-tool.h"
 
@@ -43,8 +44,9 @@ static void print_help(void)
 	printf(
 "Usage: sieve-test [-a <orig-recipient-address] [-c <config-file>]\n"
 "                  [-C] [-D] [-d <dump-filename>] [-e]\n"
-"                  [-f <envelope-sender>] [-l <mail-location>]\n"
-"                  [-m <default-mailbox>] [-P <plugin>]\n"
+"                  [-f <envelope-sender>] [-F <folded-profile-file>]\n"
+"                  [-l <mail-location>] [-m <default-mailbox>]\n"
+"                  [-p <profile-file>] [-P <plugin>]\n"
 "                  [-r <recipient-address>] [-s <script-file>]\n"
 "                  [-t <trace-file>] [-T <trace-option>] [-x <extensions>]\n"
 "                  <script-file> <mail-file>\n"
@@ -114,6 +116,29 @@ static void duplicate_mark
 	i_info("marked duplicate for user %s.\n", senv->user->username);
 }
 
+/*
+ * Profile output
+ */
+
+static void sieve_test_write_profile
+(struct sieve_binary *sbin, struct sieve_profile *profile,
+	const char *profilefile, const char *foldedfile)
+{
+	struct ostream *output;
+
+	if ( profilefile != NULL && sbin != NULL ) {
+		output = sieve_tool_open_output_stream(profilefile);
+		sieve_dump_profile(sbin, profile, output);
+		o_stream_destroy(&output);
+	}
+
+	if ( foldedfile != NULL ) {
+		output = sieve_tool_open_output_stream(foldedfile);
+		sieve_profile_write_folded(profile, output);
+		o_stream_destroy(&output);
+	}
+}
+
 /*
  * Tool implementation
  */
@@ -123,7 +148,7 @@ int main(int argc, char **argv)
 	struct sieve_instance *svinst;
 	ARRAY_TYPE (const_string) scriptfiles;
 	const char *scriptfile, *recipient, *final_recipient, *sender, *mailbox,
-		*dumpfile, *tracefile, *mailfile, *mailloc;
+		*dumpfile, *tracefile, *profilefile, *foldedfile, *mailfile, *mailloc;
 	struct sieve_trace_config tr_config;
 	struct mail *mail;
 	struct sieve_binary *main_sbin, *sbin = NULL;
@@ -133,19 +158,20 @@ int main(int argc, char **argv)
 	struct sieve_error_handler *ehandler, *action_ehandler;
 	struct ostream *teststream = NULL;
 	struct ostream *tracestream = NULL;
+	struct sieve_profile *profile = NULL;
 	bool force_compile = FALSE, execute = FALSE;
 	int exit_status = EXIT_SUCCESS;
 	int ret, c;
 
 	sieve_tool = sieve_tool_init
-		("sieve-test", &argc, &argv, "r:a:f:m:d:l:s:eCt:T:DP:x:u:", FALSE);
+		("sieve-test", &argc, &argv, "r:a:f:F:m:d:l:p:s:eCt:T:DP:x:u:", FALSE);
 
 	ehandler = action_ehandler = NULL;
 	t_array_init(&scriptfiles, 16);
 
 	/* Parse arguments */
 	recipient = final_recipient = sender = mailbox = dumpfile =
-		tracefile = mailloc = NULL;
+		tracefile = profilefile = foldedfile = mailloc = NULL;
 	memset(&tr_config, 0, sizeof(tr_config));
 	tr_config.level = SIEVE_TRLVL_ACTIONS;
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
@@ -177,11 +203,24 @@ int main(int argc, char **argv)
 			/* trace options */
 		case 'T':
 			sieve_tool_parse_trace_option(&tr_config, optarg);
+			if ( tr_config.sample_interval > 1 ) {
+				i_fatal_status(EX_USAGE,
+					"The -Tsample= trace option is not useful for sieve-test, "
+					"which processes a single message");
+			}
 			break;
 		case 'd':
 			/* dump file */
 			dumpfile = optarg;
 			break;
+		case 'p':
+			/* profile file */
+			profilefile = optarg;
+			break;
+		case 'F':
+			/* folded profile file */
+			foldedfile = optarg;
+			break;
 		case 's':
 			/* scriptfile executed before main script */
 			{
@@ -290,6 +329,9 @@ int main(int argc, char **argv)
 		if ( tracefile != NULL )
 			tracestream = sieve_tool_open_output_stream(tracefile);
 
+		if ( profilefile != NULL || foldedfile != NULL )
+			profile = sieve_profile_create();
+
 		/* Compose script environment */
 		memset(&scriptenv, 0, sizeof(scriptenv));
 		scriptenv.default_mailbox = mailbox;
@@ -303,6 +345,7 @@ int main(int argc, char **argv)
 		scriptenv.duplicate_check = duplicate_check;
 		scriptenv.trace_stream = tracestream;
 		scriptenv.trace_config = tr_config;
+		scriptenv.profile = profile;
 		scriptenv.exec_status = &estatus;
 
 		/* Run the test */
@@ -413,6 +456,13 @@ int main(int argc, char **argv)
 		if ( teststream != NULL )
 			o_stream_destroy(&teststream);
 
+		/* Write profile of the main script */
+		if ( profile != NULL ) {
+			sieve_test_write_profile((main_sbin != NULL ? main_sbin : sbin),
+				profile, profilefile, foldedfile);
+			sieve_profile_free(&profile);
+		}
+
 		/* Cleanup remaining binaries */
 		if ( sbin != NULL )
 			sieve_close(&sbin);
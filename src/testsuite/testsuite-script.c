@@ -10,6 +10,7 @@
 #include "sieve-interpreter.h"
 #include "sieve-runtime-trace.h"
 #include "sieve-result.h"
+#include "sieve-profile.h"
 
 #include "testsuite-common.h"
 #include "testsuite-settings.h"
@@ -22,12 +23,17 @@
  * Tested script environment
  */
 
+/* Profile of the last script run */
+static struct sieve_profile *testsuite_script_profile = NULL;
+
 void testsuite_script_init(void)
 {
 }
 
 void testsuite_script_deinit(void)
 {
+	if ( testsuite_script_profile != NULL )
+		sieve_profile_free(&testsuite_script_profile);
 }
 
 static struct sieve_binary *_testsuite_script_compile
@@ -119,6 +125,11 @@ bool testsuite_script_run(const struct sieve_runtime_env *renv)
 	scriptenv.trace_stream = renv->scriptenv->trace_stream;
 	scriptenv.trace_config = renv->scriptenv->trace_config;
 
+	if ( testsuite_script_profile != NULL )
+		sieve_profile_free(&testsuite_script_profile);
+	testsuite_script_profile = sieve_profile_create();
+	scriptenv.profile = testsuite_script_profile;
+
 	result = testsuite_result_get();
 
 	/* Execute the script */
@@ -136,6 +147,12 @@ bool testsuite_script_run(const struct sieve_runtime_env *renv)
                 (ictx->compiled_script, testsuite_ext) >= 0 );
 }
 
+void testsuite_script_get_profile_stacks(string_t *out)
+{
+	if ( testsuite_script_profile != NULL )
+		sieve_profile_write_stacks(testsuite_script_profile, out);
+}
+
 struct sieve_binary *testsuite_script_get_binary(const struct sieve_runtime_env *renv)
 {
 	struct testsuite_interpreter_context *ictx =
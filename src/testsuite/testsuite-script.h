@@ -19,6 +19,9 @@ bool testsuite_script_multiscript
 	(const struct sieve_runtime_env *renv,
 		ARRAY_TYPE (const_string) *scriptfiles);
 
+/* Appends the stacks of operations executed by the last script run */
+void testsuite_script_get_profile_stacks(string_t *out);
+
 struct sieve_binary *testsuite_script_get_binary(const struct sieve_runtime_env *renv);
 void testsuite_script_set_binary(const struct sieve_runtime_env *renv, struct sieve_binary *sbin);
 
@@ -28,6 +28,7 @@ struct testsuite_smtp_message {
 static pool_t testsuite_smtp_pool;
 static const char *testsuite_smtp_tmp;
 static ARRAY(struct testsuite_smtp_message) testsuite_smtp_messages;
+static unsigned int testsuite_smtp_transactions;
 
 /*
  * Initialize
@@ -48,6 +49,7 @@ void testsuite_smtp_init(void)
 	}
 
 	p_array_init(&testsuite_smtp_messages, pool, 16);
+	testsuite_smtp_transactions = 0;
 }
 
 void testsuite_smtp_deinit(void)
@@ -81,6 +83,7 @@ void *testsuite_smtp_start
 	unsigned int smtp_count = array_count(&testsuite_smtp_messages);
 	int fd;
 
+	testsuite_smtp_transactions++;
 	smtp = i_new(struct testsuite_smtp, 1);
 
 	smtp->msg_file = i_strdup_printf("%s/%d.eml", testsuite_smtp_tmp, smtp_count);
@@ -151,3 +154,8 @@ bool testsuite_smtp_get
 
 	return TRUE;
 }
+
+unsigned int testsuite_smtp_get_transaction_count(void)
+{
+	return testsuite_smtp_transactions;
+}
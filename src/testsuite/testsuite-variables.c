@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "str.h"
 
 #include "sieve-common.h"
 #include "sieve-ast.h"
@@ -16,6 +17,8 @@
 #include "sieve-ext-variables.h"
 
 #include "testsuite-common.h"
+#include "testsuite-smtp.h"
+#include "testsuite-script.h"
 #include "testsuite-variables.h"
 
 /*
@@ -149,10 +152,17 @@ int testsuite_varnamespace_read_variable
 	}
 
 	if ( str_r != NULL ) {
-		if ( strcmp(str_c(var_name), "path") == 0 )
+		if ( strcmp(str_c(var_name), "path") == 0 ) {
 			*str_r = t_str_new_const(testsuite_test_path, strlen(testsuite_test_path));
-		else
+		} else if ( strcmp(str_c(var_name), "smtp_transactions") == 0 ) {
+			*str_r = t_str_new(16);
+			str_printfa(*str_r, "%u", testsuite_smtp_get_transaction_count());
+		} else if ( strcmp(str_c(var_name), "profile") == 0 ) {
+			*str_r = t_str_new(256);
+			testsuite_script_get_profile_stacks(*str_r);
+		} else {
 			*str_r = NULL;
+		}
 	}
 	return SIEVE_EXEC_OK;
 }
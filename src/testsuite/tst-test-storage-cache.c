@@ -0,0 +1,163 @@
+/* Copyright (c) 2002-2016 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "sieve-common.h"
+#include "sieve-commands.h"
+#include "sieve-validator.h"
+#include "sieve-generator.h"
+#include "sieve-interpreter.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-dump.h"
+#include "sieve-storage-private.h"
+
+#include "testsuite-common.h"
+
+/* Seconds a value stored by this test stays in the cache */
+#define TESTSUITE_STORAGE_CACHE_TTL 60
+
+/*
+ * Test_storage_cache command
+ *
+ * Syntax:
+ *   test_storage_cache <key: string> <value: string>
+ *
+ * Looks up the key in the storage lookup cache the way a storage driver does.
+ * Yields true when the cached value is found. Otherwise the value is cached,
+ * as if it were looked up in the storage, and false is yielded.
+ */
+
+static bool tst_test_storage_cache_validate
+	(struct sieve_validator *valdtr, struct sieve_command *cmd);
+static bool tst_test_storage_cache_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd);
+
+const struct sieve_command_def tst_test_storage_cache = {
+	.identifier = "test_storage_cache",
+	.type = SCT_TEST,
+	.positional_args = 2,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.validate = tst_test_storage_cache_validate,
+	.generate = tst_test_storage_cache_generate
+};
+
+/*
+ * Operation
+ */
+
+static bool tst_test_storage_cache_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int tst_test_storage_cache_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def test_storage_cache_operation = {
+	.mnemonic = "TEST_STORAGE_CACHE",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_STORAGE_CACHE,
+	.dump = tst_test_storage_cache_operation_dump,
+	.execute = tst_test_storage_cache_operation_execute
+};
+
+/*
+ * Validation
+ */
+
+static bool tst_test_storage_cache_validate
+(struct sieve_validator *valdtr ATTR_UNUSED, struct sieve_command *tst)
+{
+	struct sieve_ast_argument *arg = tst->first_positional;
+
+	if ( !sieve_validate_positional_argument
+		(valdtr, tst, arg, "key", 1, SAAT_STRING) ) {
+		return FALSE;
+	}
+
+	if ( !sieve_validator_argument_activate(valdtr, tst, arg, FALSE) )
+		return FALSE;
+
+	arg = sieve_ast_argument_next(arg);
+
+	if ( !sieve_validate_positional_argument
+		(valdtr, tst, arg, "value", 2, SAAT_STRING) ) {
+		return FALSE;
+	}
+
+	return sieve_validator_argument_activate(valdtr, tst, arg, FALSE);
+}
+
+/*
+ * Code generation
+ */
+
+static bool tst_test_storage_cache_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *tst)
+{
+	sieve_operation_emit(cgenv->sblock, tst->ext, &test_storage_cache_operation);
+
+	/* Generate arguments */
+	return sieve_generate_arguments(cgenv, tst, NULL);
+}
+
+/*
+ * Code dump
+ */
+
+static bool tst_test_storage_cache_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address)
+{
+	sieve_code_dumpf(denv, "TEST_STORAGE_CACHE:");
+	sieve_code_descend(denv);
+
+	return
+		sieve_opr_string_dump(denv, address, "key") &&
+		sieve_opr_string_dump(denv, address, "value");
+}
+
+/*
+ * Intepretation
+ */
+
+static int tst_test_storage_cache_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address)
+{
+	string_t *key, *value;
+	const char *const *values;
+	const char *new_value;
+	unsigned int count;
+	bool result;
+	int ret;
+
+	/*
+	 * Read operands
+	 */
+
+	if ( (ret=sieve_opr_string_read(renv, address, "key", &key)) <= 0 )
+		return ret;
+	if ( (ret=sieve_opr_string_read(renv, address, "value", &value)) <= 0 )
+		return ret;
+
+	/*
+	 * Perform operation
+	 */
+
+	if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_TESTS) ) {
+		sieve_runtime_trace(renv, 0, "testsuite: test_storage_cache test");
+		sieve_runtime_trace_descend(renv);
+	}
+
+	if ( sieve_storage_cache_lookup(str_c(key), &values, &count) ) {
+		result = ( count == 1 && strcmp(values[0], str_c(value)) == 0 );
+	} else {
+		new_value = str_c(value);
+		sieve_storage_cache_update
+			(str_c(key), &new_value, 1, TESTSUITE_STORAGE_CACHE_TTL);
+		result = FALSE;
+	}
+
+	/* Set result */
+	sieve_interpreter_set_test_result(renv->interp, result);
+
+	return SIEVE_EXEC_OK;
+}